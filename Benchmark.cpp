@@ -0,0 +1,956 @@
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "SerialLink.h"
+#ifndef _WIN32
+#include <fcntl.h> // for O_RDWR, O_NOCTTY
+#include <poll.h> // for poll()
+#include <termios.h> // for cfmakeraw()
+#include <unistd.h> // for read(), write(), close()
+#endif
+
+/*
+Heap allocations of the whole program, counted by replacing the global operator new when the program is
+built with BENCH_COUNT_ALLOCATIONS, always 0 otherwise. Only read by the command benchmark
+*/
+static std::atomic<unsigned long long> allocations(0);
+#ifdef BENCH_COUNT_ALLOCATIONS
+void* operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void* memory = malloc((size > 0) ? size : 1);
+	if (memory == nullptr) throw std::bad_alloc();
+	return memory;
+}
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+void operator delete[](void* memory) noexcept
+{
+	free(memory);
+}
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+void operator delete[](void* memory, size_t) noexcept
+{
+	free(memory);
+}
+#endif
+
+/*
+@allocations counted over BENCH_COMMANDS updates
+Returns the allocations per update to print, empty if they are not counted
+*/
+static string allocationsPerUpdate(unsigned long long count)
+{
+#ifdef BENCH_COUNT_ALLOCATIONS
+	std::stringstream text;
+	text << ", " << static_cast<double>(count) / BENCH_COMMANDS << " allocations per update";
+	return text.str();
+#else
+	(void)count;
+	return "";
+#endif
+}
+
+// Benchmark
+Benchmark::Benchmark() : VideoParameters(parameter::off, parameter::off, parameter::off)
+{
+	// Ideal camera if no calibration is available
+	VideoParameters::loadCameraCalibrationOrIdeal();
+}
+bool Benchmark::run(string name)
+{
+	if (name == "pose")
+		Benchmark::poseSolver();
+	else if (name == "tiles")
+		Benchmark::tiledDetection();
+	else if (name == "scenes")
+		Benchmark::syntheticScenes();
+	else if (name == "mpc")
+		Benchmark::modelPredictiveControl();
+	else if (name == "command")
+		Benchmark::commandFormatting();
+	else if (name == "link")
+		Benchmark::serialLink();
+	else if (name == "drones")
+		Benchmark::droneRegistry();
+	else if (name == "kalman")
+		Benchmark::kalmanFilter();
+	else if (name == "undistort")
+		Benchmark::undistortion();
+	else if (name == "pid")
+		Benchmark::pidRegulator();
+	else
+	{
+		cout << "Unknown benchmark '" << name << "'. Available: pose, tiles, scenes, mpc, command, link, drones, kalman, undistort, pid" << endl;
+		return false;
+	}
+	return true;
+}
+void Benchmark::poseSolver()
+{
+	cout << "Pose solver benchmark: " << BENCH_POSES << " poses solved " << BENCH_REPEAT << " times each" << endl;
+	std::mt19937 generator(1);
+
+	// Random scenes: drone marker first, then other markers in view
+	vector<vector<vector<cv::Point2f>>> scenes(BENCH_POSES);
+	vector<std::pair<cv::Vec3d, cv::Vec3d>> truth(BENCH_POSES);
+	for (size_t i = 0; i < scenes.size(); i++)
+	{
+		for (size_t m = 0; m < BENCH_MARKERS; m++)
+		{
+			std::pair<cv::Vec3d, cv::Vec3d> pose = Benchmark::randomPose(generator);
+			vector<cv::Point2f> corners;
+			Benchmark::projectMarker(pose.first, pose.second, corners);
+			scenes.at(i).push_back(corners);
+			if (m == 0) truth.at(i) = pose;
+		}
+	}
+
+	MarkerPose markerPose(QR_CODE_SIZE);
+	markerPose.setCalibration(this->cameraMatrix, this->distanceCoeff);
+	vector<cv::Vec3d> rotationVector, translationVector;
+	vector<vector<cv::Point2f>> droneOnly(1);
+	cv::Vec3d rvec, tvec;
+
+	// Call made by videoProcessing before, every marker in view solved
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < BENCH_REPEAT; r++)
+		for (size_t i = 0; i < scenes.size(); i++)
+			cv::aruco::estimatePoseSingleMarkers(scenes.at(i), QR_CODE_SIZE, this->cameraMatrix, this->distanceCoeff, rotationVector, translationVector);
+	double allMarkers = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (BENCH_REPEAT * BENCH_POSES);
+
+	// Same OpenCV call, drone marker only
+	start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < BENCH_REPEAT; r++)
+		for (size_t i = 0; i < scenes.size(); i++)
+		{
+			droneOnly.at(0) = scenes.at(i).at(0);
+			cv::aruco::estimatePoseSingleMarkers(droneOnly, QR_CODE_SIZE, this->cameraMatrix, this->distanceCoeff, rotationVector, translationVector);
+		}
+	double oneMarker = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (BENCH_REPEAT * BENCH_POSES);
+
+	// In-tree solver, drone marker only
+	start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < BENCH_REPEAT; r++)
+		for (size_t i = 0; i < scenes.size(); i++)
+			markerPose.estimate(scenes.at(i).at(0), rvec, tvec);
+	double solver = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (BENCH_REPEAT * BENCH_POSES);
+
+	// Agreement with OpenCV and with the true pose
+	double maxTranslation = 0, maxRotation = 0, maxTranslationTruth = 0;
+	for (size_t i = 0; i < scenes.size(); i++)
+	{
+		droneOnly.at(0) = scenes.at(i).at(0);
+		cv::aruco::estimatePoseSingleMarkers(droneOnly, QR_CODE_SIZE, this->cameraMatrix, this->distanceCoeff, rotationVector, translationVector);
+		markerPose.estimate(scenes.at(i).at(0), rvec, tvec);
+
+		cv::Matx33d R1, R2;
+		cv::Rodrigues(rotationVector.at(0), R1);
+		cv::Rodrigues(rvec, R2);
+		cv::Matx33d D = R1.t() * R2;
+		double angle = std::acos(std::max(-1.0, std::min(1.0, (D(0, 0) + D(1, 1) + D(2, 2) - 1.0) / 2.0))) * 180.0 / CV_PI;
+		maxRotation = std::max(maxRotation, angle);
+		maxTranslation = std::max(maxTranslation, cv::norm(translationVector.at(0) - tvec));
+		maxTranslationTruth = std::max(maxTranslationTruth, cv::norm(truth.at(i).second - tvec));
+	}
+
+	cout << "\t- estimatePoseSingleMarkers, " << BENCH_MARKERS << " markers in view: " << allMarkers << " us" << endl;
+	cout << "\t- estimatePoseSingleMarkers, drone marker only: " << oneMarker << " us" << endl;
+	cout << "\t- MarkerPose::estimate: " << solver << " us (x" << allMarkers / solver << " vs all markers, x" << oneMarker / solver << " vs drone only)" << endl;
+	cout << "\t- Max difference with OpenCV: " << maxTranslation * 1000 << " mm, " << maxRotation << " deg" << endl;
+	cout << "\t- Max error with true pose: " << maxTranslationTruth * 1000 << " mm" << endl;
+}
+void Benchmark::tiledDetection()
+{
+	cout << "Tiled detection benchmark: " << BENCH_FRAMES << " frames per resolution, "
+		<< std::thread::hardware_concurrency() << " hardware threads" << endl;
+	std::mt19937 generator(1);
+	vector<cv::Size> resolutions = { cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080) };
+	vector<vector<cv::Point2f>> corners, rejected, referenceCorners;
+	vector<int> ids, referenceIds;
+
+	for (size_t r = 0; r < resolutions.size(); r++)
+	{
+		vector<cv::Mat> frames(BENCH_FRAMES);
+		for (size_t f = 0; f < frames.size(); f++)
+			Benchmark::markerScene(resolutions.at(r), generator, frames.at(f));
+		cout << "\t- " << resolutions.at(r).width << "x" << resolutions.at(r).height << ":" << endl;
+
+		double single = 0.0;
+		for (unsigned int threads = 1; threads <= BENCH_MAX_THREADS; threads *= 2)
+		{
+			ThreadPool pool(threads);
+			// Full resolution, full frame, every detection goes through the tiles
+			MarkerDetector detector(this->droneMarker, 0.f, parameter::off, 1);
+			detector.setThreadPool(&pool);
+			MarkerDetector reference(this->droneMarker, 0.f, parameter::off, 1);
+
+			double elapsed = 0.0, maxDifference = 0.0;
+			int missing = 0, extra = 0;
+			for (size_t f = 0; f < frames.size(); f++)
+			{
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				detector.detect(frames.at(f), corners, ids, rejected);
+				elapsed += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+				// Same markers and corners as a single detectMarkers call on the whole frame
+				reference.detect(frames.at(f), referenceCorners, referenceIds, rejected);
+				int matched = 0;
+				for (size_t i = 0; i < referenceIds.size(); i++)
+				{
+					size_t k = std::find(ids.begin(), ids.end(), referenceIds.at(i)) - ids.begin();
+					if (k == ids.size()) { missing++; continue; }
+					matched++;
+					for (size_t j = 0; j < referenceCorners.at(i).size(); j++)
+						maxDifference = std::max(maxDifference, cv::norm(corners.at(k).at(j) - referenceCorners.at(i).at(j)));
+				}
+				extra += static_cast<int>(ids.size()) - matched;
+			}
+			elapsed /= frames.size();
+			if (threads == 1) single = elapsed;
+
+			cout << "\t\t- " << threads << " thread" << ((threads == 1) ? ": " : "s:") << elapsed << " ms/frame (x" << single / elapsed
+				<< "), missing " << missing << ", extra " << extra << ", max corner difference " << maxDifference << " px, "
+				<< detector.getTileFallbacks() << " whole-image searches" << endl;
+		}
+	}
+}
+void Benchmark::syntheticScenes()
+{
+	SceneGenerator generator(BENCH_DISTRACTORS, 1);
+	cout << "Synthetic scene benchmark: " << generator.getSize().width << "x" << generator.getSize().height << ", "
+		<< BENCH_SCENE_FRAMES << " frames per trajectory (hover, orbit, approach), " << BENCH_DISTRACTORS << " distractors" << endl;
+
+	const int conditionCount = 3;
+	const char* conditionNames[conditionCount] = { "clean", "blur + noise", "dim, uneven light" };
+	SceneConditions conditions[conditionCount] = { { 0.0, 0.0, 1.0, 0.0, 0.0 }, { 1.2, 6.0, 1.0, 0.0, 0.0 }, { 0.6, 4.0, 0.45, 8.0, 0.5 } };
+	const int scaleCount = 3;
+	int scales[scaleCount] = { 1, 2, 4 };
+
+	MarkerPose markerPose(QR_CODE_SIZE);
+	markerPose.setCalibration(generator.getCameraMatrix(), generator.getDistanceCoeff());
+	vector<vector<cv::Point2f>> corners, rejected;
+	vector<int> ids;
+	vector<cv::Mat> frames(BENCH_SCENE_FRAMES);
+	vector<std::pair<cv::Vec3d, cv::Vec3d>> truth(BENCH_SCENE_FRAMES);
+
+	for (int c = 0; c < conditionCount; c++)
+	{
+		generator.setConditions(conditions[c]);
+		vector<double> translationErrors[scaleCount], rotationErrors[scaleCount];
+		// Difference with the full-resolution pose of the same frame, both searched on the full frame at their scale
+		vector<double> translationDifferences[scaleCount], rotationDifferences[scaleCount];
+		vector<std::pair<cv::Vec3d, cv::Vec3d>> fullResolution(frames.size());
+		vector<bool> fullResolutionFound(frames.size());
+		double elapsed[scaleCount] = { 0.0, 0.0, 0.0 };
+		int total = 0;
+
+		for (int trajectory = sceneTrajectory::hover; trajectory <= sceneTrajectory::approach; trajectory++)
+		{
+			for (size_t f = 0; f < frames.size(); f++)
+			{
+				truth.at(f) = generator.trajectoryPose(static_cast<sceneTrajectory>(trajectory), f / SCENE_FPS);
+				generator.render(truth.at(f).first, truth.at(f).second, frames.at(f));
+			}
+			total += static_cast<int>(frames.size());
+
+			for (int s = 0; s < scaleCount; s++)
+			{
+				MarkerDetector detector(this->droneMarker, 500.f, parameter::on, scales[s]);
+				for (size_t f = 0; f < frames.size(); f++)
+				{
+					// Same work as videoProcessing for one frame
+					cv::Vec3d rvec, tvec;
+					bool found = false;
+					std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+					if (detector.detect(frames.at(f), corners, ids, rejected))
+						for (size_t i = 0; i < ids.size(); i++)
+							if (ids.at(i) == this->droneMarker)
+							{
+								found = markerPose.estimate(corners.at(i), rvec, tvec);
+								break;
+							}
+					elapsed[s] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+					if (!found) continue;
+
+					cv::Matx33d R1, R2;
+					cv::Rodrigues(truth.at(f).first, R1);
+					cv::Rodrigues(rvec, R2);
+					cv::Matx33d D = R1.t() * R2;
+					rotationErrors[s].push_back(std::acos(std::max(-1.0, std::min(1.0, (D(0, 0) + D(1, 1) + D(2, 2) - 1.0) / 2.0))) * 180.0 / CV_PI);
+					translationErrors[s].push_back(1000.0 * cv::norm(tvec - truth.at(f).second));
+				}
+
+				// Tracking would keep a small marker at full resolution, every frame goes through the pyramid here
+				MarkerDetector pyramid(this->droneMarker, 0.f, parameter::off, scales[s]);
+				for (size_t f = 0; f < frames.size(); f++)
+				{
+					cv::Vec3d rvec, tvec;
+					bool found = false;
+					if (pyramid.detect(frames.at(f), corners, ids, rejected))
+						for (size_t i = 0; i < ids.size(); i++)
+							if (ids.at(i) == this->droneMarker)
+							{
+								found = markerPose.estimate(corners.at(i), rvec, tvec);
+								break;
+							}
+					if (s == 0)
+					{
+						fullResolutionFound.at(f) = found;
+						fullResolution.at(f) = std::make_pair(rvec, tvec);
+						continue;
+					}
+					if (!found || !fullResolutionFound.at(f)) continue;
+
+					cv::Matx33d R1, R2;
+					cv::Rodrigues(fullResolution.at(f).first, R1);
+					cv::Rodrigues(rvec, R2);
+					cv::Matx33d D = R1.t() * R2;
+					rotationDifferences[s].push_back(std::acos(std::max(-1.0, std::min(1.0, (D(0, 0) + D(1, 1) + D(2, 2) - 1.0) / 2.0))) * 180.0 / CV_PI);
+					translationDifferences[s].push_back(cv::norm(tvec - fullResolution.at(f).second) / cv::norm(fullResolution.at(f).second));
+				}
+			}
+		}
+
+		cout << "\t- " << conditionNames[c] << ":" << endl;
+		for (int s = 0; s < scaleCount; s++)
+		{
+			std::sort(translationErrors[s].begin(), translationErrors[s].end());
+			std::sort(rotationErrors[s].begin(), rotationErrors[s].end());
+			cout << "\t\t- scale 1/" << scales[s] << ": " << elapsed[s] / total << " ms/frame (" << 1000.0 * total / elapsed[s] << " frames/s), detected "
+				<< 100.0 * translationErrors[s].size() / total << " %, translation error median " << Benchmark::percentile(translationErrors[s], 0.5)
+				<< " mm p95 " << Benchmark::percentile(translationErrors[s], 0.95) << " mm, rotation error median "
+				<< Benchmark::percentile(rotationErrors[s], 0.5) << " deg p95 " << Benchmark::percentile(rotationErrors[s], 0.95) << " deg" << endl;
+			if (s == 0) continue;
+
+			std::sort(translationDifferences[s].begin(), translationDifferences[s].end());
+			std::sort(rotationDifferences[s].begin(), rotationDifferences[s].end());
+			double translation = Benchmark::percentile(translationDifferences[s], 0.95), rotation = Benchmark::percentile(rotationDifferences[s], 0.95);
+			cout << "\t\t  vs scale 1 on " << translationDifferences[s].size() << " frames: position difference median "
+				<< 100.0 * Benchmark::percentile(translationDifferences[s], 0.5) << " % p95 " << 100.0 * translation << " % of the distance, rotation difference median "
+				<< Benchmark::percentile(rotationDifferences[s], 0.5) << " deg p95 " << rotation << " deg, "
+				<< (((translation <= PYRAMID_TRANSLATION_TOLERANCE) && (rotation <= PYRAMID_ROTATION_TOLERANCE)) ? "within" : "OUT OF") << " tolerance" << endl;
+		}
+	}
+}
+void Benchmark::modelPredictiveControl()
+{
+	cout << "MPC benchmark: horizon " << MPC_HORIZON << ", " << MPC_STATES << " states, " << MPC_INPUTS << " inputs, budget "
+		<< MPC_TIME_BUDGET << " ms per solve" << endl;
+	std::mt19937 generator(1);
+	std::normal_distribution<double> noise(0.0, 0.002);
+	std::uniform_real_distribution<double> step(-0.5, 0.5);
+
+	// Closed loop on the model of the regulator, pose noise of 2 mm (2 mrad), new setpoint every 3 s
+	MpcRegulator warm;
+	double dt = 1.0 / MPC_RATE;
+	double gain[MPC_INPUTS] = { MPC_THRUST_GAIN, MPC_THRUST_GAIN, MPC_THRUST_GAIN, MPC_YAW_GAIN };
+	cv::Vec<double, MPC_STATES> x(0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 0.0, 0.0), reference = x, measured;
+	cv::Vec<double, MPC_INPUTS> u;
+	double error = 0.0;
+	for (int i = 0; i < BENCH_MPC_STEPS; i++)
+	{
+		if (i % 90 == 0)
+			reference = cv::Vec<double, MPC_STATES>(step(generator), step(generator), 1.0 + step(generator), step(generator), 0.0, 0.0, 0.0, 0.0);
+		measured = x;
+		for (int axis = 0; axis < MPC_INPUTS; axis++)
+			measured[axis] += noise(generator);
+		warm.solve(measured, reference, u);
+		for (int axis = 0; axis < MPC_INPUTS; axis++)
+		{
+			x[axis] += x[MPC_INPUTS + axis] * dt + 0.5 * gain[axis] * u[axis] * dt * dt;
+			x[MPC_INPUTS + axis] += gain[axis] * u[axis] * dt;
+		}
+		// Tracking error 1 s after each step
+		if (i % 90 == 30)
+			error += cv::norm(cv::Vec3d(x[0] - reference[0], x[1] - reference[1], x[2] - reference[2]));
+	}
+	cout << "\t- Closed loop, warm started, " << BENCH_MPC_STEPS << " solves (mean position error 1 s after a step: "
+		<< 1000.0 * error / (BENCH_MPC_STEPS / 90) << " mm):" << endl;
+	warm.printMpcState();
+
+	// Worst case: every solve from an unrelated state
+	MpcRegulator cold;
+	std::uniform_real_distribution<double> state(-1.0, 1.0);
+	for (int i = 0; i < BENCH_MPC_COLD; i++)
+	{
+		for (int s = 0; s < MPC_STATES; s++)
+			x[s] = state(generator);
+		cold.reset();
+		cold.solve(x, reference, u);
+	}
+	cout << "\t- Cold started, " << BENCH_MPC_COLD << " solves from random states:" << endl;
+	cold.printMpcState();
+}
+void Benchmark::commandFormatting()
+{
+	cout << "Command benchmark: " << BENCH_COMMANDS << " updates per path" << endl;
+#ifndef BENCH_COUNT_ALLOCATIONS
+	cout << "Heap allocations not counted, build with BENCH_COUNT_ALLOCATIONS defined (see Benchmark.h)." << endl;
+#endif
+	std::mt19937 generator(1);
+	std::uniform_int_distribution<int> value(MIN_CONTROL_VALUE - 100, MAX_CONTROL_VALUE + 100);
+	vector<int> inputs(4 * 1024);
+	for (size_t i = 0; i < inputs.size(); i++)
+		inputs.at(i) = value(generator);
+	size_t mask = inputs.size() - 4;
+	unsigned long long before, sent;
+	std::chrono::steady_clock::time_point start;
+
+	// Regulator output: set all values, format, compare with the last command sent
+	ControlMode control(mode::automatic, regulator::pid, filter::filteroff, cv::Vec3d(0, 0, 1));
+	ControlCommand command, last;
+	sent = 0;
+	before = allocations.load();
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < BENCH_COMMANDS; i++)
+	{
+		const int* v = &inputs[(4 * i) & mask];
+		control.setAllControlValues(v[0], v[1], v[2], v[3]);
+		command = control.getCommand();
+		if (command != last)
+		{
+			last = command;
+			sent += last.length;
+		}
+	}
+	double regulatorTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_COMMANDS;
+	unsigned long long regulatorAllocations = allocations.load() - before;
+
+	// External controller: clamp and format the values read from shared memory, one channel stepped by hand in between
+	before = allocations.load();
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < BENCH_COMMANDS; i++)
+	{
+		const int* v = &inputs[(4 * i) & mask];
+		command.set(v[0], v[1], v[2], v[3]);
+		control.setControlValue(controlChannel::rollChannel, control.getControlValue(controlChannel::rollChannel) + 25);
+		if (command != last)
+		{
+			last = command;
+			sent += last.length;
+		}
+	}
+	double externalTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_COMMANDS;
+	unsigned long long externalAllocations = allocations.load() - before;
+
+	// Former path: std::stringstream into a std::string, string comparison
+	string stringCommand, stringLast;
+	before = allocations.load();
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < BENCH_COMMANDS; i++)
+	{
+		const int* v = &inputs[(4 * i) & mask];
+		std::stringstream convert;
+		convert << std::max(MIN_CONTROL_VALUE, std::min(MAX_CONTROL_VALUE, v[0])) << "," << std::max(MIN_CONTROL_VALUE, std::min(MAX_CONTROL_VALUE, v[1])) << ","
+			<< std::max(MIN_CONTROL_VALUE, std::min(MAX_CONTROL_VALUE, v[2])) << "," << std::max(MIN_CONTROL_VALUE, std::min(MAX_CONTROL_VALUE, v[3]));
+		stringCommand = convert.str();
+		if (stringCommand != stringLast)
+		{
+			stringLast = stringCommand;
+			sent += stringLast.size();
+		}
+	}
+	double stringTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_COMMANDS;
+	unsigned long long stringAllocations = allocations.load() - before;
+
+	cout << "\t- Regulator path (setAllControlValues, getCommand, compare): " << regulatorTime << " ns"
+		<< allocationsPerUpdate(regulatorAllocations) << endl;
+	cout << "\t- External controller path (ControlCommand::set, compare): " << externalTime << " ns"
+		<< allocationsPerUpdate(externalAllocations) << endl;
+	cout << "\t- std::stringstream and std::string: " << stringTime << " ns"
+		<< allocationsPerUpdate(stringAllocations) << endl;
+	cout << "\t  (" << sent << " characters sent)" << endl;
+
+	// Binary frames: encode, then decode with the reference decoder, 1 byte in 100 corrupted
+	uint8_t frame[DRACO_FRAME_SIZE];
+	uint16_t channels[DRACO_FRAME_CHANNELS];
+	draco_frame_decoder decoder;
+	draco_frame decoded;
+	draco_decoder_reset(&decoder);
+	std::uniform_int_distribution<int> corruption(0, 99), bit(0, 7);
+	unsigned long long intact = 0, wrong = 0;
+	before = allocations.load();
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < BENCH_COMMANDS; i++)
+	{
+		const int* v = &inputs[(4 * i) & mask];
+		command.set(v[0], v[1], v[2], v[3]);
+		for (int c = 0; c < DRACO_FRAME_CHANNELS; c++)
+			channels[c] = static_cast<uint16_t>(command.values[c]);
+		draco_encode(frame, static_cast<uint16_t>(i), channels);
+		for (int b = 0; b < DRACO_FRAME_SIZE; b++)
+		{
+			uint8_t byte = frame[b];
+			if (corruption(generator) == 0)
+				byte ^= static_cast<uint8_t>(1 << bit(generator));
+			if (draco_decode(&decoder, byte, &decoded))
+			{
+				if ((decoded.sequence == static_cast<uint16_t>(i)) && std::equal(channels, channels + DRACO_FRAME_CHANNELS, decoded.channels)) intact++;
+				else wrong++;
+			}
+		}
+	}
+	double frameTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / BENCH_COMMANDS;
+	unsigned long long frameAllocations = allocations.load() - before;
+	cout << "\t- Binary frame, encode and reference decode (1 byte in 100 corrupted): " << frameTime << " ns"
+		<< allocationsPerUpdate(frameAllocations) << endl;
+	cout << "\t  " << intact << " frames decoded intact, " << wrong << " decoded wrong, " << decoder.errors << " candidates rejected" << endl;
+	// 10 bits per byte on the line (start, 8 data, stop)
+	cout << "\t- Link time per command at " << SERIAL_BAUD_RATE << " baud: binary frame " << 10000.0 * DRACO_FRAME_SIZE / SERIAL_BAUD_RATE
+		<< " ms (" << DRACO_FRAME_SIZE << " bytes), text " << 10000.0 * MAX_DATA_LENGTH / SERIAL_BAUD_RATE << " ms (" << MAX_DATA_LENGTH << " bytes)" << endl;
+}
+void Benchmark::serialLink()
+{
+#ifdef _WIN32
+	cout << "Link benchmark: needs a pseudo-terminal, POSIX only." << endl;
+#else
+	const unsigned int bauds[3] = { 57600, 115200, 460800 };
+	const double rates[4] = { 30.0, 100.0, 300.0, 1000.0 };
+	cout << "Link benchmark: emulated Arduino on a pseudo-terminal, " << BENCH_LINK_DURATION << " ms per line" << endl;
+	for (size_t b = 0; b < 3; b++)
+	{
+		for (int binary = 1; binary >= 0; binary--)
+		{
+			cout << "\t- " << bauds[b] << " baud, " << ((binary == 1) ? "binary frames" : "text commands") << ":" << endl;
+			for (size_t r = 0; r < 4; r++)
+			{
+				// Pseudo-terminal, the far end is raw like the Arduino's UART
+				int master = posix_openpt(O_RDWR | O_NOCTTY);
+				if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0))
+				{
+					cout << "\tERROR: Could not create a pseudo-terminal." << endl;
+					if (master >= 0) close(master);
+					return;
+				}
+				struct termios raw;
+				tcgetattr(master, &raw);
+				cfmakeraw(&raw);
+				tcsetattr(master, TCSANOW, &raw);
+				string name = ptsname(master);
+
+				// The Arduino boots while the port opens, the constructor returns on its ready byte
+				std::atomic<bool> running(true);
+				std::atomic<unsigned long long> delivered(0);
+				std::thread arduino(&Benchmark::emulateArduino, this, master, bauds[b], binary == 1, std::ref(running), std::ref(delivered));
+				SerialPort* port = new SerialPort(&name[0u], bauds[b]);
+				SerialLink link;
+				link.setBinary((binary == 1) ? parameter::on : parameter::off);
+				link.open(port);
+
+				// Commands posted at a fixed rate, every one different like a regulator output
+				ControlCommand command;
+				std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / rates[r]));
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now(), next = start;
+				for (int i = 0; std::chrono::steady_clock::now() - start < std::chrono::milliseconds(BENCH_LINK_DURATION); i++)
+				{
+					command.set(MIN_CONTROL_VALUE + 1 + i % 999, ROLL_DEF, PITCH_DEF, YAW_DEF);
+					link.post(command, false);
+					next += period;
+					std::this_thread::sleep_until(next);
+				}
+				double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				unsigned long long deliveredDuringPosting = delivered.load();
+				// Let the line drain for the acks, then stop both ends
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				link.close();
+				running = false;
+				arduino.join();
+				close(master);
+
+				LatencyHistogram& queue = link.getQueueToWire();
+				LatencyHistogram& roundTrip = link.getRoundTrip();
+				cout << "\t\t- " << rates[r] << " Hz: " << deliveredDuringPosting / elapsed << " commands/s delivered, " << link.getSuperseded()
+					<< " superseded, " << link.getFailed() << " failed writes, queue to wire p50 " << queue.percentile(0.5) << " ms p99 " << queue.percentile(0.99) << " ms";
+				if (binary == 1)
+					cout << ", round trip p50 " << roundTrip.percentile(0.5) << " ms p99 " << roundTrip.percentile(0.99) << " ms (" << link.getAcks() << " acks)";
+				cout << endl;
+			}
+		}
+	}
+#endif
+}
+void Benchmark::droneRegistry()
+{
+	cout << "Drone registry benchmark: " << BENCH_DRONE_FRAMES << " frames per number of drones, one detection per frame" << endl;
+	// The drones carry the markers of the distractors, IDs 10 and up
+	SceneGenerator generator(MAX_DRONES, 1);
+	std::pair<cv::Vec3d, cv::Vec3d> pose = generator.trajectoryPose(sceneTrajectory::hover, 0.0);
+	cv::Mat frame;
+	generator.render(pose.first, pose.second, frame);
+	ThreadPool pool(0);
+	vector<vector<cv::Point2f>> corners, rejected;
+	vector<int> ids;
+
+	double single = 0.0;
+	for (int count = 1; count <= MAX_DRONES; count *= 2)
+	{
+		// Same work as the video and control threads for one frame, full frame search as with several drones
+		MarkerDetector detector(this->droneMarker, 0.f, parameter::off, DETECTION_SCALE);
+		detector.setThreadPool(&pool);
+		DroneRegistry registry;
+		registry.setCalibration(generator.getCameraMatrix(), generator.getDistanceCoeff());
+		for (int d = 0; d < count; d++)
+			registry.add(10 + d, cv::Vec3d(0.0, 0.0, 1.5), nullptr);
+
+		double detection = 0.0, dispatch = 0.0, control = 0.0;
+		size_t found = 0;
+		std::chrono::steady_clock::time_point capture = std::chrono::steady_clock::now();
+		for (int f = 0; f < BENCH_DRONE_FRAMES; f++)
+		{
+			// Frames 33 ms apart for the regulators
+			capture += std::chrono::milliseconds(33);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			detector.detect(frame, corners, ids, rejected);
+			std::chrono::steady_clock::time_point detected = std::chrono::steady_clock::now();
+			found += registry.dispatch(ids, corners, capture);
+			std::chrono::steady_clock::time_point dispatched = std::chrono::steady_clock::now();
+			registry.control(true, true);
+			std::chrono::steady_clock::time_point controlled = std::chrono::steady_clock::now();
+			detection += std::chrono::duration<double, std::milli>(detected - start).count();
+			dispatch += std::chrono::duration<double, std::milli>(dispatched - detected).count();
+			control += std::chrono::duration<double, std::milli>(controlled - dispatched).count();
+		}
+		double total = (detection + dispatch + control) / BENCH_DRONE_FRAMES;
+		if (count == 1) single = total;
+		cout << "\t- " << count << " drone" << ((count == 1) ? ": " : "s: ") << total << " ms/frame (detection " << detection / BENCH_DRONE_FRAMES
+			<< " ms, dispatch and poses " << 1000.0 * dispatch / BENCH_DRONE_FRAMES << " us, control " << 1000.0 * control / BENCH_DRONE_FRAMES
+			<< " us), x" << total / single << " the cost of 1 drone, x" << count * single / total << " faster than one pipeline per drone, "
+			<< static_cast<double>(found) / BENCH_DRONE_FRAMES << " drones found per frame" << endl;
+	}
+}
+void Benchmark::kalmanFilter()
+{
+	cout << "Kalman filter benchmark: " << BENCH_KALMAN_FRAMES << " poses per trajectory, noise " << KALMAN_LATERAL_NOISE * 1000 << " mm laterally, "
+		<< KALMAN_DEPTH_NOISE * 1000 << " mm in depth, " << KALMAN_ANGLE_NOISE << " rad" << endl;
+	SceneGenerator scene(0, 1);
+	std::mt19937 generator(1);
+	std::normal_distribution<double> noise(0.0, 1.0);
+	const char* names[3] = { "hover", "orbit", "approach" };
+
+	for (int trajectory = sceneTrajectory::hover; trajectory <= sceneTrajectory::approach; trajectory++)
+	{
+		PoseFilter filter;
+		vector<double> updateTimes, rawErrors, filteredErrors, rawAngles, filteredAngles, bridgedErrors;
+		int rejected = 0, flips = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int f = 0; f < BENCH_KALMAN_FRAMES; f++)
+		{
+			std::pair<cv::Vec3d, cv::Vec3d> truth = scene.trajectoryPose(static_cast<sceneTrajectory>(trajectory), f / SCENE_FPS);
+			cv::Matx33d truthRotation = PoseFilter::vectorToRotation(truth.first);
+			std::chrono::steady_clock::time_point capture = start + std::chrono::microseconds(static_cast<long long>(1e6 * f / SCENE_FPS));
+			cv::Vec3d rvec, tvec;
+
+			// Missed frames, the pose is predicted
+			if ((f % BENCH_KALMAN_DROPOUT == BENCH_KALMAN_DROPOUT - 2) || (f % BENCH_KALMAN_DROPOUT == BENCH_KALMAN_DROPOUT - 1))
+			{
+				if (filter.predict(capture, rvec, tvec))
+					bridgedErrors.push_back(1000.0 * cv::norm(tvec - truth.second));
+				continue;
+			}
+
+			// Detection with the noise of MarkerPose, or flipped by 35 degrees
+			cv::Vec3d measuredT = truth.second + cv::Vec3d(KALMAN_LATERAL_NOISE * noise(generator), KALMAN_LATERAL_NOISE * noise(generator), KALMAN_DEPTH_NOISE * noise(generator));
+			bool flip = (f % BENCH_KALMAN_FLIP == BENCH_KALMAN_FLIP - 1);
+			cv::Vec3d perturbation = (flip) ? cv::Vec3d(0.6, 0.0, 0.0) : cv::Vec3d(noise(generator), noise(generator), noise(generator)) * KALMAN_ANGLE_NOISE;
+			cv::Vec3d measuredR = MarkerPose::rotationToVector(truthRotation * PoseFilter::vectorToRotation(perturbation));
+			flips += (flip) ? 1 : 0;
+
+			std::chrono::steady_clock::time_point before = std::chrono::steady_clock::now();
+			bool accepted = filter.update(measuredR, measuredT, capture);
+			updateTimes.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - before).count());
+			rejected += (accepted) ? 0 : 1;
+			if (flip || (f < SCENE_FPS) || !filter.predict(capture, rvec, tvec)) continue;
+
+			// Errors once the filter has settled
+			rawErrors.push_back(1000.0 * cv::norm(measuredT - truth.second));
+			filteredErrors.push_back(1000.0 * cv::norm(tvec - truth.second));
+			rawAngles.push_back(cv::norm(MarkerPose::rotationToVector(truthRotation.t() * PoseFilter::vectorToRotation(measuredR))) * 180.0 / CV_PI);
+			filteredAngles.push_back(cv::norm(MarkerPose::rotationToVector(truthRotation.t() * PoseFilter::vectorToRotation(rvec))) * 180.0 / CV_PI);
+		}
+		std::sort(updateTimes.begin(), updateTimes.end());
+		std::sort(rawErrors.begin(), rawErrors.end());
+		std::sort(filteredErrors.begin(), filteredErrors.end());
+		std::sort(rawAngles.begin(), rawAngles.end());
+		std::sort(filteredAngles.begin(), filteredAngles.end());
+		std::sort(bridgedErrors.begin(), bridgedErrors.end());
+
+		cout << "\t- " << names[trajectory] << ":" << endl;
+		cout << "\t\t- Update: p50 " << Benchmark::percentile(updateTimes, 0.5) << " us, p99 " << Benchmark::percentile(updateTimes, 0.99) << " us" << endl;
+		cout << "\t\t- Translation error median: raw " << Benchmark::percentile(rawErrors, 0.5) << " mm, filtered " << Benchmark::percentile(filteredErrors, 0.5)
+			<< " mm (p95 " << Benchmark::percentile(rawErrors, 0.95) << " mm, " << Benchmark::percentile(filteredErrors, 0.95) << " mm)" << endl;
+		cout << "\t\t- Rotation error median: raw " << Benchmark::percentile(rawAngles, 0.5) << " deg, filtered " << Benchmark::percentile(filteredAngles, 0.5) << " deg" << endl;
+		cout << "\t\t- Missed frames: " << bridgedErrors.size() << " predicted, error median " << Benchmark::percentile(bridgedErrors, 0.5)
+			<< " mm p95 " << Benchmark::percentile(bridgedErrors, 0.95) << " mm" << endl;
+		cout << "\t\t- Flipped poses: " << flips << ", rejected detections " << rejected << endl;
+	}
+}
+void Benchmark::undistortion()
+{
+	cout << "Undistortion benchmark: " << BENCH_UNDISTORT_CORNERS << " corners and " << BENCH_UNDISTORT_FRAMES << " previews per resolution" << endl;
+	std::mt19937 generator(1);
+
+	// Lens of the calibration, or of a typical webcam if the calibration has none
+	cv::Mat distortion = this->distanceCoeff.clone();
+	if (cv::countNonZero(distortion) == 0)
+	{
+		cout << "No distortion in the calibration, using a typical webcam lens." << endl;
+		distortion = (cv::Mat_<double>(5, 1) << -0.3, 0.12, 0.001, -0.001, -0.02);
+	}
+
+	vector<cv::Size> resolutions = { cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080) };
+	for (size_t r = 0; r < resolutions.size(); r++)
+	{
+		// Same field of view at every resolution
+		cv::Size size = resolutions.at(r);
+		double focal = 0.9 * size.width;
+		cv::Mat camera = (cv::Mat_<double>(3, 3) << focal, 0, size.width / 2.0, 0, focal, size.height / 2.0, 0, 0, 1);
+		MarkerPose iterative(QR_CODE_SIZE), lookup(QR_CODE_SIZE);
+		iterative.setCalibration(camera, distortion);
+		lookup.setCalibration(camera, distortion);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		lookup.setImageSize(size);
+		double build = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		// A second solver of the same calibration and size, as a drone of the registry
+		MarkerPose other(QR_CODE_SIZE);
+		other.setCalibration(camera, distortion);
+		start = std::chrono::steady_clock::now();
+		other.setImageSize(size);
+		double share = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::uniform_real_distribution<float> x(0.f, static_cast<float>(size.width - 1)), y(0.f, static_cast<float>(size.height - 1));
+		vector<cv::Point2f> corners(BENCH_UNDISTORT_CORNERS), opencv(BENCH_UNDISTORT_CORNERS);
+		for (size_t i = 0; i < corners.size(); i++)
+			corners.at(i) = cv::Point2f(x(generator), y(generator));
+		vector<cv::Vec2d> reference(corners.size()), looked(corners.size());
+
+		// One call per marker, as cv::aruco::estimatePoseSingleMarkers does
+		vector<cv::Point2f> marker(4), undistorted;
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < corners.size(); i += 4)
+		{
+			marker.assign(corners.begin() + i, corners.begin() + i + 4);
+			cv::undistortPoints(marker, undistorted, camera, distortion);
+			std::copy(undistorted.begin(), undistorted.end(), opencv.begin() + i);
+		}
+		double opencvTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / corners.size();
+
+		// Converged fixed point, the reference of the errors
+		start = std::chrono::steady_clock::now();
+		iterative.undistortPoints(corners.data(), reference.data(), corners.size());
+		double iterativeTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / corners.size();
+
+		start = std::chrono::steady_clock::now();
+		lookup.undistortPoints(corners.data(), looked.data(), corners.size());
+		double lookupTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / corners.size();
+
+		// Errors in pixels of the undistorted image
+		vector<double> opencvError(corners.size()), lookupError(corners.size());
+		for (size_t i = 0; i < corners.size(); i++)
+		{
+			opencvError.at(i) = focal * cv::norm(cv::Vec2d(opencv.at(i).x, opencv.at(i).y) - reference.at(i));
+			lookupError.at(i) = focal * cv::norm(looked.at(i) - reference.at(i));
+		}
+		std::sort(opencvError.begin(), opencvError.end());
+		std::sort(lookupError.begin(), lookupError.end());
+
+		// Preview of the webcam window, the maps are built once per calibration and frame size
+		double scale = std::min(1.0, PREVIEW_WIDTH / static_cast<double>(size.width));
+		cv::Size previewSize(cvRound(size.width * scale), cvRound(size.height * scale));
+		cv::Mat previewCamera = camera * scale;
+		previewCamera.at<double>(2, 2) = 1.0;
+		cv::Mat preview(previewSize, CV_8UC3), remapped, map1, map2;
+		cv::randu(preview, cv::Scalar::all(0), cv::Scalar::all(255));
+		start = std::chrono::steady_clock::now();
+		cv::initUndistortRectifyMap(previewCamera, distortion, cv::Mat(), previewCamera, previewSize, CV_16SC2, map1, map2);
+		double mapTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		start = std::chrono::steady_clock::now();
+		for (int f = 0; f < BENCH_UNDISTORT_FRAMES; f++)
+			cv::remap(preview, remapped, map1, map2, cv::INTER_LINEAR);
+		double remapTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / BENCH_UNDISTORT_FRAMES;
+
+		cout << "\t- " << size.width << "x" << size.height << ": grid of " << lookup.getGridSize() << " nodes ("
+			<< lookup.getGridSize() * sizeof(cv::Vec2f) / 1024 << " kB) built in " << build << " ms, shared by another solver in " << share << " ms" << endl;
+		cout << "\t\t- cv::undistortPoints, 4 corners per call: " << opencvTime << " ns/corner, error p50 "
+			<< Benchmark::percentile(opencvError, 0.5) << " px, max " << opencvError.back() << " px" << endl;
+		cout << "\t\t- MarkerPose, iterated to convergence: " << iterativeTime << " ns/corner" << endl;
+		cout << "\t\t- MarkerPose, lookup grid: " << lookupTime << " ns/corner (x" << opencvTime / lookupTime << " vs OpenCV, x"
+			<< iterativeTime / lookupTime << " vs iterated), error p50 " << Benchmark::percentile(lookupError, 0.5) << " px, max " << lookupError.back() << " px" << endl;
+		cout << "\t\t- Preview " << previewSize.width << "x" << previewSize.height << ": maps built in " << mapTime << " ms, remap "
+			<< remapTime << " ms/frame" << endl;
+	}
+}
+void Benchmark::pidRegulator()
+{
+	cout << "PID benchmark: double integrator at " << BENCH_PID_RATE << " Hz, " << BENCH_PID_PLANT_GAIN << " m/s^2 (rad/s^2) per unit of command, "
+		<< BENCH_PID_OFFSET << " m (rad) from the setpoint" << endl;
+	const char* names[PID_AXES] = { "x (roll)", "y (throttle)", "z (pitch)", "yaw" };
+	const cv::Vec3d setpoint(0.0, 0.0, 1.5);
+	const double target[PID_AXES] = { setpoint[0], setpoint[1], setpoint[2], 0.0 };
+	const double dt = 1.0 / BENCH_PID_RATE;
+	const int steps = static_cast<int>(BENCH_PID_DURATION * BENCH_PID_RATE);
+	const cv::Matx33d facing(1, 0, 0, 0, -1, 0, 0, 0, -1);
+
+	for (int axis = 0; axis < PID_AXES; axis++)
+	{
+		PidRegulator regulator;
+		double position[PID_AXES], velocity[PID_AXES], acceleration[PID_AXES];
+		for (int a = 0; a < PID_AXES; a++)
+		{
+			position[a] = target[a];
+			velocity[a] = acceleration[a] = 0.0;
+		}
+		position[axis] += BENCH_PID_OFFSET;
+		std::chrono::steady_clock::time_point timestamp = std::chrono::steady_clock::now();
+		double settled = -1.0, overshoot = 0.0;
+		for (int k = 0; k < steps; k++)
+		{
+			// Marker facing the camera, turned by the yaw
+			double psi = position[pidAxis::yawAxis];
+			cv::Matx33d yaw(std::cos(psi), 0, std::sin(psi), 0, 1, 0, -std::sin(psi), 0, std::cos(psi));
+			int throttle, roll, pitch, yawCommand;
+			if (regulator.update(cv::Vec3d(position[0], position[1], position[2]), MarkerPose::rotationToVector(yaw * facing), setpoint, timestamp,
+				throttle, roll, pitch, yawCommand))
+			{
+				// More throttle moves the drone towards -y
+				acceleration[pidAxis::xAxis] = BENCH_PID_PLANT_GAIN * (roll - ROLL_DEF);
+				acceleration[pidAxis::yAxis] = -BENCH_PID_PLANT_GAIN * (throttle - PID_HOVER_THROTTLE);
+				acceleration[pidAxis::zAxis] = BENCH_PID_PLANT_GAIN * (pitch - PITCH_DEF);
+				acceleration[pidAxis::yawAxis] = BENCH_PID_PLANT_GAIN * (yawCommand - YAW_DEF);
+			}
+			// Command held until the next pose
+			for (int a = 0; a < PID_AXES; a++)
+			{
+				velocity[a] += acceleration[a] * dt;
+				position[a] += velocity[a] * dt;
+			}
+			timestamp += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(dt));
+
+			// The offset is positive, overshoot is on the other side of the setpoint
+			double error = position[axis] - target[axis];
+			overshoot = std::max(overshoot, -error);
+			if (std::fabs(error) > BENCH_PID_TOLERANCE) settled = -1.0;
+			else if (settled < 0.0) settled = (k + 1) * dt;
+		}
+
+		double unit = (axis == pidAxis::yawAxis) ? 1.0 : 1000.0;
+		const char* name = (axis == pidAxis::yawAxis) ? " rad" : " mm";
+		cout << "\t- " << names[axis] << ": ";
+		if (settled >= 0.0) cout << "settled in " << settled << " s";
+		else cout << "not settled after " << BENCH_PID_DURATION << " s";
+		cout << ", overshoot " << overshoot * unit << name << ", final error " << (position[axis] - target[axis]) * unit << name << endl;
+	}
+}
+void Benchmark::emulateArduino(int fd, unsigned int baud, bool binary, std::atomic<bool>& running, std::atomic<unsigned long long>& delivered)
+{
+#ifndef _WIN32
+	// 10 bits per byte on the line (start, 8 data, stop)
+	std::chrono::steady_clock::duration byteTime = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(10.0 / baud));
+	std::chrono::steady_clock::time_point lineFree = std::chrono::steady_clock::now(), lastTelemetry = lineFree;
+	draco_frame_decoder decoder;
+	draco_decoder_reset(&decoder);
+	uint8_t bytes[64], uplink[DRACO_UPLINK_SIZE];
+	size_t textBytes = 0;
+	uint16_t telemetry = 0;
+	// Reset by the opening of the port, the setup ends with the ready byte
+	std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_LINK_BOOT));
+	const char ready = ARDUINO_READY_BYTE;
+	if (write(fd, &ready, 1) != 1) return;
+	while (running.load())
+	{
+		struct pollfd descriptor = { fd, POLLIN, 0 };
+		if (poll(&descriptor, 1, 10) <= 0) continue;
+		// Small reads, the bytes arrive at the pace of the line
+		ssize_t count = read(fd, bytes, 16);
+		if (count <= 0) continue;
+		lineFree = std::max(lineFree, std::chrono::steady_clock::now()) + count * byteTime;
+		std::this_thread::sleep_until(lineFree);
+		for (ssize_t i = 0; i < count; i++)
+		{
+			draco_frame frame;
+			if (binary && draco_decode(&decoder, bytes[i], &frame))
+			{
+				delivered++;
+				draco_uplink ack = { DRACO_UPLINK_ACK, 1, frame.sequence, 0, 0 };
+				draco_encode_uplink(uplink, &ack);
+				if (write(fd, uplink, DRACO_UPLINK_SIZE) != DRACO_UPLINK_SIZE) return;
+			}
+			else if (!binary && (++textBytes == MAX_DATA_LENGTH))
+			{
+				delivered++;
+				textBytes = 0;
+			}
+		}
+		if (std::chrono::steady_clock::now() - lastTelemetry >= std::chrono::seconds(1))
+		{
+			lastTelemetry = std::chrono::steady_clock::now();
+			draco_uplink state = { DRACO_UPLINK_TELEMETRY, 255, telemetry++, 12000, 0 };
+			draco_encode_uplink(uplink, &state);
+			if (write(fd, uplink, DRACO_UPLINK_SIZE) != DRACO_UPLINK_SIZE) return;
+		}
+	}
+#else
+	(void)fd; (void)baud; (void)binary; (void)running; (void)delivered;
+#endif
+}
+void Benchmark::projectMarker(cv::Vec3d rvec, cv::Vec3d tvec, vector<cv::Point2f>& corners)
+{
+	float half = QR_CODE_SIZE / 2.f;
+	vector<cv::Point3f> model = { cv::Point3f(-half, half, 0), cv::Point3f(half, half, 0),
+		cv::Point3f(half, -half, 0), cv::Point3f(-half, -half, 0) };
+	cv::projectPoints(model, rvec, tvec, this->cameraMatrix, this->distanceCoeff, corners);
+}
+std::pair<cv::Vec3d, cv::Vec3d> Benchmark::randomPose(std::mt19937& generator)
+{
+	std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+	// Marker facing the camera (rotation of pi around x), tilted up to ~25 deg, any yaw
+	cv::Vec3d rvec(CV_PI + 0.4 * uniform(generator), 0.4 * uniform(generator), 0.0);
+	cv::Matx33d tilt, yaw;
+	cv::Rodrigues(rvec, tilt);
+	cv::Rodrigues(cv::Vec3d(0, 0, CV_PI * uniform(generator)), yaw);
+	cv::Rodrigues(tilt * yaw, rvec);
+	cv::Vec3d tvec(0.3 * uniform(generator), 0.2 * uniform(generator), 1.2 + 0.6 * uniform(generator));
+	return std::make_pair(rvec, tvec);
+}
+void Benchmark::markerScene(cv::Size size, std::mt19937& generator, cv::Mat& frame)
+{
+	frame.create(size, CV_8UC1);
+	cv::randn(frame, cv::Scalar::all(180), cv::Scalar::all(20));
+	cv::Ptr<cv::aruco::Dictionary> dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::PREDEFINED_DICTIONARY_NAME::DICT_4X4_100);
+
+	// One marker per cell of a grid so that markers never overlap, from 4 % of the frame height to the largest
+	// that fits a cell with its white border (a third of the height at 16:9), above the tile overlap sized
+	// from TILE_MARKER_SIZE so that markers only found by the whole-image search are there too
+	int cols = 3, rows = 2;
+	int cellWidth = size.width / cols, cellHeight = size.height / rows;
+	double smallest = 0.04 * size.height, largest = 2.0 * std::min(cellWidth, cellHeight) / 3.0;
+	vector<int> cells(cols * rows);
+	for (size_t i = 0; i < cells.size(); i++) cells.at(i) = static_cast<int>(i);
+	std::shuffle(cells.begin(), cells.end(), generator);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	cv::Mat marker;
+	for (int m = 0; m < BENCH_MARKERS; m++)
+	{
+		int side = static_cast<int>(smallest + (largest - smallest) * uniform(generator));
+		int border = side / 4;
+		cv::aruco::drawMarker(dictionary, (m == 0) ? this->droneMarker : m + 10, side, marker);
+		int x = (cells.at(m) % cols) * cellWidth + border + static_cast<int>((cellWidth - side - 2 * border) * uniform(generator));
+		int y = (cells.at(m) / cols) * cellHeight + border + static_cast<int>((cellHeight - side - 2 * border) * uniform(generator));
+		frame(cv::Rect(x - border, y - border, side + 2 * border, side + 2 * border)).setTo(cv::Scalar::all(255));
+		marker.copyTo(frame(cv::Rect(x, y, side, side)));
+	}
+}
+double Benchmark::percentile(const vector<double>& sorted, double fraction)
+{
+	if (sorted.empty()) return 0.0;
+	size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+	return sorted.at(std::min(index, sorted.size() - 1));
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "VideoParameters.h"
+#include "MarkerPose.h"
+#include "MarkerDetector.h"
+#include "SceneGenerator.h"
+#include "MpcRegulator.h"
+#include "ControlMode.h"
+#include "SerialPort.h"
+#include "draco_serial.h"
+#include "DroneRegistry.h"
+#include "PoseFilter.h"
+#include "PidRegulator.h"
+#include "FrameDisplay.h"
+
+// Uncomment (or define for the project) to count the heap allocations of the command benchmark, the global
+// operator new is then replaced and every allocation of the program pays an atomic increment
+//#define BENCH_COUNT_ALLOCATIONS
+
+#define BENCH_POSES 1000 // number of random marker poses per benchmark
+#define BENCH_REPEAT 20 // number of times each pose is solved
+#define BENCH_MARKERS 4 // markers in view when estimatePoseSingleMarkers solves all detections
+#define BENCH_FRAMES 20 // number of frames detected per resolution and thread count
+#define BENCH_MAX_THREADS 8 // largest thread pool tested
+#define BENCH_SCENE_FRAMES 60 // synthetic frames rendered per trajectory and condition
+#define BENCH_DISTRACTORS 3 // markers other than the drone in the synthetic scenes
+#define BENCH_MPC_STEPS 6000 // closed-loop MPC solves, 200 s at camera rate
+#define BENCH_MPC_COLD 1000 // MPC solves from random states without warm start
+#define BENCH_COMMANDS 1000000 // command updates per path of the command benchmark
+#define BENCH_LINK_DURATION 1000 // ms of posting per baud rate, framing and command rate of the link benchmark
+#define BENCH_LINK_BOOT 50 // ms the emulated Arduino takes to send its ready byte, as after the reset
+#define BENCH_DRONE_FRAMES 100 // frames processed per number of drones
+#define BENCH_KALMAN_FRAMES 3000 // noisy poses filtered per trajectory, 100 s at camera rate
+#define BENCH_KALMAN_DROPOUT 50 // every this many frames, the marker is missed on two frames
+#define BENCH_KALMAN_FLIP 97 // every this many frames, the detection is a flipped pose
+#define BENCH_UNDISTORT_CORNERS 100000 // random corners undistorted per resolution, a multiple of 4
+#define BENCH_UNDISTORT_FRAMES 100 // previews remapped per resolution
+#define BENCH_PID_RATE 30.0 // Hz, poses given to the PID
+#define BENCH_PID_DURATION 10.0 // s simulated per axis
+#define BENCH_PID_PLANT_GAIN 0.01 // m/s^2 (rad/s^2 for yaw) per unit of command from its default, simulated drone
+#define BENCH_PID_OFFSET 0.4 // m (rad for yaw), initial distance of the drone to the setpoint
+#define BENCH_PID_TOLERANCE 0.02 // m (rad for yaw), an axis is settled once it stays this close to the setpoint
+
+/*
+Class to run microbenchmarks of the processing pipeline without camera nor drone
+Started from the command line: DRACO bench <name>
+*/
+class Benchmark : private VideoParameters
+{
+	public:
+		Benchmark(); // Constructor of the class, loads the calibration file or an ideal camera
+
+		/*
+		@name of the benchmark
+		Runs the benchmark, returns false if the name is unknown
+		*/
+		bool run(string);
+		// Compares MarkerPose with cv::aruco::estimatePoseSingleMarkers on random marker poses
+		void poseSolver();
+		// Compares tile-parallel detection on 1 to BENCH_MAX_THREADS threads at several resolutions
+		void tiledDetection();
+		// Runs detection and pose estimation at each detection scale on synthetic scenes, reports throughput and pose error
+		void syntheticScenes();
+		// Runs the MPC in closed loop on its own model with noise and setpoint steps, reports solve time percentiles
+		void modelPredictiveControl();
+		// Runs the command updates of the control loop, reports time and heap allocations per update against string formatting,
+		// and the serial link time of binary frames against text, with the reference decoder on a corrupted stream
+		void commandFormatting();
+		// Posts commands through SerialLink to an emulated Arduino on a pseudo-terminal, reports delivered commands/s,
+		// latencies and drops per baud rate, framing and command rate (POSIX only)
+		void serialLink();
+		// Runs one detection per frame on a synthetic scene and dispatches it to 1 to MAX_DRONES drones,
+		// reports the cost per frame of detection, dispatch and control against one pipeline per drone
+		void droneRegistry();
+		// Filters noisy poses of the synthetic trajectories with missed frames and flipped poses, reports update time,
+		// error of the raw and filtered poses and error of the poses predicted through the missed frames
+		void kalmanFilter();
+		// Undistorts random corners with cv::undistortPoints, the iterative MarkerPose solution and its lookup grid,
+		// reports the cost per corner, the error against the converged solution and the cost of the preview remap
+		void undistortion();
+		// Closes the loop of the PID on a simulated double integrator, one axis away from the setpoint at a time,
+		// reports settling time, overshoot and final error per axis
+		void pidRegulator();
+
+	private:
+		/*
+		@rotation vector of the marker
+		@translation vector of the marker
+		@corners out, in pixels
+		Projects the corners of a marker with the camera calibration
+		*/
+		void projectMarker(cv::Vec3d, cv::Vec3d, vector<cv::Point2f>&);
+
+		/*
+		@random generator
+		Returns a random pose in front of the camera, marker facing the camera
+		*/
+		std::pair<cv::Vec3d, cv::Vec3d> randomPose(std::mt19937&);
+
+		/*
+		@size of the frame
+		@random generator
+		@frame out
+		Draws BENCH_MARKERS markers of random size and position on a noisy background
+		*/
+		void markerScene(cv::Size, std::mt19937&, cv::Mat&);
+
+		/*
+		@sorted values
+		@fraction, 0.5 for the median
+		Returns the value at a fraction of the sorted values, 0 if there is none
+		*/
+		double percentile(const vector<double>&, double);
+
+		/*
+		@file descriptor of the far end of the pseudo-terminal
+		@baud rate emulated, bytes are consumed at the pace of the line
+		@true for binary frames, false for text commands of MAX_DATA_LENGTH bytes
+		@false to stop
+		@commands decoded out
+		Emulated Arduino: sends the ready byte after BENCH_LINK_BOOT ms, decodes the commands, answers every frame
+		with an ack and sends telemetry every second
+		*/
+		void emulateArduino(int, unsigned int, bool, std::atomic<bool>&, std::atomic<unsigned long long>&);
+};
+
+#endif // BENCHMARK_H
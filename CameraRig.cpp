@@ -0,0 +1,267 @@
+#include "stdafx.h"
+#include "CameraRig.h"
+
+// Camera of the rig
+CameraWorker::CameraWorker(int webcam, int target) :
+	detector(target, RIG_FALLBACK_DELAY, parameter::on, DETECTION_SCALE),
+	markerPose(QR_CODE_SIZE)
+{
+	this->index = webcam;
+	this->rotation = cv::Matx33d::eye();
+	this->translation = cv::Vec3d(0, 0, 0);
+	this->registered = false;
+	this->observation.valid = false;
+	this->detections = 0;
+}
+
+// Camera rig
+CameraRig::CameraRig(int target) : VideoParameters(parameter::off, parameter::off, parameter::off)
+{
+	this->droneMarker = target;
+	this->reference = -1;
+	this->referenceObservation.valid = false;
+	this->running = false;
+}
+CameraRig::~CameraRig()
+{
+	CameraRig::stop();
+}
+int CameraRig::start(int referenceWebcam)
+{
+	CameraRig::stop();
+	// The video thread adds its observations and the console prints the rig meanwhile
+	CameraRig::mu.lock();
+	this->reference = referenceWebcam;
+	this->referenceObservation.valid = false;
+	CameraRig::mu.unlock();
+	this->running = true;
+
+	// Built aside, the video and console threads read the cameras under the lock
+	vector<CameraWorker*> started;
+	for (int i = 0; i < MAX_CAMERAS; i++)
+	{
+		if (i == referenceWebcam) continue;
+
+		CameraWorker* camera = new CameraWorker(i, this->droneMarker);
+		if (!camera->grabber.start(i))
+		{
+			delete camera;
+			continue;
+		}
+
+		// Calibration of this camera if it has one, else the calibration of the reference camera
+		if (!VideoParameters::loadCameraCalibration(CALIBDATA_CAMERA_FILE + std::to_string(i) + ".txt"))
+			VideoParameters::loadCameraCalibration();
+		camera->markerPose.setCalibration(this->cameraMatrix, this->distanceCoeff);
+		CameraRig::loadExtrinsics(camera);
+
+		camera->thread = std::thread(&CameraRig::cameraLoop, this, camera);
+		started.push_back(camera);
+	}
+	int count = static_cast<int>(started.size());
+	if (started.empty()) this->running = false;
+	CameraRig::mu.lock();
+	this->cameras.swap(started);
+	CameraRig::mu.unlock();
+	return count;
+}
+void CameraRig::stop()
+{
+	this->running = false;
+	// Taken out under the lock, joined outside of it as the camera threads take it to add their observations
+	vector<CameraWorker*> stopped;
+	CameraRig::mu.lock();
+	this->cameras.swap(stopped);
+	CameraRig::mu.unlock();
+	for (size_t i = 0; i < stopped.size(); i++)
+	{
+		if (stopped.at(i)->thread.joinable())
+			stopped.at(i)->thread.join();
+		stopped.at(i)->grabber.stop();
+		delete stopped.at(i);
+	}
+}
+void CameraRig::addReferenceObservation(cv::Vec3d rvec, cv::Vec3d tvec, std::chrono::steady_clock::time_point timestamp)
+{
+	CameraRig::mu.lock();
+	this->referenceObservation.rvec = rvec;
+	this->referenceObservation.tvec = tvec;
+	this->referenceObservation.depth = tvec[2];
+	this->referenceObservation.timestamp = timestamp;
+	this->referenceObservation.valid = true;
+	CameraRig::mu.unlock();
+}
+bool CameraRig::getFusedPose(cv::Vec3d& rvec, cv::Vec3d& tvec, std::chrono::steady_clock::time_point& timestamp)
+{
+	// Copy the observations, the camera threads keep updating them
+	vector<CameraObservation> observations;
+	CameraRig::mu.lock();
+	if (this->referenceObservation.valid) observations.push_back(this->referenceObservation);
+	for (size_t i = 0; i < this->cameras.size(); i++)
+		if (this->cameras.at(i)->registered && this->cameras.at(i)->observation.valid)
+			observations.push_back(this->cameras.at(i)->observation);
+	CameraRig::mu.unlock();
+	if (observations.empty()) return false;
+
+	timestamp = observations.at(0).timestamp;
+	for (size_t i = 1; i < observations.size(); i++)
+		if (observations.at(i).timestamp > timestamp) timestamp = observations.at(i).timestamp;
+
+	// Position: mean weighted by 1/z^2, the position error of a marker grows with the square of its distance
+	// to the camera that saw it (its own depth, not the one in the reference frame)
+	// Orientation: taken from the closest camera, rotation vectors can't be averaged linearly
+	cv::Vec3d position(0, 0, 0);
+	double totalWeight = 0.0, bestWeight = 0.0;
+	for (size_t i = 0; i < observations.size(); i++)
+	{
+		if (std::chrono::duration<float, std::milli>(timestamp - observations.at(i).timestamp).count() > FUSION_WINDOW) continue;
+		double z = std::max(observations.at(i).depth, 1e-3);
+		double weight = 1.0 / (z * z);
+		position += observations.at(i).tvec * weight;
+		totalWeight += weight;
+		if (weight > bestWeight)
+		{
+			bestWeight = weight;
+			rvec = observations.at(i).rvec;
+		}
+	}
+	tvec = position * (1.0 / totalWeight);
+	return true;
+}
+void CameraRig::printRigState()
+{
+	cout << "Camera rig:" << endl;
+	cout << "\t- Multi-camera: " << ((CameraRig::isRunning()) ? "ON" : "OFF") << endl;
+	if (!CameraRig::isRunning()) return;
+	CameraRig::mu.lock();
+	cout << "\t- Reference webcam: " << this->reference << endl;
+	for (size_t i = 0; i < this->cameras.size(); i++)
+	{
+		CameraWorker* camera = this->cameras.at(i);
+		cout << "\t- Webcam " << camera->index << ": " << camera->grabber.getCapturedFrames() << " frames, "
+			<< camera->detections << " with the drone, ";
+		if (camera->registered)
+			cout << "registered at " << camera->translation << endl;
+		else
+			cout << "registering (" << camera->samples.size() << "/" << REGISTRATION_SAMPLES << ")" << endl;
+	}
+	CameraRig::mu.unlock();
+}
+void CameraRig::cameraLoop(CameraWorker* camera)
+{
+	vector<vector<cv::Point2f>> markerCorners, rejectedCandidates;
+	vector<int> markerIds;
+	cv::Vec3d rvec, tvec;
+	cv::Size frameSize; // size of the last frame, the undistortion grid is taken again when it changes
+
+	while (this->running && camera->grabber.isRunning())
+	{
+		CapturedFrame* captured = camera->grabber.getLatestFrame();
+		if (captured == nullptr)
+		{
+			// No new frame since last iteration, give the capture thread some time
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		if (captured->image.size() != frameSize)
+		{
+			frameSize = captured->image.size();
+			camera->markerPose.setImageSize(frameSize);
+		}
+		if (!camera->detector.detect(captured->image, markerCorners, markerIds, rejectedCandidates)) continue;
+		for (size_t i = 0; i < markerIds.size(); i++)
+		{
+			if (markerIds.at(i) == this->droneMarker)
+			{
+				if (camera->markerPose.estimate(markerCorners.at(i), rvec, tvec))
+					CameraRig::addObservation(camera, rvec, tvec, captured->timestamp);
+				break;
+			}
+		}
+	}
+}
+void CameraRig::addObservation(CameraWorker* camera, cv::Vec3d rvec, cv::Vec3d tvec, std::chrono::steady_clock::time_point timestamp)
+{
+	cv::Matx33d markerRotation;
+	cv::Rodrigues(rvec, markerRotation);
+
+	CameraRig::mu.lock();
+	camera->detections++;
+	if (camera->registered)
+	{
+		// Marker pose in the reference camera frame
+		camera->observation.rvec = MarkerPose::rotationToVector(camera->rotation * markerRotation);
+		camera->observation.tvec = camera->rotation * tvec + camera->translation;
+		camera->observation.depth = tvec[2];
+		camera->observation.timestamp = timestamp;
+		camera->observation.valid = true;
+	}
+	// Registration, the reference camera has to see the drone at the same time
+	else if (this->referenceObservation.valid
+		&& (std::fabs(std::chrono::duration<float, std::milli>(timestamp - this->referenceObservation.timestamp).count()) <= REGISTRATION_WINDOW))
+	{
+		// Camera pose in the reference frame: T_ref_cam = T_ref_marker * inv(T_cam_marker)
+		cv::Matx33d referenceRotation;
+		cv::Rodrigues(this->referenceObservation.rvec, referenceRotation);
+		cv::Matx33d rotation = referenceRotation * markerRotation.t();
+		cv::Vec3d translation = this->referenceObservation.tvec - rotation * tvec;
+		camera->samples.push_back(std::make_pair(rotation, translation));
+
+		if (camera->samples.size() >= REGISTRATION_SAMPLES)
+		{
+			// Mean translation, and closest rotation matrix to the mean of the rotations
+			cv::Matx33d rotationSum = cv::Matx33d::zeros();
+			cv::Vec3d translationSum(0, 0, 0);
+			for (size_t i = 0; i < camera->samples.size(); i++)
+			{
+				rotationSum += camera->samples.at(i).first;
+				translationSum += camera->samples.at(i).second;
+			}
+			cv::Matx33d u, vt;
+			cv::Matx31d w;
+			cv::SVD::compute(rotationSum, w, u, vt);
+			camera->rotation = u * vt;
+			if (cv::determinant(camera->rotation) < 0)
+				camera->rotation = u * cv::Matx33d::diag(cv::Vec3d(1, 1, -1)) * vt;
+			camera->translation = translationSum * (1.0 / camera->samples.size());
+			camera->samples.clear();
+			camera->registered = true;
+			CameraRig::saveExtrinsics(camera);
+			cout << "Webcam " << camera->index << " registered." << endl;
+		}
+	}
+	CameraRig::mu.unlock();
+}
+bool CameraRig::loadExtrinsics(CameraWorker* camera)
+{
+	std::ifstream inStream(EXTRINSICS_FILE + std::to_string(this->reference) + "_" + std::to_string(camera->index) + ".txt");
+	if (inStream)
+	{
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++)
+				inStream >> camera->rotation(r, c);
+		for (int r = 0; r < 3; r++)
+			inStream >> camera->translation[r];
+		camera->registered = !inStream.fail();
+		inStream.close();
+		return camera->registered;
+	}
+	else return false;
+}
+bool CameraRig::saveExtrinsics(CameraWorker* camera)
+{
+	std::ofstream outStream(EXTRINSICS_FILE + std::to_string(this->reference) + "_" + std::to_string(camera->index) + ".txt");
+	if (outStream)
+	{
+		outStream.precision(17);
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 3; c++)
+				outStream << camera->rotation(r, c) << endl;
+		for (int r = 0; r < 3; r++)
+			outStream << camera->translation[r] << endl;
+		outStream.close();
+		return true;
+	}
+	else return false;
+}
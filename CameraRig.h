@@ -0,0 +1,120 @@
+#pragma once
+
+#ifndef CAMERARIG_H
+#define CAMERARIG_H
+
+#include "VideoParameters.h"
+#include "FrameGrabber.h"
+#include "MarkerDetector.h"
+#include "MarkerPose.h"
+
+#define MAX_CAMERAS 4 // number of webcam indexes probed for the camera rig
+#define RIG_FALLBACK_DELAY 500.f // ms without target before a camera of the rig searches its full frame again
+#define FUSION_WINDOW 100.f // ms, observations older than this compared to the newest one are not fused
+#define REGISTRATION_WINDOW 15.f // ms, max time between two observations used to register a camera
+#define REGISTRATION_SAMPLES 30 // number of joint observations averaged to register a camera
+#define CALIBDATA_CAMERA_FILE "calibdata_" // prefix of per-camera calibration files, calibdata_<index>.txt
+#define EXTRINSICS_FILE "extrinsics_" // prefix of files storing camera poses, extrinsics_<reference>_<index>.txt
+
+// Pose of the drone seen by one camera
+struct CameraObservation
+{
+	cv::Vec3d rvec, tvec; // pose of the marker in the reference camera frame
+	double depth; // m, distance of the marker along the optical axis of the camera that saw it
+	std::chrono::steady_clock::time_point timestamp; // capture time of the frame
+	bool valid; // false until the camera has seen the drone
+};
+
+// Camera of the rig, with its own capture and detection
+struct CameraWorker
+{
+	/*
+	@webcam index
+	@ID of the drone marker
+	Constructor of the structure
+	*/
+	CameraWorker(int, int);
+
+	int index; // webcam index
+	FrameGrabber grabber; // capture thread of the camera
+	MarkerDetector detector; // detection in the frames of the camera
+	MarkerPose markerPose; // pose solver with the calibration of the camera
+	std::thread thread; // detection thread
+
+	cv::Matx33d rotation; // orientation of the camera in the reference camera frame
+	cv::Vec3d translation; // position of the camera in the reference camera frame
+	bool registered; // true when the pose of the camera is known
+	vector<std::pair<cv::Matx33d, cv::Vec3d>> samples; // camera poses measured during registration
+
+	CameraObservation observation; // last pose of the drone, in the reference camera frame
+	unsigned long long detections; // frames where the drone was found
+};
+
+/*
+Class to capture and detect the drone with several webcams in parallel
+The camera used by videoProcessing is the reference, every other webcam found gets its own capture
+and detection threads. A camera is registered (its pose in the reference frame is found) from
+observations made at the same time as the reference camera, and saved for the next runs.
+The poses of all cameras are fused into one timestamped estimate in the reference camera frame.
+*/
+class CameraRig : private VideoParameters
+{
+	public:
+		/*
+		@ID of the drone marker
+		Constructor of the class
+		*/
+		CameraRig(int);
+		~CameraRig(); // destructor of the class, stops all cameras
+
+		/*
+		@webcam index of the reference camera, opened elsewhere
+		Opens every other webcam and starts their threads, returns the number of cameras started
+		*/
+		int start(int);
+		void stop(); // Stops all cameras
+		bool isRunning() { return this->running.load(); } // Returns true while the rig runs
+
+		/*
+		@rotation vector of the drone seen by the reference camera
+		@translation vector
+		@capture time of the frame
+		Registers a pose of the drone seen by the reference camera
+		*/
+		void addReferenceObservation(cv::Vec3d, cv::Vec3d, std::chrono::steady_clock::time_point);
+
+		/*
+		@fused rotation vector out
+		@fused translation vector out
+		@capture time of the newest fused observation out
+		Fuses the latest observations of all cameras, returns false if no camera sees the drone
+		*/
+		bool getFusedPose(cv::Vec3d&, cv::Vec3d&, std::chrono::steady_clock::time_point&);
+		void printRigState(); // Prints cameras and their registration state
+
+	private:
+		/*
+		@camera to run
+		Routine run by the detection thread of a camera
+		*/
+		void cameraLoop(CameraWorker*);
+
+		/*
+		@camera that saw the drone
+		@rotation vector in the camera frame
+		@translation vector in the camera frame
+		@capture time of the frame
+		Moves the observation to the reference frame, or uses it to register the camera
+		*/
+		void addObservation(CameraWorker*, cv::Vec3d, cv::Vec3d, std::chrono::steady_clock::time_point);
+		bool loadExtrinsics(CameraWorker*); // Loads the pose of a camera, returns false if unknown
+		bool saveExtrinsics(CameraWorker*); // Saves the pose of a camera
+
+		int reference; // webcam index of the reference camera
+		vector<CameraWorker*> cameras; // secondary cameras
+		CameraObservation referenceObservation; // last pose seen by the reference camera
+		std::atomic<bool> running; // true while the camera threads run
+		std::mutex mu; // protects the reference, observations and registration
+};
+
+#endif // CAMERARIG_H
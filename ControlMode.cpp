@@ -10,7 +10,7 @@ ControlMode::ControlMode(mode mode, regulator reg, filter filt, cv::Vec3d sp)
 
 	ControlMode::resetAllControlValues(); // throttle, roll, pitch and yaw set to default
 
-	this->droneStop = ControlMode::convertControlValuesToStr(); // Create a standard string to stop drone
+	this->droneStop = ControlMode::getCommand(); // Create a standard command to stop drone
 	this->newData = this->droneStop;
 	this->oldData = this->newData;
 	ControlMode::setSetPoint(sp); // Set default setpoint
@@ -18,7 +18,7 @@ ControlMode::ControlMode(mode mode, regulator reg, filter filt, cv::Vec3d sp)
 void ControlMode::printControlState()
 {
 	cout << "Control parameters:" << endl;
-	cout << "\t- t,r,p,y: " << this->newData << endl;
+	cout << "\t- t,r,p,y: " << this->newData.text << endl;
 	cout << "\t- Operating mode: " << ((ControlMode::getOperatingMode() == mode::manual) ? "manual" : "automatic") << endl;
 	cout << "\t- Regulator" << ((ControlMode::getOperatingMode() == mode::manual) ? " (unactive: manual mode): " : ": ");
 	switch (ControlMode::getOperatingReg())
@@ -52,70 +52,61 @@ void ControlMode::printControlState()
 }
 void ControlMode::resetAllControlValues()
 {
-	this->throttle = THROTTLE_DEF;
-	this->roll = ROLL_DEF;
-	this->pitch = PITCH_DEF;
-	this->yaw = YAW_DEF;
+	this->values[controlChannel::throttleChannel] = THROTTLE_DEF;
+	this->values[controlChannel::rollChannel] = ROLL_DEF;
+	this->values[controlChannel::pitchChannel] = PITCH_DEF;
+	this->values[controlChannel::yawChannel] = YAW_DEF;
 }
-void ControlMode::resetControlValue(string controlValue)
+void ControlMode::resetControlValue(controlChannel channel)
 {
-	// Reset value
-	if (controlValue == "throttle")
-		this->throttle = THROTTLE_DEF;
-	else if (controlValue == "roll")
-		this->roll = ROLL_DEF;
-	else if (controlValue == "pitch")
-		this->pitch = PITCH_DEF;
-	else if (controlValue == "yaw")
-		this->yaw = YAW_DEF;
+	const int defaults[CONTROL_CHANNELS] = { THROTTLE_DEF, ROLL_DEF, PITCH_DEF, YAW_DEF };
+	this->values[channel] = defaults[channel];
 }
-int ControlMode::getControlValue(string controlValue)
+void ControlMode::setAllControlValues(int t, int r, int p, int y)
 {
-	if (controlValue == "throttle")
-		return this->throttle;
-	else if (controlValue == "roll")
-		return this->roll;
-	else if (controlValue == "pitch")
-		return this->pitch;
-	else if (controlValue == "yaw")
-		return this->yaw;
+	ControlMode::setControlValue(controlChannel::throttleChannel, t);
+	ControlMode::setControlValue(controlChannel::rollChannel, r);
+	ControlMode::setControlValue(controlChannel::pitchChannel, p);
+	ControlMode::setControlValue(controlChannel::yawChannel, y);
 }
-void ControlMode::setControlValue(string controlValue, int value)
+ControlCommand ControlMode::getCommand()
 {
-	// Control limit values
-	if (value > MAX_CONTROL_VALUE) value = MAX_CONTROL_VALUE;
-	else if (value < MIN_CONTROL_VALUE) value = MIN_CONTROL_VALUE;
-	// Assign value
-	if (controlValue == "throttle")
-		this->throttle = value;
-	else if (controlValue == "roll")
-		this->roll = value;
-	else if (controlValue == "pitch")
-		this->pitch = value;
-	else if (controlValue == "yaw")
-		this->yaw = value;
+	ControlCommand command;
+	command.set(this->values[controlChannel::throttleChannel], this->values[controlChannel::rollChannel],
+		this->values[controlChannel::pitchChannel], this->values[controlChannel::yawChannel]);
+	return command;
 }
-void ControlMode::setAllControlValues(int t, int r, int p, int y)
-{
-	// Control limit values
-	if (t > MAX_CONTROL_VALUE) t = MAX_CONTROL_VALUE;
-	else if (t < MIN_CONTROL_VALUE) t = MIN_CONTROL_VALUE;
-	if (r > MAX_CONTROL_VALUE) t = MAX_CONTROL_VALUE;
-	else if (r < MIN_CONTROL_VALUE) t = MIN_CONTROL_VALUE;
-	if (p > MAX_CONTROL_VALUE) t = MAX_CONTROL_VALUE;
-	else if (p < MIN_CONTROL_VALUE) t = MIN_CONTROL_VALUE;
-	if (y > MAX_CONTROL_VALUE) t = MAX_CONTROL_VALUE;
-	else if (y < MIN_CONTROL_VALUE) t = MIN_CONTROL_VALUE;
 
-	this->throttle = t;
-	this->roll = r;
-	this->pitch = p;
-	this->yaw = y;
+// Control command
+void ControlCommand::set(int t, int r, int p, int y)
+{
+	int values[CONTROL_CHANNELS] = { t, r, p, y };
+	char* end = this->text;
+	for (int i = 0; i < CONTROL_CHANNELS; i++)
+	{
+		this->values[i] = std::max(MIN_CONTROL_VALUE, std::min(MAX_CONTROL_VALUE, values[i]));
+		if (i > 0) *end++ = ',';
+		end = std::to_chars(end, this->text + COMMAND_CAPACITY - 1, this->values[i]).ptr;
+	}
+	// Clear what is left of a longer text
+	std::fill(end, this->text + std::max(this->length, static_cast<size_t>(end - this->text)) + 1, '\0');
+	this->length = end - this->text;
 }
-string ControlMode::convertControlValuesToStr()
+bool ControlCommand::parse(const char* text, size_t length)
 {
-	std::stringstream convert;
-	convert << this->throttle << "," << this->roll << "," << this->pitch << "," << this->yaw;
-	return convert.str();
-	convert.str("");
-}
\ No newline at end of file
+	int values[CONTROL_CHANNELS];
+	const char* position = text;
+	const char* end = text + length;
+	for (int i = 0; i < CONTROL_CHANNELS; i++)
+	{
+		if ((i > 0) && ((position == end) || (*position++ != ','))) return false;
+		std::from_chars_result result = std::from_chars(position, end, values[i]);
+		if (result.ec != std::errc()) return false;
+		position = result.ptr;
+	}
+	// Trailing carriage return of files written on Windows
+	while ((position != end) && ((*position == '\r') || (*position == ' '))) position++;
+	if (position != end) return false;
+	ControlCommand::set(values[0], values[1], values[2], values[3]);
+	return true;
+}
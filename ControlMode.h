@@ -11,6 +11,8 @@
 #define ROLL_DEF 1500
 #define PITCH_DEF 1500
 #define YAW_DEF 1500
+#define CONTROL_CHANNELS 4 // throttle, roll, pitch and yaw
+#define COMMAND_CAPACITY 255 // bytes of a formatted command, the serial port always sends MAX_DATA_LENGTH bytes
 
 // Enumeration to store operating modes
 enum mode
@@ -32,6 +34,47 @@ enum filter
 	kalman = 1
 };
 
+// Enumeration to index the control channels, in the order they are sent
+enum controlChannel
+{
+	throttleChannel = 0,
+	rollChannel = 1,
+	pitchChannel = 2,
+	yawChannel = 3
+};
+
+/*
+Command sent to the drone: values per channel and their text "t,r,p,y"
+The text lives in the object and is formatted with std::to_chars, nothing is allocated on the heap.
+Commands compare on their values only
+*/
+struct ControlCommand
+{
+	int values[CONTROL_CHANNELS]; // throttle, roll, pitch and yaw
+	char text[COMMAND_CAPACITY]; // values separated by commas, null terminated and padded
+	size_t length; // characters in text
+
+	ControlCommand() { std::fill(this->values, this->values + CONTROL_CHANNELS, 0); std::fill(this->text, this->text + COMMAND_CAPACITY, '\0'); this->length = 0; }
+
+	/*
+	@throttle
+	@roll
+	@pitch
+	@yaw
+	Sets the values clamped to MIN_CONTROL_VALUE..MAX_CONTROL_VALUE and formats the text
+	*/
+	void set(int, int, int, int);
+
+	/*
+	@text "t,r,p,y" written by the external controller
+	@length of the text
+	Parses and sets the values, returns false and keeps the command if the text is not four integers
+	*/
+	bool parse(const char*, size_t);
+	bool operator==(const ControlCommand& other) const { return std::equal(this->values, this->values + CONTROL_CHANNELS, other.values); }
+	bool operator!=(const ControlCommand& other) const { return !(*this == other); }
+};
+
 /*
 Class to initiate, store and handle control modes
 */
@@ -71,23 +114,23 @@ class ControlMode
 		void resetAllControlValues(); // Resets all control values
 
 		/*
-		@name of control value "throttle", "roll", "pitch" or "yaw"
+		@control channel
 		Resets a specific control value
 		*/
-		void resetControlValue(string);
+		void resetControlValue(controlChannel);
 
 		/*
-		@name of control value "throttle", "roll", "pitch" or "yaw"
+		@control channel
 		Returns a specific control value
 		*/
-		int getControlValue(string);
+		int getControlValue(controlChannel channel) { return this->values[channel]; }
 
 		/*
-		@name of control value "throttle", "roll", "pitch" or "yaw"
+		@control channel
 		@value to assign
 		Sets a specific control value
 		*/
-		void setControlValue(string, int);
+		void setControlValue(controlChannel channel, int value) { this->values[channel] = std::max(MIN_CONTROL_VALUE, std::min(MAX_CONTROL_VALUE, value)); }
 
 		/*
 		@throttle
@@ -104,17 +147,17 @@ class ControlMode
 		Sets new setpoint to given values
 		*/
 		void setSetPoint(cv::Vec3d newSetPoint) { this->setpoint = newSetPoint;  }
-		string convertControlValuesToStr(); // Routine to convert curent control values to string
+		ControlCommand getCommand(); // Returns the command formatted from the current control values
 	protected:
-		string droneStop; // String to stop drone
-		string oldData, newData; // Strings to update commands to send to the drone
+		ControlCommand droneStop; // Command to stop drone
+		ControlCommand oldData, newData; // Last command sent and command to send to the drone
 
 	private:
 		mode operating_mode; // Operating mode (manual/automatic)
 		regulator operating_reg; // Operating regulator (none/PID/MPC)
 		filter operating_filt; // Operating filter (none/Kalman)
 		
-		int throttle, roll, pitch, yaw; // Controller values
+		int values[CONTROL_CHANNELS]; // Controller values, indexed by controlChannel
 		cv::Vec3d setpoint; // vector to store the setpoint (objective)
 };
 
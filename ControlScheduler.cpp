@@ -0,0 +1,161 @@
+#include "stdafx.h"
+#include "ControlScheduler.h"
+#ifndef _WIN32
+#include <pthread.h> // for pthread_setschedparam(), pthread_setaffinity_np()
+#include <sched.h> // for SCHED_FIFO, cpu_set_t
+#endif
+
+// Control scheduler
+ControlScheduler::ControlScheduler(float rate)
+{
+	this->running = false;
+	this->rate = std::max(CONTROL_MIN_RATE, std::min(CONTROL_MAX_RATE, rate));
+	this->eventDriven = false;
+	this->realtime = false;
+	this->cpu = -1;
+	this->priorityChanged = false;
+	this->priorityApplied = true;
+	this->notified = false;
+	this->rescheduled = false;
+	this->ticks = this->eventTicks = this->misses = 0;
+}
+ControlScheduler::~ControlScheduler()
+{
+	ControlScheduler::stop();
+}
+void ControlScheduler::start(const std::function<void()>& routine)
+{
+	ControlScheduler::stop();
+	this->routine = routine;
+	this->jitter.reset();
+	this->duration.reset();
+	this->ticks = this->eventTicks = this->misses = 0;
+	this->notified = false;
+	this->rescheduled = false;
+	this->running = true;
+	this->thread = std::thread(&ControlScheduler::schedulerLoop, this);
+}
+void ControlScheduler::stop()
+{
+	ControlScheduler::mu.lock();
+	this->running = false;
+	ControlScheduler::mu.unlock();
+	this->wake.notify_one();
+	if (this->thread.joinable()) this->thread.join();
+}
+void ControlScheduler::setRate(float rate)
+{
+	ControlScheduler::mu.lock();
+	this->rate = std::max(CONTROL_MIN_RATE, std::min(CONTROL_MAX_RATE, rate));
+	this->rescheduled = true;
+	ControlScheduler::mu.unlock();
+	this->wake.notify_one();
+}
+void ControlScheduler::notify()
+{
+	if (!this->eventDriven.load()) return;
+	ControlScheduler::mu.lock();
+	this->notified = true;
+	ControlScheduler::mu.unlock();
+	this->wake.notify_one();
+}
+void ControlScheduler::setRealtime(bool realtime, int cpu)
+{
+	this->realtime = realtime;
+	this->cpu = cpu;
+	this->priorityChanged = true;
+}
+void ControlScheduler::printSchedulerState()
+{
+	cout << "Control scheduler:" << endl;
+	cout << "\t- Rate: " << ControlScheduler::getRate() << " Hz" << ((ControlScheduler::getEventDriven()) ? ", and on every new pose" : "")
+		<< ((ControlScheduler::isRunning()) ? "" : " (stopped)") << endl;
+	cout << "\t- Priority: " << ((ControlScheduler::getRealtime()) ? "real-time" : "normal");
+	if (this->cpu.load() >= 0) cout << ", pinned to core " << this->cpu.load();
+	cout << ((this->priorityApplied.load()) ? "" : " (refused by the system)") << endl;
+	cout << "\t- Ticks: " << this->ticks.load() << " timed, " << this->eventTicks.load() << " on new poses, "
+		<< this->misses.load() << " deadline misses" << endl;
+	if (this->jitter.getCount() > 0)
+		cout << "\t- Jitter: p50 " << this->jitter.percentile(0.5) << " ms, p99 " << this->jitter.percentile(0.99) << " ms, max " << this->jitter.getMax() << " ms" << endl;
+	if (this->duration.getCount() > 0)
+		cout << "\t- Tick duration: p50 " << this->duration.percentile(0.5) << " ms, p99 " << this->duration.percentile(0.99) << " ms, max " << this->duration.getMax() << " ms" << endl;
+}
+void ControlScheduler::schedulerLoop()
+{
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point previous = deadline; // deadline of the last timed tick
+	while (this->running.load())
+	{
+		if (this->priorityChanged.exchange(false)) ControlScheduler::applyPriority();
+
+		// Wait for the next deadline, or for a new pose in event mode
+		bool event = false;
+		std::unique_lock<std::mutex> lock(this->mu);
+		while (this->running.load() && !this->notified && (std::chrono::steady_clock::now() < deadline))
+		{
+			// New rate: one new period after the last tick, at once if that is already past
+			if (this->rescheduled)
+			{
+				this->rescheduled = false;
+				deadline = previous + ControlScheduler::getPeriod();
+				continue;
+			}
+			this->wake.wait_until(lock, deadline);
+		}
+		this->rescheduled = false;
+		event = this->notified;
+		this->notified = false;
+		lock.unlock();
+		if (!this->running.load()) break;
+
+		std::chrono::steady_clock::duration period = ControlScheduler::getPeriod();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool timed = (start >= deadline);
+		if (timed)
+		{
+			this->jitter.record(start - deadline);
+			this->ticks++;
+			// Late by more than a period: the ticks in between are skipped
+			if (start - deadline >= period)
+			{
+				this->misses++;
+				deadline += ((start - deadline) / period) * period;
+			}
+			previous = deadline;
+			deadline += period;
+		}
+		else if (event) this->eventTicks++;
+
+		this->routine();
+		this->duration.record(std::chrono::steady_clock::now() - start);
+	}
+}
+std::chrono::steady_clock::duration ControlScheduler::getPeriod()
+{
+	return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / this->rate.load()));
+}
+void ControlScheduler::applyPriority()
+{
+	bool applied = true;
+	int core = this->cpu.load();
+#ifdef _WIN32
+	applied = (SetThreadPriority(GetCurrentThread(), (this->realtime.load()) ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_NORMAL) != 0);
+	DWORD_PTR mask = (core >= 0) ? (static_cast<DWORD_PTR>(1) << core) : static_cast<DWORD_PTR>(-1);
+	if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) applied = (core < 0) && applied;
+#else
+	// SCHED_FIFO needs CAP_SYS_NICE (or an rtprio limit)
+	sched_param parameters;
+	parameters.sched_priority = (this->realtime.load()) ? sched_get_priority_max(SCHED_FIFO) - 1 : 0;
+	if (pthread_setschedparam(pthread_self(), (this->realtime.load()) ? SCHED_FIFO : SCHED_OTHER, &parameters) != 0) applied = false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (core >= 0) CPU_SET(core, &set);
+	else
+		for (unsigned int i = 0; i < std::thread::hardware_concurrency(); i++)
+			CPU_SET(i, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0) applied = false;
+#endif
+	this->priorityApplied = applied;
+	if (!applied)
+		cout << "\tControl thread: priority or affinity refused by the system." << endl;
+}
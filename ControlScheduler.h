@@ -0,0 +1,89 @@
+#pragma once
+
+#ifndef CONTROLSCHEDULER_H
+#define CONTROLSCHEDULER_H
+
+#include "stdafx.h"
+#include "LatencyMonitor.h"
+
+#define CONTROL_RATE 33.3f // Hz, default rate of the control thread (one command every 30 ms)
+#define CONTROL_MIN_RATE 1.f // Hz, lowest rate accepted
+#define CONTROL_MAX_RATE 500.f // Hz, highest rate accepted
+
+/*
+Class to run a control routine on its own thread at a fixed rate
+Ticks are scheduled on absolute steady clock deadlines (condition variable wait_until, which notify, stop
+and setRate can interrupt, unlike a sleep), so the rate does not drift with the time spent in the routine. A tick that starts after the next deadline is a deadline miss,
+the schedule then skips to the next deadline in the future instead of running late ticks back to back.
+In event mode, the routine also runs as soon as notify is called (new pose), between the ticks.
+The thread can be given a real-time priority (SCHED_FIFO, TIME_CRITICAL on Windows) and pinned to a core
+*/
+class ControlScheduler
+{
+	public:
+		/*
+		@rate in Hz
+		Constructor of the class
+		*/
+		ControlScheduler(float);
+		~ControlScheduler(); // destructor of the class, stops the thread
+
+		/*
+		@routine to run on every tick
+		Starts the thread
+		*/
+		void start(const std::function<void()>&);
+		void stop(); // Stops the thread after the current tick
+		bool isRunning() { return this->running.load(); } // Returns true while the thread runs
+		float getRate() { return this->rate.load(); } // Returns rate in Hz
+
+		/*
+		@rate in Hz, clamped to CONTROL_MIN_RATE..CONTROL_MAX_RATE
+		Sets the rate, the pending deadline moves to one new period after the last tick
+		*/
+		void setRate(float);
+		bool getEventDriven() { return this->eventDriven.load(); } // Returns true if the routine also runs on notify
+
+		/*
+		@true to also run the routine as soon as notify is called
+		Sets the event mode
+		*/
+		void setEventDriven(bool eventDriven) { this->eventDriven = eventDriven; }
+		void notify(); // Wakes the thread in event mode, called when a new pose is available
+		bool getRealtime() { return this->realtime.load(); } // Returns true if a real-time priority was asked
+
+		/*
+		@true for a real-time priority
+		@core to pin the thread to, -1 for any core
+		Changes the priority and affinity of the thread, applied on its next tick
+		*/
+		void setRealtime(bool, int);
+		void printSchedulerState(); // Prints rate, jitter, deadline misses and tick duration
+
+	private:
+		void schedulerLoop(); // Routine run by the control thread
+		void applyPriority(); // Applies the priority and affinity from the control thread
+		std::chrono::steady_clock::duration getPeriod(); // Returns period of the current rate
+
+		std::thread thread; // control thread
+		std::function<void()> routine; // routine run on every tick
+		std::atomic<bool> running; // true while the thread runs
+		std::atomic<float> rate; // Hz
+		std::atomic<bool> eventDriven; // true to run on notify as well
+		std::atomic<bool> realtime; // true for a real-time priority
+		std::atomic<int> cpu; // core the thread is pinned to, -1 for any
+		std::atomic<bool> priorityChanged; // set by setRealtime, handled by the thread
+		std::atomic<bool> priorityApplied; // false if the system refused the last priority change
+
+		std::mutex mu; // protects notified and rescheduled
+		std::condition_variable wake; // signals notify, setRate and stop
+		bool notified; // true when a pose arrived since the last tick
+		bool rescheduled; // true when the rate changed since the deadline was set
+
+		// Statistics
+		LatencyHistogram jitter; // time between the deadline and the start of a tick
+		LatencyHistogram duration; // time spent in the routine
+		std::atomic<unsigned long long> ticks, eventTicks, misses; // timed ticks, ticks run on notify, deadline misses
+};
+
+#endif // CONTROLSCHEDULER_H
@@ -0,0 +1,270 @@
+#include "stdafx.h"
+#include "DroneRegistry.h"
+
+// Drone
+Drone::Drone(int markerId, cv::Vec3d setpoint, SerialPort* port) :
+	ControlMode(mode::automatic, regulator::pid, filter::filteroff, setpoint),
+	markerPose(QR_CODE_SIZE)
+{
+	this->markerId = markerId;
+	this->poses = 0;
+	this->regulated = 0;
+	this->lastSeen = std::chrono::steady_clock::now();
+	if (port != nullptr)
+		this->link.open(port);
+}
+Drone::~Drone()
+{
+	// The stop is written before the port closes
+	this->link.post(this->droneStop, true);
+	this->link.close();
+}
+void Drone::observe(const vector<cv::Point2f>* corners, std::chrono::steady_clock::time_point timestamp)
+{
+	DronePose pose;
+	Drone::poseMu.lock();
+	pose = this->history[this->poses % DRONE_POSE_HISTORY];
+	Drone::poseMu.unlock();
+
+	// Last known pose if the marker is not on the frame, solved outside of the lock
+	pose.detected = (corners != nullptr) && this->markerPose.estimate(*corners, pose.rvec, pose.tvec);
+	pose.timestamp = timestamp;
+
+	Drone::poseMu.lock();
+	pose.sequence = ++this->poses;
+	if (pose.detected) this->lastSeen = std::chrono::steady_clock::now();
+	this->history[pose.sequence % DRONE_POSE_HISTORY] = pose;
+	Drone::poseMu.unlock();
+}
+bool Drone::getPose(DronePose& pose)
+{
+	std::lock_guard<std::mutex> lock(this->poseMu);
+	if (this->poses == 0) return false;
+	pose = this->history[this->poses % DRONE_POSE_HISTORY];
+	return true;
+}
+void Drone::getPoseHistory(vector<DronePose>& poses)
+{
+	std::lock_guard<std::mutex> lock(this->poseMu);
+	poses.clear();
+	unsigned long long first = (this->poses > DRONE_POSE_HISTORY) ? this->poses - DRONE_POSE_HISTORY + 1 : 1;
+	for (unsigned long long s = first; s <= this->poses; s++)
+		poses.push_back(this->history[s % DRONE_POSE_HISTORY]);
+}
+void Drone::control(bool running, bool automatic)
+{
+	DronePose pose;
+	bool posed = Drone::getPose(pose);
+	Drone::poseMu.lock();
+	bool lost = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - this->lastSeen).count() >= MARKER_TIMEOUT;
+	Drone::poseMu.unlock();
+
+	// Paused, or the marker is out of reach for too long: stop once, the regulator restarts from the next pose
+	if ((!running || (automatic && posed && !pose.detected && lost)) && Drone::isFlying())
+	{
+		ControlMode::resetAllControlValues();
+		this->newData = this->droneStop;
+		this->regulator.reset();
+	}
+	// Once per new pose
+	else if (running && automatic && posed && pose.detected && (pose.sequence != this->regulated))
+	{
+		this->regulated = pose.sequence;
+		int t, r, p, y;
+		if (this->regulator.update(pose.tvec, pose.rvec, ControlMode::getSetPoint(), pose.timestamp, t, r, p, y))
+		{
+			ControlMode::setAllControlValues(t, r, p, y);
+			this->newData = ControlMode::getCommand();
+		}
+	}
+
+	// A command refused behind a pending stop is posted again on the next step
+	if (this->oldData != this->newData)
+	{
+		bool queued = this->link.post(this->newData, this->newData == this->droneStop);
+		if (queued || !this->link.isOpen())
+			this->oldData = this->newData;
+	}
+}
+void Drone::printDroneState()
+{
+	vector<DronePose> poses;
+	Drone::getPoseHistory(poses);
+	cout << "Drone of marker " << this->markerId << ":" << endl;
+	cout << "\t- Setpoint: " << ControlMode::getSetPoint() << endl;
+	if (poses.empty())
+		cout << "\t- No frame processed yet." << endl;
+	else
+	{
+		const DronePose& newest = poses.back();
+		cout << "\t- Pose" << ((newest.detected) ? ": " : " (marker not on the last frame): ") << "tvec " << newest.tvec << ", rvec " << newest.rvec << endl;
+		// Mean speed between the oldest and newest detections of the history
+		const DronePose* oldest = nullptr;
+		const DronePose* latest = nullptr;
+		for (size_t i = 0; i < poses.size(); i++)
+		{
+			if (!poses.at(i).detected) continue;
+			if (oldest == nullptr) oldest = &poses.at(i);
+			latest = &poses.at(i);
+		}
+		double elapsed = (oldest != nullptr) ? std::chrono::duration<double>(latest->timestamp - oldest->timestamp).count() : 0.0;
+		if (elapsed > 0.0)
+			cout << "\t- Speed over the last " << poses.size() << " frames: " << cv::norm(latest->tvec - oldest->tvec) / elapsed << " m/s" << endl;
+	}
+	cout << "\t- Command: " << ControlMode::getCommand().text << ((Drone::isFlying()) ? "" : " (not flying)") << endl;
+	this->link.printLinkState();
+}
+
+// Drone registry
+DroneRegistry::DroneRegistry() :
+	pool(0)
+{
+	std::fill(this->keys, this->keys + DRONE_SLOTS, DRONE_FREE_SLOT);
+	std::fill(this->indexes, this->indexes + DRONE_SLOTS, -1);
+}
+DroneRegistry::~DroneRegistry()
+{
+	DroneRegistry::clear();
+}
+size_t DroneRegistry::home(int id)
+{
+	// Fibonacci hashing, consecutive IDs land on distant slots
+	return ((static_cast<unsigned int>(id) * 2654435761u) >> 16) & (DRONE_SLOTS - 1);
+}
+size_t DroneRegistry::probe(int id)
+{
+	// The table is never more than a quarter full, a free slot is always found
+	size_t slot = DroneRegistry::home(id);
+	while ((this->keys[slot] != DRONE_FREE_SLOT) && (this->keys[slot] != id))
+		slot = (slot + 1) & (DRONE_SLOTS - 1);
+	return slot;
+}
+bool DroneRegistry::add(int id, cv::Vec3d setpoint, SerialPort* port)
+{
+	std::unique_lock<std::shared_mutex> lock(this->mu);
+	size_t slot = DroneRegistry::probe(id);
+	if ((id < 0) || (this->keys[slot] == id) || (this->drones.size() >= MAX_DRONES))
+	{
+		delete port;
+		return false;
+	}
+	Drone* drone = new Drone(id, setpoint, port);
+	if (!this->cameraMatrix.empty())
+		drone->setCalibration(this->cameraMatrix, this->distanceCoeff);
+	if (this->imageSize.area() > 0)
+		drone->setImageSize(this->imageSize);
+	this->keys[slot] = id;
+	this->indexes[slot] = static_cast<int>(this->drones.size());
+	this->drones.push_back(drone);
+	return true;
+}
+bool DroneRegistry::remove(int id)
+{
+	std::unique_lock<std::shared_mutex> lock(this->mu);
+	size_t slot = DroneRegistry::probe(id);
+	if ((id < 0) || (this->keys[slot] != id)) return false;
+	DroneRegistry::erase(static_cast<size_t>(this->indexes[slot]));
+	return true;
+}
+void DroneRegistry::clear()
+{
+	std::unique_lock<std::shared_mutex> lock(this->mu);
+	while (!this->drones.empty())
+		DroneRegistry::erase(this->drones.size() - 1);
+}
+void DroneRegistry::erase(size_t index)
+{
+	Drone* drone = this->drones.at(index);
+	size_t hole = DroneRegistry::probe(drone->getMarkerId());
+	this->keys[hole] = DRONE_FREE_SLOT;
+
+	// Backward shift: entries after the hole move into it if it lies between their home slot and their slot,
+	// so lookups never stop early on it and no tombstone is needed
+	for (size_t next = (hole + 1) & (DRONE_SLOTS - 1); this->keys[next] != DRONE_FREE_SLOT; next = (next + 1) & (DRONE_SLOTS - 1))
+	{
+		size_t start = DroneRegistry::home(this->keys[next]);
+		if (((next - start) & (DRONE_SLOTS - 1)) >= ((next - hole) & (DRONE_SLOTS - 1)))
+		{
+			this->keys[hole] = this->keys[next];
+			this->indexes[hole] = this->indexes[next];
+			this->keys[next] = DRONE_FREE_SLOT;
+			hole = next;
+		}
+	}
+
+	// The last drone takes the place of the removed one in the dense array
+	if (index + 1 < this->drones.size())
+	{
+		this->drones.at(index) = this->drones.back();
+		this->indexes[DroneRegistry::probe(this->drones.at(index)->getMarkerId())] = static_cast<int>(index);
+	}
+	this->drones.pop_back();
+	delete drone;
+}
+Drone* DroneRegistry::find(int id)
+{
+	std::shared_lock<std::shared_mutex> lock(this->mu);
+	size_t slot = DroneRegistry::probe(id);
+	return ((id >= 0) && (this->keys[slot] == id)) ? this->drones.at(this->indexes[slot]) : nullptr;
+}
+size_t DroneRegistry::size()
+{
+	std::shared_lock<std::shared_mutex> lock(this->mu);
+	return this->drones.size();
+}
+void DroneRegistry::setCalibration(const cv::Mat& cameraMatrix, const cv::Mat& distanceCoeff)
+{
+	std::unique_lock<std::shared_mutex> lock(this->mu);
+	this->cameraMatrix = cameraMatrix.clone();
+	this->distanceCoeff = distanceCoeff.clone();
+	for (size_t i = 0; i < this->drones.size(); i++)
+		this->drones.at(i)->setCalibration(this->cameraMatrix, this->distanceCoeff);
+}
+void DroneRegistry::setImageSize(cv::Size size)
+{
+	std::unique_lock<std::shared_mutex> lock(this->mu);
+	this->imageSize = size;
+	for (size_t i = 0; i < this->drones.size(); i++)
+		this->drones.at(i)->setImageSize(size);
+}
+size_t DroneRegistry::dispatch(const vector<int>& ids, const vector<vector<cv::Point2f>>& corners, std::chrono::steady_clock::time_point timestamp)
+{
+	std::shared_lock<std::shared_mutex> lock(this->mu);
+	int count = static_cast<int>(this->drones.size());
+	if (count == 0) return 0;
+
+	// One lookup per detected marker (matches is only used by the video thread), the first marker of an ID wins
+	size_t found = 0;
+	this->matches.assign(count, -1);
+	for (size_t i = 0; i < ids.size(); i++)
+	{
+		size_t slot = DroneRegistry::probe(ids.at(i));
+		if ((ids.at(i) >= 0) && (this->keys[slot] == ids.at(i)) && (this->matches.at(this->indexes[slot]) < 0))
+		{
+			this->matches.at(this->indexes[slot]) = static_cast<int>(i);
+			found++;
+		}
+	}
+
+	std::function<void(int)> observe = [this, &corners, timestamp](int d)
+	{
+		this->drones.at(d)->observe((this->matches.at(d) >= 0) ? &corners.at(this->matches.at(d)) : nullptr, timestamp);
+	};
+	if (count >= DRONE_PARALLEL_MIN) this->pool.parallelFor(count, observe);
+	else for (int d = 0; d < count; d++) observe(d);
+	return found;
+}
+void DroneRegistry::control(bool running, bool automatic)
+{
+	// Inline, the pool belongs to the video thread
+	std::shared_lock<std::shared_mutex> lock(this->mu);
+	for (size_t d = 0; d < this->drones.size(); d++)
+		this->drones.at(d)->control(running, automatic);
+}
+void DroneRegistry::printRegistryState()
+{
+	std::shared_lock<std::shared_mutex> lock(this->mu);
+	cout << "Drones: " << this->drones.size() << " of " << MAX_DRONES << ((this->drones.empty()) ? "." : ", by marker ID:") << endl;
+	for (size_t i = 0; i < this->drones.size(); i++)
+		this->drones.at(i)->printDroneState();
+}
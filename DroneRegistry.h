@@ -0,0 +1,206 @@
+#pragma once
+
+#ifndef DRONEREGISTRY_H
+#define DRONEREGISTRY_H
+
+#include "stdafx.h"
+#include "ControlMode.h"
+#include "MarkerPose.h"
+#include "PidRegulator.h"
+#include "SerialLink.h"
+#include "ThreadPool.h"
+
+#define MARKER_TIMEOUT 2000.f // ms without the marker before a flying drone is stopped
+#define MAX_DRONES 16 // drones the registry holds besides the one of VideoParameters::droneMarker
+#define DRONE_SLOTS 64 // slots of the marker ID table, a power of two, at least 4 times MAX_DRONES
+#define DRONE_FREE_SLOT -1 // key of an empty slot, marker IDs are never negative
+#define DRONE_POSE_HISTORY 32 // poses kept per drone, one per processed frame
+#define DRONE_PARALLEL_MIN 4 // fewer drones have their poses solved on the video thread, the pool costs more than they do
+
+// Pose of a drone on one processed frame
+struct DronePose
+{
+	unsigned long long sequence; // number of the pose, incremented on every processed frame
+	bool detected; // true if the marker was found, the pose is the last known one otherwise
+	cv::Vec3d rvec, tvec; // pose of the drone
+	std::chrono::steady_clock::time_point timestamp; // capture time of the frame
+};
+
+/*
+Class of a drone flown from the ground station besides the main one
+Each drone has its own marker, pose history, setpoint, control channels, PID regulator and serial link,
+so drones never share a command nor a port. Poses are written by the video thread, the control thread
+regulates on the newest one
+*/
+class Drone : private ControlMode
+{
+	public:
+		/*
+		@ID of the marker on the drone
+		@setpoint
+		@serial port of its Arduino, owned by the drone from now on, nullptr for none
+		Constructor of the class, the drone flies in automatic mode with its own PID
+		*/
+		Drone(int, cv::Vec3d, SerialPort*);
+		~Drone(); // destructor of the class, sends the stop command and closes the serial link
+		int getMarkerId() { return this->markerId; } // Returns ID of the marker on the drone
+
+		/*
+		@camera matrix
+		@distortion coefficients
+		Sets the intrinsics of the pose solver
+		*/
+		void setCalibration(const cv::Mat& cameraMatrix, const cv::Mat& distanceCoeff) { this->markerPose.setCalibration(cameraMatrix, distanceCoeff); }
+
+		/*
+		@size of the frames
+		Builds the undistortion lookup of the pose solver for the size
+		*/
+		void setImageSize(cv::Size size) { this->markerPose.setImageSize(size); }
+
+		/*
+		@corners of the marker on the frame, nullptr if the marker was not found
+		@capture time of the frame
+		Estimates the pose and adds it to the history, called by the video thread
+		*/
+		void observe(const vector<cv::Point2f>*, std::chrono::steady_clock::time_point);
+
+		/*
+		@pose out
+		Copies the newest pose, returns false if no frame was processed yet
+		*/
+		bool getPose(DronePose&);
+
+		/*
+		@poses out, oldest first
+		Copies the poses of the last processed frames
+		*/
+		void getPoseHistory(vector<DronePose>&);
+
+		/*
+		@true if the system runs, false to stop the drone
+		@true in automatic mode
+		Regulates on the newest pose and posts the command if it changed, called by the control thread
+		*/
+		void control(bool, bool);
+		cv::Vec3d getSetPoint() { return ControlMode::getSetPoint(); } // Returns setpoint of the drone
+
+		/*
+		@setpoint cv::Vec3d(double, double, double)
+		Sets the setpoint of the drone
+		*/
+		void setSetPoint(cv::Vec3d setpoint) { ControlMode::setSetPoint(setpoint); }
+		bool isFlying() { return ControlMode::getControlValue(controlChannel::throttleChannel) > MIN_CONTROL_VALUE; } // Returns true if the last throttle is above its minimum
+		void printDroneState(); // Prints pose, speed over the history, command and serial link
+
+	private:
+		int markerId; // ID of the marker on the drone
+		MarkerPose markerPose; // pose solver, keeps the undistortion cache of this marker
+		PidRegulator regulator; // regulator of this drone
+		SerialLink link; // writer thread owning the port of this drone
+
+		std::mutex poseMu; // protects the history
+		DronePose history[DRONE_POSE_HISTORY]; // poses of the last frames, indexed by sequence modulo the size
+		unsigned long long poses; // sequence of the newest pose
+		std::chrono::steady_clock::time_point lastSeen; // time the marker was last found
+		unsigned long long regulated; // sequence of the last pose the regulator ran on
+};
+
+/*
+Class to hold the drones by the ID of their marker
+The IDs are kept in an open addressing table (linear probing, DRONE_SLOTS slots) pointing into a dense
+array of drones, so dispatching the markers of a frame is one multiplicative hash and a probe or two
+per marker. Detection runs once per frame for every drone, only the pose solve and the control step
+are per drone. The pose solves run in parallel on the pool of the registry from DRONE_PARALLEL_MIN drones on,
+the control steps (a PID update and a post each) run on the control thread itself, so a control tick never
+waits behind the solves of a frame nor loses the priority of its thread
+The video and control threads share the registry, adding or removing a drone waits for both
+*/
+class DroneRegistry
+{
+	public:
+		DroneRegistry(); // Constructor of the class, starts the pool
+		~DroneRegistry(); // destructor of the class, stops every drone
+
+		/*
+		@ID of the marker on the drone
+		@setpoint
+		@serial port of its Arduino, owned by the registry from now on, nullptr for none
+		Adds a drone, returns false (and closes the port) if the ID is taken or the registry is full
+		*/
+		bool add(int, cv::Vec3d, SerialPort*);
+
+		/*
+		@ID of the marker on the drone
+		Stops and removes a drone, returns false if there is none with this ID
+		*/
+		bool remove(int);
+		void clear(); // Stops and removes every drone
+
+		/*
+		@ID of the marker
+		Returns the drone carrying the marker, nullptr if none. The drone stays valid until it is removed
+		*/
+		Drone* find(int);
+		size_t size(); // Returns number of drones
+
+		/*
+		@camera matrix
+		@distortion coefficients
+		Sets the intrinsics of every drone, and of the drones added later
+		*/
+		void setCalibration(const cv::Mat&, const cv::Mat&);
+
+		/*
+		@size of the frames
+		Sets the image size of every drone, and of the drones added later
+		*/
+		void setImageSize(cv::Size);
+
+		/*
+		@IDs of the markers detected on the frame
+		@corners of the markers
+		@capture time of the frame
+		Hands each drone its marker (or its absence) on the frame, returns the number of drones found
+		*/
+		size_t dispatch(const vector<int>&, const vector<vector<cv::Point2f>>&, std::chrono::steady_clock::time_point);
+
+		/*
+		@true if the system runs, false to stop the drones
+		@true in automatic mode
+		Runs the control step of every drone on the calling thread
+		*/
+		void control(bool, bool);
+		void printRegistryState(); // Prints every drone
+
+	private:
+		/*
+		@ID of the marker
+		Returns the first slot probed for the ID
+		*/
+		static size_t home(int);
+
+		/*
+		@ID of the marker
+		Returns the slot of the ID, or the free slot where it would go
+		*/
+		size_t probe(int);
+
+		/*
+		@dense index of the drone to remove
+		Removes a drone, the registry has to be locked
+		*/
+		void erase(size_t);
+
+		int keys[DRONE_SLOTS]; // marker ID per slot, DRONE_FREE_SLOT if empty
+		int indexes[DRONE_SLOTS]; // index in drones per slot
+		vector<Drone*> drones; // dense, iterated every frame
+		vector<int> matches; // index of the marker of each drone on the frame being dispatched, -1 if not found
+		cv::Mat cameraMatrix, distanceCoeff; // intrinsics for the drones added later
+		cv::Size imageSize; // size of the frames for the drones added later, empty until known
+
+		ThreadPool pool; // threads of the pose solves, only used by the video thread
+		std::shared_mutex mu; // shared by dispatch and control, exclusive to add and remove
+};
+
+#endif // DRONEREGISTRY_H
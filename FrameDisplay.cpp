@@ -0,0 +1,170 @@
+#include "stdafx.h"
+#include "FrameDisplay.h"
+
+// Frame display
+FrameDisplay::FrameDisplay(float rate, int width)
+{
+	this->running = false;
+	this->visible = false;
+	this->rate = rate;
+	this->rateLimit = PREVIEW_NO_LIMIT;
+	this->undistort = true;
+	this->distorted = false;
+	this->width = width;
+	this->pending = 0;
+	this->fresh = false;
+	this->lastSubmit = std::chrono::steady_clock::now();
+	this->renderedFrames = 0;
+	this->droppedFrames = 0;
+}
+FrameDisplay::~FrameDisplay()
+{
+	FrameDisplay::stop();
+}
+void FrameDisplay::start()
+{
+	FrameDisplay::stop();
+	this->fresh = false;
+	this->renderedFrames = 0;
+	this->droppedFrames = 0;
+	this->running = true;
+	this->displayThread = std::thread(&FrameDisplay::displayLoop, this);
+}
+void FrameDisplay::stop()
+{
+	FrameDisplay::mu.lock();
+	this->running = false;
+	FrameDisplay::mu.unlock();
+	this->ready.notify_all();
+	if (this->displayThread.joinable())
+		this->displayThread.join();
+}
+void FrameDisplay::setCalibration(const cv::Mat& cameraMatrix, const cv::Mat& distanceCoeff)
+{
+	// Only read by the display thread, set before it starts
+	cameraMatrix.copyTo(this->cameraMatrix);
+	distanceCoeff.copyTo(this->distanceCoeff);
+	this->distorted = !this->distanceCoeff.empty() && (cv::countNonZero(this->distanceCoeff) > 0);
+	this->mapSize = cv::Size();
+}
+bool FrameDisplay::isDue()
+{
+	float period = 1000.f / std::max(std::min(this->rate.load(), this->rateLimit.load()), 1.f);
+	return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - this->lastSubmit).count() >= period;
+}
+void FrameDisplay::submit(const cv::Mat& frame, const vector<vector<cv::Point2f>>& rejected, bool drawRejected,
+	bool droneDetected, cv::Vec3d rvec, cv::Vec3d tvec, bool drawAxes)
+{
+	this->lastSubmit = std::chrono::steady_clock::now();
+
+	std::lock_guard<std::mutex> lock(this->mu);
+	// Previous snapshot not shown yet, the display thread can't keep up
+	if (this->fresh) this->droppedFrames++;
+	DisplaySnapshot& snapshot = this->snapshots[this->pending];
+	frame.copyTo(snapshot.image);
+	snapshot.rejected = rejected;
+	snapshot.drawRejected = drawRejected;
+	snapshot.droneDetected = droneDetected;
+	snapshot.rvec = rvec;
+	snapshot.tvec = tvec;
+	snapshot.drawAxes = drawAxes;
+	this->fresh = true;
+	this->ready.notify_one();
+}
+void FrameDisplay::printDisplayState()
+{
+	cout << "Display:" << endl;
+	cout << "\t- Display thread: " << ((this->running) ? "running" : "stopped") << ", window " << ((this->visible) ? "shown" : "closed") << endl;
+	cout << "\t- Preview: " << this->width << " px wide at " << FrameDisplay::getRate() << " Hz";
+	if (this->rateLimit.load() < FrameDisplay::getRate())
+		cout << " (limited to " << this->rateLimit.load() << " Hz)";
+	cout << endl;
+	cout << "\t- Undistortion: " << ((!this->distorted) ? "none needed" : (this->undistort) ? "on" : "off") << endl;
+	cout << "\t- Frames rendered: " << this->renderedFrames << endl;
+	cout << "\t- Frames dropped by the display: " << this->droppedFrames << endl;
+}
+void FrameDisplay::scaleCalibration(cv::Size size, double scale)
+{
+	this->cameraMatrix.copyTo(this->previewMatrix);
+	this->previewMatrix.at<double>(0, 0) *= scale;
+	this->previewMatrix.at<double>(0, 2) *= scale;
+	this->previewMatrix.at<double>(1, 1) *= scale;
+	this->previewMatrix.at<double>(1, 2) *= scale;
+	if (this->distorted && (size != this->mapSize))
+	{
+		// Same camera matrix on both sides, the preview keeps its size and scale
+		cv::Size previewSize(cvRound(size.width * scale), cvRound(size.height * scale));
+		cv::initUndistortRectifyMap(this->previewMatrix, this->distanceCoeff, cv::Mat(), this->previewMatrix, previewSize, CV_16SC2, this->map1, this->map2);
+		this->mapSize = size;
+	}
+}
+void FrameDisplay::displayLoop()
+{
+	bool windowOpen = false;
+
+	while (this->running)
+	{
+		DisplaySnapshot* snapshot = nullptr;
+		{
+			// Wake up at least at the preview rate to keep the window responsive
+			std::unique_lock<std::mutex> lock(this->mu);
+			int period = static_cast<int>(1000.f / std::max(this->rate.load(), 1.f));
+			this->ready.wait_for(lock, std::chrono::milliseconds(period), [this] { return this->fresh || !this->running; });
+			if (!this->running) break;
+			if (this->fresh)
+			{
+				// Take the pending snapshot, submit writes the other one from now on
+				snapshot = &this->snapshots[this->pending];
+				this->pending = 1 - this->pending;
+				this->fresh = false;
+			}
+		}
+
+		if (!this->visible)
+		{
+			if (windowOpen) cv::destroyWindow(WEBCAM_WINDOW);
+			windowOpen = false;
+			continue;
+		}
+		if (!windowOpen)
+		{
+			cv::namedWindow(WEBCAM_WINDOW, CV_WINDOW_AUTOSIZE);
+			windowOpen = true;
+		}
+
+		if ((snapshot != nullptr) && !snapshot->image.empty())
+		{
+			// Downscale first, everything is drawn on the preview
+			double scale = std::min(1.0, this->width / static_cast<double>(snapshot->image.cols));
+			if (scale < 1.0)
+				cv::resize(snapshot->image, this->preview, cv::Size(), scale, scale, cv::INTER_AREA);
+			else
+				snapshot->image.copyTo(this->preview);
+
+			if (snapshot->drawRejected)
+			{
+				for (size_t i = 0; i < snapshot->rejected.size(); i++)
+					for (size_t j = 0; j < snapshot->rejected.at(i).size(); j++)
+						snapshot->rejected.at(i).at(j) *= scale;
+				cv::aruco::drawDetectedMarkers(this->preview, snapshot->rejected);
+			}
+			bool remapped = this->undistort && this->distorted;
+			if (!this->cameraMatrix.empty() && (remapped || (snapshot->drawAxes && snapshot->droneDetected)))
+				FrameDisplay::scaleCalibration(snapshot->image.size(), scale);
+			if (snapshot->drawAxes && snapshot->droneDetected && !this->cameraMatrix.empty())
+				cv::aruco::drawAxis(this->preview, this->previewMatrix, this->distanceCoeff, snapshot->rvec, snapshot->tvec, QR_CODE_SIZE);
+
+			// Drawn on the distorted preview, the overlays are undistorted with it
+			if (remapped && (this->map1.size() == this->preview.size()))
+			{
+				cv::remap(this->preview, this->undistorted, this->map1, this->map2, cv::INTER_LINEAR);
+				cv::imshow(WEBCAM_WINDOW, this->undistorted);
+			}
+			else
+				cv::imshow(WEBCAM_WINDOW, this->preview);
+			this->renderedFrames++;
+		}
+		cv::waitKey(1);
+	}
+	if (windowOpen) cv::destroyWindow(WEBCAM_WINDOW);
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#ifndef FRAMEDISPLAY_H
+#define FRAMEDISPLAY_H
+
+#include "VideoParameters.h"
+
+#define DISPLAY_RATE 15.f // Hz, default rate of the preview window
+#define PREVIEW_NO_LIMIT 1000.f // Hz, rate limit above any preview rate, the preview is not capped
+#define PREVIEW_WIDTH 640 // width in pixels of the preview, frames are downscaled to it
+
+// Frame and detections handed over to the display thread
+struct DisplaySnapshot
+{
+	cv::Mat image; // copy of the frame, buffer reused between snapshots
+	vector<vector<cv::Point2f>> rejected; // rejected candidates, in frame coordinates
+	bool drawRejected; // true to draw the rejected candidates
+	bool droneDetected; // true if the pose below is valid
+	cv::Vec3d rvec, tvec; // pose of the drone
+	bool drawAxes; // true to draw the axes of the drone marker
+};
+
+/*
+Class to render the webcam window on its own thread
+The processing thread only copies the frame and its detections when a new preview is due, the display
+thread downscales, draws and shows it. If the display thread is still busy with the previous snapshot,
+the older one is dropped, the processing thread never waits for the window
+The preview can be undistorted: the remap maps are built once per frame size and calibration, each preview
+is then a single cv::remap, drawn on before it so the overlays are undistorted with the frame
+All HighGUI calls are made by the display thread
+*/
+class FrameDisplay
+{
+	public:
+		/*
+		@preview rate in Hz
+		@preview width in pixels
+		Constructor of the class
+		*/
+		FrameDisplay(float, int);
+		~FrameDisplay(); // destructor of the class, stops the display thread
+		void start(); // Starts the display thread
+		void stop(); // Stops the display thread and closes the window
+
+		/*
+		@camera matrix
+		@distortion coefficients
+		Sets the calibration used to draw the axes and undistort the preview
+		*/
+		void setCalibration(const cv::Mat&, const cv::Mat&);
+
+		/*
+		@true to undistort the preview
+		Undistorts the preview or shows the frame as captured
+		*/
+		void setUndistort(bool undistort) { this->undistort = undistort; }
+		bool getUndistort() { return this->undistort.load(); } // Returns true if the preview is undistorted
+
+		/*
+		@true to show the window
+		Shows or closes the window
+		*/
+		void setVisible(bool visible) { this->visible = visible; }
+		float getRate() { return this->rate.load(); } // Returns preview rate in Hz
+
+		/*
+		@preview rate in Hz
+		Sets the preview rate
+		*/
+		void setRate(float rate) { this->rate = rate; }
+
+		/*
+		@highest preview rate in Hz, whatever the rate set
+		Caps the preview rate, used by FrameGovernor under load
+		*/
+		void setRateLimit(float limit) { this->rateLimit = limit; }
+		bool isDue(); // Returns true when a new snapshot should be submitted
+
+		/*
+		@frame
+		@rejected candidates
+		@true to draw the rejected candidates
+		@true if the drone has been detected
+		@rotation vector of the drone
+		@translation vector of the drone
+		@true to draw the axes of the drone marker
+		Copies a snapshot for the display thread, replaces the previous one if it hasn't been shown
+		*/
+		void submit(const cv::Mat&, const vector<vector<cv::Point2f>>&, bool, bool, cv::Vec3d, cv::Vec3d, bool);
+		void printDisplayState(); // Prints display rate and statistics
+
+	private:
+		void displayLoop(); // Routine run by the display thread
+
+		/*
+		@size of the frame
+		@scale of the preview
+		Sets previewMatrix to the camera matrix of the preview, and builds the remap maps again if the frame size changed
+		*/
+		void scaleCalibration(cv::Size, double);
+
+		std::thread displayThread; // thread rendering the window
+		std::atomic<bool> running; // true while the display thread runs
+		std::atomic<bool> visible; // true while the window should be shown
+		std::atomic<float> rate; // preview rate in Hz
+		std::atomic<float> rateLimit; // highest preview rate in Hz
+		std::atomic<bool> undistort; // true to undistort the preview
+		int width; // preview width
+
+		DisplaySnapshot snapshots[2]; // pending snapshot written by submit, and snapshot being rendered
+		int pending; // index of the pending snapshot
+		bool fresh; // true if the pending snapshot hasn't been taken by the display thread
+		std::mutex mu; // protects pending, fresh and the pending snapshot
+		std::condition_variable ready; // signals a new snapshot
+		std::chrono::steady_clock::time_point lastSubmit; // time of the last snapshot
+
+		cv::Mat cameraMatrix, distanceCoeff; // calibration of the frames
+		bool distorted; // true if a distortion coefficient is not null
+		cv::Mat previewMatrix; // camera matrix scaled to the preview
+		cv::Size mapSize; // frame size the maps were built for, empty to build them again
+		cv::Mat map1, map2; // remap of the preview, fixed point
+		cv::Mat preview; // downscaled frame
+		cv::Mat undistorted; // remapped preview
+
+		std::atomic<unsigned long long> renderedFrames; // snapshots shown
+		std::atomic<unsigned long long> droppedFrames; // snapshots replaced before being shown
+};
+
+#endif // FRAMEDISPLAY_H
@@ -0,0 +1,136 @@
+#include "stdafx.h"
+#include "FrameGovernor.h"
+
+// Quality levels, cheapest losses first: the preview, then the resolution, the tracking region and the corner refinement
+static const GovernorLevel governorLevels[GOVERNOR_LEVELS] = {
+	{ 0, ROI_PADDING, true, true, PREVIEW_NO_LIMIT },
+	{ 0, ROI_PADDING, true, false, GOVERNOR_PREVIEW_RATE },
+	{ 1, ROI_PADDING, true, false, GOVERNOR_PREVIEW_RATE },
+	{ 1, ROI_PADDING / 2.f, true, false, GOVERNOR_PREVIEW_RATE },
+	{ 2, ROI_PADDING / 2.f, true, false, GOVERNOR_PREVIEW_RATE },
+	{ 2, ROI_PADDING / 2.f, false, false, GOVERNOR_PREVIEW_RATE }
+};
+
+// Frame governor
+FrameGovernor::FrameGovernor(float rate)
+{
+	FrameGovernor::setRate(rate);
+	this->enabled = true;
+	this->level = 0;
+	this->smoothed = 0.0;
+	this->scale = 1;
+	// The first frames pay for warm-up (allocations, first search of the whole frame), the average starts after them
+	this->settling = GOVERNOR_SETTLE;
+	this->fastFrames = 0;
+	for (int l = 0; l < GOVERNOR_LEVELS; l++)
+		this->hold[l] = GOVERNOR_HOLD;
+	this->frames = this->lastUp = this->changes = 0;
+	this->lastUpFrom = -1;
+}
+bool FrameGovernor::update(double frameTime, MarkerDetector& detector, FrameDisplay& display)
+{
+	if (this->frames++ == 0)
+	{
+		this->start = std::chrono::steady_clock::now();
+		this->smoothed = frameTime;
+	}
+	int current = this->level.load();
+	this->scale = detector.getScale();
+
+	// Off: back to full quality, the average starts again once turned back on
+	if (!this->enabled.load())
+	{
+		this->smoothed = frameTime;
+		this->settling = GOVERNOR_SETTLE;
+		if (current == 0) return false;
+		FrameGovernor::setLevel(0, detector, display);
+		return true;
+	}
+
+	// The level above held long enough, it may be tried again as fast as the others
+	if ((this->lastUpFrom > current) && (this->frames - this->lastUp == GOVERNOR_BOUNCE))
+		this->hold[this->lastUpFrom] = GOVERNOR_HOLD;
+
+	// Frames started before the change, the average restarts after them
+	if (this->settling > 0)
+	{
+		this->settling--;
+		this->smoothed = frameTime;
+		return false;
+	}
+	double smoothed = this->smoothed.load();
+	smoothed += (frameTime - smoothed) / GOVERNOR_SMOOTHING;
+	this->smoothed = smoothed;
+
+	double budget = 1000.0 / this->rate.load();
+	if ((smoothed > budget) && (current < GOVERNOR_LEVELS - 1))
+	{
+		// Given back too early, wait longer before trying again
+		if ((this->lastUpFrom == current + 1) && (this->frames - this->lastUp < GOVERNOR_BOUNCE))
+			this->hold[current + 1] = std::min(2 * this->hold[current + 1], GOVERNOR_MAX_HOLD);
+		FrameGovernor::setLevel(current + 1, detector, display);
+		return true;
+	}
+	this->fastFrames = (smoothed < GOVERNOR_HEADROOM * budget) ? this->fastFrames + 1 : 0;
+	if ((current > 0) && (this->fastFrames >= this->hold[current]))
+	{
+		this->lastUp = this->frames;
+		this->lastUpFrom = current;
+		FrameGovernor::setLevel(current - 1, detector, display);
+		return true;
+	}
+	return false;
+}
+void FrameGovernor::setLevel(int level, MarkerDetector& detector, FrameDisplay& display)
+{
+	const GovernorLevel& settings = governorLevels[level];
+	detector.setScaleSteps(settings.scaleSteps);
+	detector.setRoiPadding(settings.roiPadding);
+	detector.setRefinement((settings.refinement) ? parameter::on : parameter::off);
+	display.setRateLimit(settings.previewRate);
+
+	std::stringstream change;
+	change << std::chrono::duration<float>(std::chrono::steady_clock::now() - this->start).count() << " s: level "
+		<< this->level.load() << " -> " << level << " (" << FrameGovernor::describe(level) << "), processing "
+		<< this->smoothed.load() << " ms for a budget of " << 1000.f / this->rate.load() << " ms";
+	cout << "Frame governor: " << change.str() << "." << endl;
+
+	this->level = level;
+	this->settling = GOVERNOR_SETTLE;
+	this->fastFrames = 0;
+	this->changes++;
+	std::lock_guard<std::mutex> lock(this->mu);
+	this->history.push_back(change.str());
+	if (this->history.size() > GOVERNOR_HISTORY) this->history.pop_front();
+}
+bool FrameGovernor::getOverlay()
+{
+	return governorLevels[this->level.load()].overlay;
+}
+string FrameGovernor::describe(int level)
+{
+	const GovernorLevel& settings = governorLevels[level];
+	if (level == 0) return "full quality";
+	std::stringstream description;
+	description << "preview " << settings.previewRate << " Hz without overlay";
+	// Resolution actually searched, MarkerDetector goes no lower than 1/4
+	int scale = this->scale.load();
+	int effective = std::min(4, scale << settings.scaleSteps);
+	if (effective > scale) description << ", detection resolution 1/" << effective;
+	if (settings.roiPadding < ROI_PADDING) description << ", ROI padding " << settings.roiPadding;
+	if (!settings.refinement) description << ", no corner refinement";
+	return description.str();
+}
+void FrameGovernor::printGovernorState()
+{
+	cout << "Frame governor:" << endl;
+	cout << "\t- " << ((this->enabled.load()) ? "On" : "Off") << ", minimum pose rate " << this->rate.load() << " Hz ("
+		<< 1000.f / this->rate.load() << " ms per frame)" << endl;
+	cout << "\t- Level " << this->level.load() << " of " << GOVERNOR_LEVELS - 1 << ": " << FrameGovernor::describe(this->level.load()) << endl;
+	if (this->frames > 0)
+		cout << "\t- Processing time: " << this->smoothed.load() << " ms (averaged over " << GOVERNOR_SMOOTHING << " frames), "
+			<< this->changes << " level changes" << endl;
+	std::lock_guard<std::mutex> lock(this->mu);
+	for (size_t i = 0; i < this->history.size(); i++)
+		cout << "\t\t- " << this->history.at(i) << endl;
+}
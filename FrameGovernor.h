@@ -0,0 +1,109 @@
+#pragma once
+
+#ifndef FRAMEGOVERNOR_H
+#define FRAMEGOVERNOR_H
+
+#include "stdafx.h"
+#include "MarkerDetector.h"
+#include "FrameDisplay.h"
+
+#define GOVERNOR_RATE 25.f // Hz, default minimum pose rate, the budget of a frame is its period
+#define GOVERNOR_MIN_RATE 1.f // Hz, lowest rate accepted
+#define GOVERNOR_LEVELS 6 // quality levels, 0 is full quality
+#define GOVERNOR_SMOOTHING 8 // frames the processing time is averaged over
+#define GOVERNOR_HEADROOM 0.6 // fraction of the budget below which the level above is tried again
+#define GOVERNOR_SETTLE 5 // frames ignored at start and after a level change, warm-up or started with the old settings
+#define GOVERNOR_HOLD 60 // frames within the headroom before the level above is tried, about 2 s at 30 fps
+#define GOVERNOR_MAX_HOLD 1920 // frames, the hold doubles each time the level above turns out to be too slow
+#define GOVERNOR_BOUNCE 120 // frames, going back down sooner after going up means the level above is too slow
+#define GOVERNOR_HISTORY 16 // level changes kept for printGovernorState
+#define GOVERNOR_PREVIEW_RATE 5.f // Hz, preview rate under load
+
+// Detection and display settings of a quality level
+struct GovernorLevel
+{
+	int scaleSteps; // halvings of the detection resolution on top of the detection scale
+	float roiPadding; // padding of the tracking region, relative to the marker box
+	bool refinement; // subpixel refinement of the corners found on a downscaled image
+	bool overlay; // rejected candidates and axes drawn on the preview
+	float previewRate; // Hz, highest preview rate
+};
+
+/*
+Class to hold the processing time of a frame within the budget of a minimum pose rate
+The processing time of each frame (detection, pose, hand-over to the control and display threads) is
+averaged over GOVERNOR_SMOOTHING frames, from the end of the GOVERNOR_SETTLE warm-up frames. Over the budget, the governor steps down one quality level:
+preview overlays and rate first, then detection resolution, tracking region size and corner refinement.
+Within GOVERNOR_HEADROOM of the budget for GOVERNOR_HOLD frames, it steps back up one level. A level that
+is given back and lost again within GOVERNOR_BOUNCE frames doubles its hold, so the governor doesn't
+oscillate between two levels. Every change is printed and kept for printGovernorState
+Only the video thread updates the governor
+*/
+class FrameGovernor
+{
+	public:
+		/*
+		@minimum pose rate in Hz
+		Constructor of the class
+		*/
+		FrameGovernor(float);
+
+		/*
+		@processing time of the frame in ms
+		@detector to set the detection settings of
+		@display to set the preview settings of
+		Records the processing time of a frame, returns true if the level changed
+		*/
+		bool update(double, MarkerDetector&, FrameDisplay&);
+		float getRate() { return this->rate.load(); } // Returns minimum pose rate in Hz
+
+		/*
+		@minimum pose rate in Hz, at least GOVERNOR_MIN_RATE
+		Sets the budget of a frame
+		*/
+		void setRate(float rate) { this->rate = std::max(rate, GOVERNOR_MIN_RATE); }
+		bool isEnabled() { return this->enabled.load(); } // Returns true if the governor changes the settings
+
+		/*
+		@true to govern, false to go back to full quality at the next frame
+		Turns the governor on or off
+		*/
+		void setEnabled(bool enabled) { this->enabled = enabled; }
+		int getLevel() { return this->level.load(); } // Returns current level, 0 is full quality
+		bool getOverlay(); // Returns true if overlays may be drawn on the preview
+		void printGovernorState(); // Prints rate, level, settings, processing time and last level changes
+
+	private:
+		/*
+		@level
+		Returns a description of the settings of a level, at the detection scale of the last frame
+		*/
+		string describe(int);
+
+		/*
+		@new level
+		@detector
+		@display
+		Applies the settings of a level and logs the change
+		*/
+		void setLevel(int, MarkerDetector&, FrameDisplay&);
+
+		std::atomic<float> rate; // minimum pose rate in Hz
+		std::atomic<bool> enabled; // governor on/off
+		std::atomic<int> level; // current level
+		std::atomic<double> smoothed; // averaged processing time in ms
+		std::atomic<int> scale; // detection scale of the last frame, the levels lower the resolution from it
+		int settling; // frames still ignored since the last change
+		int fastFrames; // consecutive frames within the headroom
+		int hold[GOVERNOR_LEVELS]; // frames within the headroom before leaving each level upwards
+		unsigned long long frames; // frames recorded
+		unsigned long long lastUp; // frame of the last step up
+		int lastUpFrom; // level of the last step up, -1 if none
+		std::chrono::steady_clock::time_point start; // time of the first frame
+
+		std::mutex mu; // protects the history
+		std::deque<string> history; // last level changes
+		unsigned long long changes; // level changes since start
+};
+
+#endif // FRAMEGOVERNOR_H
@@ -0,0 +1,226 @@
+#include "stdafx.h"
+#include "FrameGrabber.h"
+
+// Frame grabber
+FrameGrabber::FrameGrabber()
+{
+	this->running = false;
+	this->replay = false;
+	this->realtime = true;
+	this->replayFps = REPLAY_DEFAULT_FPS;
+	this->nextFile = 0;
+	this->middle = 1;
+	this->back = 0;
+	this->front = 2;
+	this->capturedFrames = 0;
+	this->droppedFrames = 0;
+	this->overwrittenFrames = 0;
+	this->driverTimestamps = 0;
+	this->clockMapped = this->steadyDriverClock = false;
+	this->driverOffset = this->lastDriverTime = 0.0;
+}
+FrameGrabber::~FrameGrabber()
+{
+	FrameGrabber::stop();
+}
+bool FrameGrabber::start(int webcam)
+{
+	// Only one capture thread at a time
+	FrameGrabber::stop();
+
+	this->replay = false;
+	this->files.clear();
+	this->vid.open(webcam);
+	if (!this->vid.isOpened()) return false;
+	// Ask the driver to keep as few frames as possible in its own queue (not supported by every backend)
+	this->vid.set(cv::CAP_PROP_BUFFERSIZE, 1);
+	return FrameGrabber::startThread();
+}
+bool FrameGrabber::startReplay(string path, bool realtime)
+{
+	FrameGrabber::stop();
+
+	this->replay = true;
+	this->realtime = realtime;
+	this->replayFps = REPLAY_DEFAULT_FPS;
+	this->files.clear();
+	this->nextFile = 0;
+	// Video file or image sequence pattern, else every image of a directory in name order
+	this->vid.open(path);
+	if (this->vid.isOpened())
+	{
+		double fps = this->vid.get(cv::CAP_PROP_FPS);
+		if (fps > 0) this->replayFps = fps;
+	}
+	else
+	{
+		cv::glob(path, this->files, false);
+		if (this->files.empty()) return false;
+		std::sort(this->files.begin(), this->files.end());
+	}
+	return FrameGrabber::startThread();
+}
+bool FrameGrabber::startThread()
+{
+	// Preallocate the frame pool at the resolution of the webcam, retrieve() then reuses the buffers
+	int width = static_cast<int>(this->vid.get(cv::CAP_PROP_FRAME_WIDTH));
+	int height = static_cast<int>(this->vid.get(cv::CAP_PROP_FRAME_HEIGHT));
+	for (size_t i = 0; i < FRAME_BUFFERS; i++)
+	{
+		if ((width > 0) && (height > 0))
+			this->frames[i].image.create(height, width, CV_8UC3);
+		this->frames[i].sequence = 0;
+		this->frames[i].driverTimestamp = false;
+	}
+
+	// Reset buffer indexes and statistics
+	this->back = 0;
+	this->middle = 1;
+	this->front = 2;
+	this->capturedFrames = 0;
+	this->droppedFrames = 0;
+	this->overwrittenFrames = 0;
+	this->driverTimestamps = 0;
+	this->grabDelay.reset();
+	this->clockMapped = false;
+	this->lastDriverTime = 0.0;
+
+	this->running = true;
+	this->captureThread = std::thread(&FrameGrabber::captureLoop, this);
+	return true;
+}
+void FrameGrabber::stop()
+{
+	// Under the lock, a fast replay waiting for the consumer can't miss it
+	{
+		std::lock_guard<std::mutex> lock(this->takenMu);
+		this->running = false;
+	}
+	this->taken.notify_all();
+	if (this->captureThread.joinable())
+		this->captureThread.join();
+	if (this->vid.isOpened())
+		this->vid.release();
+}
+CapturedFrame* FrameGrabber::getLatestFrame()
+{
+	// Nothing new since last call
+	if (!(this->middle.load(std::memory_order_acquire) & FRESH_FRAME))
+		return nullptr;
+	// Swap the consumer buffer with the freshly published one
+	unsigned int previous = this->middle.exchange(this->front, std::memory_order_acq_rel);
+	this->front = previous & ~FRESH_FRAME;
+	// A fast replay reads the next frame once this one is taken
+	if (this->replay && !this->realtime)
+	{
+		std::lock_guard<std::mutex> lock(this->takenMu);
+		this->taken.notify_one();
+	}
+	return &this->frames[this->front];
+}
+void FrameGrabber::printCaptureState()
+{
+	cout << "Capture:" << endl;
+	cout << "\t- Capture thread: " << ((FrameGrabber::isRunning()) ? "running" : "stopped") << endl;
+	cout << "\t- Frames captured: " << FrameGrabber::getCapturedFrames() << endl;
+	cout << "\t- Frames dropped: " << FrameGrabber::getDroppedFrames() << endl;
+	cout << "\t- Frames overwritten before detection: " << FrameGrabber::getOverwrittenFrames() << endl;
+	cout << "\t- Timestamps: " << ((this->driverTimestamps.load() > 0) ? "driver" : "grab time") << " (" << this->driverTimestamps.load() << " frames stamped by the driver)" << endl;
+	if (this->grabDelay.getCount() > 0)
+		cout << "\t- Driver timestamp to grab: p50 " << this->grabDelay.percentile(0.5) << " ms, p99 " << this->grabDelay.percentile(0.99)
+			<< " ms, max " << this->grabDelay.getMax() << " ms" << endl;
+}
+void FrameGrabber::captureLoop()
+{
+	int failures = 0; // consecutive failed grabs
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now(); // start of the replay
+
+	while (this->running)
+	{
+		CapturedFrame& frame = this->frames[this->back];
+
+		if (this->replay)
+		{
+			// Recorded pace, the frame is due at its time in the recording
+			if (this->realtime)
+				std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<long long>(1e6 * this->capturedFrames / this->replayFps)));
+			// As fast as possible, but no frame is skipped: wait until the consumer took the last one
+			else
+			{
+				std::unique_lock<std::mutex> lock(this->takenMu);
+				this->taken.wait(lock, [this] { return !this->running || !(this->middle.load(std::memory_order_acquire) & FRESH_FRAME); });
+			}
+		}
+
+		if (!FrameGrabber::readFrame(frame))
+		{
+			// End of the recording
+			if (this->replay)
+			{
+				this->running = false;
+				break;
+			}
+			this->droppedFrames++;
+			// Camera unplugged or closed
+			if (++failures >= MAX_GRAB_FAILURES) this->running = false;
+			continue;
+		}
+		frame.sequence = ++this->capturedFrames;
+		failures = 0;
+
+		// Publish the frame, and take back the previous shared buffer to write the next one
+		unsigned int previous = this->middle.exchange(this->back | FRESH_FRAME, std::memory_order_acq_rel);
+		if (previous & FRESH_FRAME) this->overwrittenFrames++;
+		this->back = previous & ~FRESH_FRAME;
+	}
+}
+bool FrameGrabber::readFrame(CapturedFrame& frame)
+{
+	if (this->files.empty())
+	{
+		// grab() returns as soon as the driver has a frame, stamp it before decoding
+		bool grabbed = this->vid.grab();
+		frame.grabbed = frame.timestamp = std::chrono::steady_clock::now();
+		frame.driverTimestamp = false;
+		if (grabbed && !this->replay) FrameGrabber::stampFrame(frame);
+		return grabbed && this->vid.retrieve(frame.image);
+	}
+
+	// Files that aren't images are skipped
+	while (this->nextFile < this->files.size())
+	{
+		frame.image = cv::imread(this->files.at(this->nextFile++), cv::IMREAD_COLOR);
+		frame.grabbed = frame.timestamp = std::chrono::steady_clock::now();
+		frame.driverTimestamp = false;
+		if (!frame.image.empty()) return true;
+	}
+	return false;
+}
+void FrameGrabber::stampFrame(CapturedFrame& frame)
+{
+	// 0 or -1 if the backend doesn't stamp its buffers, a timestamp that doesn't move isn't one either
+	double driver = this->vid.get(cv::CAP_PROP_POS_MSEC);
+	if ((driver <= 0.0) || (driver <= this->lastDriverTime)) return;
+	this->lastDriverTime = driver;
+
+	// The first frame tells whether the driver stamps on the steady clock, another clock is mapped
+	// by the offset of the frame grabbed the fastest
+	double grabbed = std::chrono::duration<double, std::milli>(frame.grabbed.time_since_epoch()).count();
+	double offset = grabbed - driver;
+	if (!this->clockMapped)
+	{
+		this->steadyDriverClock = (offset >= 0.0) && (offset < DRIVER_CLOCK_WINDOW);
+		this->driverOffset = offset;
+		this->clockMapped = true;
+	}
+	else if (!this->steadyDriverClock)
+		this->driverOffset = std::min(this->driverOffset, offset);
+	double capture = driver + ((this->steadyDriverClock) ? 0.0 : this->driverOffset);
+	// Stamped after the grab, or too long before it: not the time of this frame
+	if ((capture > grabbed) || (grabbed - capture >= DRIVER_CLOCK_WINDOW)) return;
+
+	frame.timestamp = std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(capture)));
+	frame.driverTimestamp = true;
+	this->driverTimestamps++;
+	this->grabDelay.record(frame.grabbed - frame.timestamp);
+}
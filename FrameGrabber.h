@@ -0,0 +1,117 @@
+#pragma once
+
+#ifndef FRAMEGRABBER_H
+#define FRAMEGRABBER_H
+
+#include "stdafx.h"
+#include "LatencyMonitor.h"
+
+#define FRAME_BUFFERS 3 // number of preallocated frame buffers (triple buffer)
+#define FRESH_FRAME 0x4u // flag set on the shared buffer index when it holds a frame that hasn't been read
+#define MAX_GRAB_FAILURES 50 // number of consecutive failed grabs before the camera is considered lost
+#define REPLAY_DEFAULT_FPS 30.0 // frame rate of replayed image sequences, and of videos without frame rate
+#define DRIVER_CLOCK_WINDOW 1000.0 // ms, a driver timestamp this close before the grab is taken to be on the steady clock
+
+// Frame published by the capture thread
+struct CapturedFrame
+{
+	cv::Mat image; // preallocated image buffer
+	std::chrono::steady_clock::time_point timestamp; // capture time, from the driver if it stamps its buffers, grab time otherwise
+	std::chrono::steady_clock::time_point grabbed; // time the frame was grabbed from the driver
+	bool driverTimestamp; // true if the capture time comes from the driver
+	unsigned long long sequence; // number of the frame since the capture started
+};
+
+/*
+Class to capture frames from a webcam on a dedicated thread
+Frames are grabbed into a pool of preallocated buffers, and only the newest one
+is published to the consumer through a lock-free triple buffer
+A recorded video or a directory of images can be replayed instead of a webcam, either at the recorded
+pace (frames are overwritten like with a webcam) or as fast as possible (every frame is handed over)
+Webcam frames carry the time the driver stamped their buffer (CAP_PROP_POS_MSEC, the monotonic clock
+of V4L2 on Linux) when the backend exposes it. A driver clock other than the steady clock is mapped on
+it by the smallest grab - driver offset seen, so only the jitter of the delivery is recovered
+*/
+class FrameGrabber
+{
+	public:
+		FrameGrabber(); // Constructor of the class
+		~FrameGrabber(); // destructor of the class, stops the capture thread
+
+		/*
+		@index of the webcam to open
+		Opens the webcam and starts the capture thread
+		Returns false if the webcam could not be opened
+		*/
+		bool start(int);
+
+		/*
+		@video file, image sequence pattern (img_%04d.png) or directory of images
+		@true to replay at the recorded frame rate, false as fast as the consumer reads the frames
+		Opens the recording and starts the capture thread, which stops at the end of the recording
+		Returns false if nothing could be opened
+		*/
+		bool startReplay(string, bool);
+		bool isReplaying() { return this->replay; } // Returns true if frames come from a recording
+		void stop(); // Stops the capture thread and releases the webcam
+		bool isRunning() { return this->running.load(); } // Returns true while the capture thread delivers frames
+
+		/*
+		Returns the newest frame if a new one has been published since last call, nullptr otherwise
+		The returned frame belongs to the caller until the next call
+		*/
+		CapturedFrame* getLatestFrame();
+		unsigned long long getCapturedFrames() { return this->capturedFrames.load(); } // Returns number of captured frames
+		unsigned long long getDroppedFrames() { return this->droppedFrames.load(); } // Returns number of frames the driver failed to deliver
+		unsigned long long getOverwrittenFrames() { return this->overwrittenFrames.load(); } // Returns number of frames replaced before being read
+		unsigned long long getDriverTimestamps() { return this->driverTimestamps.load(); } // Returns number of frames stamped by the driver
+		void printCaptureState(); // Prints capture statistics
+
+	private:
+		void captureLoop(); // Routine run by the capture thread
+		bool startThread(); // Preallocates the frame pool, resets statistics and starts the capture thread
+
+		/*
+		@frame to fill
+		Reads the next frame of the webcam or of the recording, returns false if none could be read
+		*/
+		bool readFrame(CapturedFrame&);
+
+		/*
+		@grabbed frame
+		Replaces the grab time of the frame by the time the driver stamped it, if the backend exposes it
+		*/
+		void stampFrame(CapturedFrame&);
+
+		cv::VideoCapture vid; // webcam, only accessed by the capture thread while running
+		std::thread captureThread; // thread grabbing frames
+		std::atomic<bool> running; // true while the capture thread runs
+
+		// Replay
+		bool replay; // true if frames come from a recording
+		bool realtime; // true to replay at the recorded frame rate
+		double replayFps; // recorded frame rate
+		vector<cv::String> files; // images of a replayed directory, empty for a video
+		size_t nextFile; // index of the next image to read
+		std::mutex takenMu; // pairs with taken
+		std::condition_variable taken; // notified when a frame is taken during a fast replay, and on stop
+
+		// Driver clock, capture thread only
+		bool clockMapped; // true once the first driver timestamp has been seen
+		bool steadyDriverClock; // true if the driver stamps on the steady clock
+		double driverOffset; // ms from the driver clock to the steady clock
+		double lastDriverTime; // ms, driver timestamp of the previous frame
+
+		CapturedFrame frames[FRAME_BUFFERS]; // frame pool
+		std::atomic<unsigned int> middle; // index of the shared buffer, FRESH_FRAME set when unread
+		unsigned int back; // index of the buffer written by the capture thread
+		unsigned int front; // index of the buffer owned by the consumer
+
+		std::atomic<unsigned long long> capturedFrames; // frames grabbed since start
+		std::atomic<unsigned long long> droppedFrames; // failed grabs since start
+		std::atomic<unsigned long long> overwrittenFrames; // frames published but never read
+		std::atomic<unsigned long long> driverTimestamps; // frames stamped by the driver
+		LatencyHistogram grabDelay; // driver timestamp to end of the grab
+};
+
+#endif // FRAMEGRABBER_H
@@ -0,0 +1,85 @@
+#include "stdafx.h"
+#include "LatencyMonitor.h"
+
+// Latency histogram
+LatencyHistogram::LatencyHistogram()
+{
+	LatencyHistogram::reset();
+}
+void LatencyHistogram::record(std::chrono::steady_clock::duration elapsed)
+{
+	long long us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+	unsigned long long value = (us > 0) ? static_cast<unsigned long long>(us) : 0;
+
+	this->buckets[LatencyHistogram::bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	this->count.fetch_add(1, std::memory_order_relaxed);
+	unsigned long long previous = this->max.load(std::memory_order_relaxed);
+	while ((value > previous) && !this->max.compare_exchange_weak(previous, value, std::memory_order_relaxed)) { ; }
+}
+double LatencyHistogram::percentile(double fraction)
+{
+	unsigned long long total = LatencyHistogram::getCount();
+	if (total == 0) return 0.0;
+
+	// Rank of the value, 1 for the smallest
+	unsigned long long rank = static_cast<unsigned long long>(std::ceil(fraction * total));
+	if (rank < 1) rank = 1;
+	if (rank >= total) return LatencyHistogram::getMax();
+	unsigned long long seen = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		seen += this->buckets[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+			return std::min(LatencyHistogram::bucketValue(i) / 1000.0, LatencyHistogram::getMax());
+	}
+	// Values recorded while reading
+	return LatencyHistogram::getMax();
+}
+void LatencyHistogram::reset()
+{
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+		this->buckets[i].store(0, std::memory_order_relaxed);
+	this->count.store(0, std::memory_order_relaxed);
+	this->max.store(0, std::memory_order_relaxed);
+}
+size_t LatencyHistogram::bucketIndex(unsigned long long value)
+{
+	if (value < LATENCY_SUB_BUCKETS) return static_cast<size_t>(value);
+
+	// Power of two the value lies in, then linear position inside it
+	size_t magnitude = 0;
+	while ((value >> magnitude) >= 2 * LATENCY_SUB_BUCKETS) magnitude++;
+	if (magnitude >= LATENCY_MAGNITUDES) return LATENCY_BUCKETS - 1;
+	return (magnitude + 1) * LATENCY_SUB_BUCKETS + static_cast<size_t>(value >> magnitude) - LATENCY_SUB_BUCKETS;
+}
+double LatencyHistogram::bucketValue(size_t index)
+{
+	if (index < LATENCY_SUB_BUCKETS) return static_cast<double>(index);
+
+	size_t magnitude = index / LATENCY_SUB_BUCKETS - 1;
+	unsigned long long lower = static_cast<unsigned long long>(index % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS) << magnitude;
+	return lower + ((1ull << magnitude) - 1) / 2.0;
+}
+
+// Latency monitor
+void LatencyMonitor::printLatencyState()
+{
+	const char* names[LATENCY_STAGES] = { "Capture -> detection    ", "Detection -> pose       ", "Pose -> decision        ",
+		"Decision -> serial queue", "Capture -> serial queue " };
+	cout << "Latency per frame (steady clock):" << endl;
+	for (size_t i = 0; i < LATENCY_STAGES; i++)
+	{
+		LatencyHistogram& histogram = this->histograms[i];
+		cout << "\t- " << names[i] << ": ";
+		if (histogram.getCount() == 0)
+			cout << "no frame yet" << endl;
+		else
+			cout << "p50 " << histogram.percentile(0.5) << " ms, p99 " << histogram.percentile(0.99) << " ms, max "
+				<< histogram.getMax() << " ms (" << histogram.getCount() << " frames)" << endl;
+	}
+}
+void LatencyMonitor::reset()
+{
+	for (size_t i = 0; i < LATENCY_STAGES; i++)
+		this->histograms[i].reset();
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#ifndef LATENCYMONITOR_H
+#define LATENCYMONITOR_H
+
+#include "stdafx.h"
+
+#define LATENCY_SUB_BUCKETS 32 // linear buckets per power of two, values are kept within 1/32 of their size
+#define LATENCY_MAGNITUDES 27 // powers of two above the linear range, latencies up to about 70 minutes in us
+#define LATENCY_BUCKETS ((LATENCY_MAGNITUDES + 1) * LATENCY_SUB_BUCKETS) // buckets of a histogram
+#define LATENCY_STAGES 5 // number of timed stages of a frame
+
+// Enumeration to store the timed stages of a frame, from its capture to the serial write it leads to
+enum latencyStage
+{
+	detectionLatency = 0, // capture to end of detection, time waiting for the processing thread included
+	poseLatency = 1, // detection to pose, fusion included
+	decisionLatency = 2, // pose to controller decision
+	writeLatency = 3, // controller decision to command posted to the serial writer, time waiting for the next send slot included
+	endToEndLatency = 4 // capture to command posted to the serial writer, see SerialLink for the time to the wire
+};
+
+// Timestamps of the newest processed frame through the pipeline, all taken on the steady clock
+struct FrameTimeline
+{
+	std::chrono::steady_clock::time_point capture, detection, pose, decision;
+	bool decided; // true once the controller has run on the frame
+	bool written; // true once a command computed from the frame has been written to the serial port
+};
+
+/*
+Class to store a latency distribution in fixed log-linear buckets (HDR histogram)
+Values below LATENCY_SUB_BUCKETS us have their own bucket, larger ones are split in LATENCY_SUB_BUCKETS
+buckets per power of two, so percentiles are exact to about 3 % whatever the range
+Recording is lock-free and never allocates, any thread may read the percentiles meanwhile
+*/
+class LatencyHistogram
+{
+	public:
+		LatencyHistogram(); // Constructor of the class
+
+		/*
+		@time to record
+		Adds a value to the histogram, negative values count as 0
+		*/
+		void record(std::chrono::steady_clock::duration);
+
+		/*
+		@fraction of the values, 0.5 for the median
+		Returns the value in ms below which the fraction of the recorded values lies, 0 if empty
+		*/
+		double percentile(double);
+		unsigned long long getCount() { return this->count.load(std::memory_order_relaxed); } // Returns number of recorded values
+		double getMax() { return this->max.load(std::memory_order_relaxed) / 1000.0; } // Returns largest recorded value in ms
+		void reset(); // Forgets all values
+
+	private:
+		/*
+		@value in us
+		Returns index of the bucket holding the value
+		*/
+		static size_t bucketIndex(unsigned long long);
+
+		/*
+		@index of a bucket
+		Returns value in us in the middle of the bucket
+		*/
+		static double bucketValue(size_t);
+
+		std::atomic<unsigned long long> buckets[LATENCY_BUCKETS]; // number of values per bucket
+		std::atomic<unsigned long long> count; // number of values
+		std::atomic<unsigned long long> max; // largest value in us
+};
+
+/*
+Class to keep a latency histogram per stage of the frames
+Stages are measured between the timestamps of a frame, so the capture to serial write latency is their sum
+*/
+class LatencyMonitor
+{
+	public:
+		/*
+		@stage of the frame
+		@time spent in the stage
+		Records the time spent in a stage, may be called from any thread
+		*/
+		void record(latencyStage stage, std::chrono::steady_clock::duration elapsed) { this->histograms[stage].record(elapsed); }
+
+		/*
+		@stage of the frame
+		Returns the histogram of a stage
+		*/
+		LatencyHistogram& getHistogram(latencyStage stage) { return this->histograms[stage]; }
+		void printLatencyState(); // Prints p50/p99/max latency of each stage
+		void reset(); // Forgets all values
+
+	private:
+		LatencyHistogram histograms[LATENCY_STAGES]; // one histogram per stage
+};
+
+#endif // LATENCYMONITOR_H
@@ -0,0 +1,198 @@
+#pragma once
+
+#ifndef LINEARMPC_H
+#define LINEARMPC_H
+
+#include "stdafx.h"
+
+/*
+Class template of a linear MPC with a horizon of N steps, NX states and NU inputs, sizes fixed at compile time
+Cost over the horizon: sum of (x_k - r)' Q (x_k - r) + u_k' R u_k for x_1..x_N, with diagonal Q and R,
+inputs bounded by lower <= u_k <= upper
+The states are eliminated (condensed QP on the N * NU inputs): the Hessian, and the matrices giving the
+linear term from the current state and the reference, are computed once by setup. Each solve then runs
+ADMM iterations warm started from the previous solution shifted by one step, each iteration is one
+product with the precomputed inverse of (H + rho I) and a clamp. All storage is in the object, nothing
+is allocated on the heap, and the returned inputs always satisfy the bounds
+*/
+template <int N, int NX, int NU>
+class LinearMpc
+{
+	public:
+		static const int NV = N * NU; // number of decision variables
+
+		LinearMpc() { this->ready = false; LinearMpc::reset(); } // Constructor of the class, setup has to be called before solving
+
+		/*
+		@state transition matrix A, x_k+1 = A x_k + B u_k
+		@input matrix B
+		@diagonal of the state weight Q
+		@diagonal of the input weight R, strictly positive
+		@lower bound of the inputs
+		@upper bound of the inputs
+		Precomputes the condensed QP, takes O((N * NU)^3) operations, not to be called in the control loop
+		*/
+		void setup(const cv::Matx<double, NX, NX>& A, const cv::Matx<double, NX, NU>& B, const cv::Vec<double, NX>& Q, const cv::Vec<double, NU>& R,
+			const cv::Vec<double, NU>& lower, const cv::Vec<double, NU>& upper)
+		{
+			// Powers of A and impulse responses A^m B
+			cv::Matx<double, NX, NX> powers[N + 1];
+			cv::Matx<double, NX, NU> responses[N];
+			powers[0] = cv::Matx<double, NX, NX>::eye();
+			for (int m = 1; m <= N; m++)
+				powers[m] = A * powers[m - 1];
+			for (int m = 0; m < N; m++)
+				responses[m] = powers[m] * B;
+			cv::Matx<double, NX, NX> weight = cv::Matx<double, NX, NX>::diag(Q);
+
+			// Input i acts on the states i+1..N: H_ij = sum over k >= max(i,j) of (A^(k-i) B)' Q A^(k-j) B, + R on the diagonal
+			// Linear term: f_i = F_i x0 - Fr_i r with F_i = sum over k >= i of (A^(k-i) B)' Q A^(k+1) and Fr_i = sum of (A^(k-i) B)' Q
+			double trace = 0.0;
+			for (int i = 0; i < N; i++)
+			{
+				for (int j = 0; j < N; j++)
+				{
+					cv::Matx<double, NU, NU> block;
+					for (int k = std::max(i, j); k < N; k++)
+						block += responses[k - i].t() * weight * responses[k - j];
+					for (int a = 0; a < NU; a++)
+						for (int b = 0; b < NU; b++)
+							this->inverse[i * NU + a][j * NU + b] = block(a, b) + (((i == j) && (a == b)) ? R[a] : 0.0);
+				}
+				cv::Matx<double, NU, NX> state, reference;
+				for (int k = i; k < N; k++)
+				{
+					state += responses[k - i].t() * weight * powers[k + 1];
+					reference += responses[k - i].t() * weight;
+				}
+				for (int a = 0; a < NU; a++)
+				{
+					for (int s = 0; s < NX; s++)
+					{
+						this->stateGain[i * NU + a][s] = state(a, s);
+						this->referenceGain[i * NU + a][s] = reference(a, s);
+					}
+					this->lower[i * NU + a] = lower[a];
+					this->upper[i * NU + a] = upper[a];
+				}
+			}
+			for (int i = 0; i < NV; i++)
+				trace += this->inverse[i][i];
+
+			// ADMM step of the order of the curvature, then (H + rho I)^-1 in place (Gauss-Jordan, no pivoting needed for a positive definite matrix)
+			this->rho = trace / NV;
+			for (int i = 0; i < NV; i++)
+				this->inverse[i][i] += this->rho;
+			for (int p = 0; p < NV; p++)
+			{
+				double pivot = 1.0 / this->inverse[p][p];
+				this->inverse[p][p] = 1.0;
+				for (int j = 0; j < NV; j++)
+					this->inverse[p][j] *= pivot;
+				for (int i = 0; i < NV; i++)
+				{
+					if ((i == p) || (this->inverse[i][p] == 0.0)) continue;
+					double factor = this->inverse[i][p];
+					this->inverse[i][p] = 0.0;
+					for (int j = 0; j < NV; j++)
+						this->inverse[i][j] -= factor * this->inverse[p][j];
+				}
+			}
+			this->ready = true;
+			LinearMpc::reset();
+		}
+
+		// Forgets the previous solution, the next solve starts from zero inputs
+		void reset()
+		{
+			for (int i = 0; i < NV; i++)
+				this->z[i] = this->y[i] = 0.0;
+			this->iterations = 0;
+			this->residual = 0.0;
+			this->converged = false;
+		}
+
+		/*
+		@current state
+		@reference state
+		@first input of the solution out
+		@max number of iterations
+		@tolerance on the primal residual and on the change of the solution, in input units
+		@time budget in ms, iterations stop when it is spent
+		Solves the QP and shifts the solution to warm start the next solve, returns false if setup was not called
+		*/
+		bool solve(const cv::Vec<double, NX>& x0, const cv::Vec<double, NX>& r, cv::Vec<double, NU>& u0,
+			int maxIterations, double tolerance, double budget)
+		{
+			if (!this->ready) return false;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+			for (int i = 0; i < NV; i++)
+			{
+				this->q[i] = 0.0;
+				for (int s = 0; s < NX; s++)
+					this->q[i] += this->stateGain[i][s] * x0[s] - this->referenceGain[i][s] * r[s];
+			}
+
+			this->iterations = 0;
+			this->converged = false;
+			while (this->iterations < maxIterations)
+			{
+				// u = (H + rho I)^-1 (rho (z - y) - q)
+				for (int i = 0; i < NV; i++)
+					this->w[i] = this->rho * (this->z[i] - this->y[i]) - this->q[i];
+				double primal = 0.0, change = 0.0;
+				for (int i = 0; i < NV; i++)
+				{
+					double u = 0.0;
+					for (int j = 0; j < NV; j++)
+						u += this->inverse[i][j] * this->w[j];
+					// z = clamp(u + y), y += u - z
+					double zNew = std::max(this->lower[i], std::min(this->upper[i], u + this->y[i]));
+					change = std::max(change, std::fabs(zNew - this->z[i]));
+					primal = std::max(primal, std::fabs(u - zNew));
+					this->y[i] += u - zNew;
+					this->z[i] = zNew;
+				}
+				this->iterations++;
+				this->residual = primal;
+				if ((primal < tolerance) && (change < tolerance))
+				{
+					this->converged = true;
+					break;
+				}
+				if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budget) break;
+			}
+
+			for (int a = 0; a < NU; a++)
+				u0[a] = this->z[a];
+			// Warm start: the solution from the next step on, last input repeated
+			for (int i = 0; i < NV - NU; i++)
+			{
+				this->z[i] = this->z[i + NU];
+				this->y[i] = this->y[i + NU];
+			}
+			return true;
+		}
+		int getIterations() { return this->iterations; } // Returns number of iterations of the last solve
+		double getResidual() { return this->residual; } // Returns primal residual of the last solve
+		bool isConverged() { return this->converged; } // Returns false if the last solve stopped on the iteration or time limit
+
+	private:
+		double inverse[NV][NV]; // (H + rho I)^-1
+		double stateGain[NV][NX]; // linear term per unit of current state
+		double referenceGain[NV][NX]; // linear term per unit of reference
+		double lower[NV], upper[NV]; // bounds of the inputs over the horizon
+		double rho; // ADMM step
+		bool ready; // true once setup has been called
+
+		// Solver state, kept between solves for the warm start
+		double z[NV]; // inputs within bounds
+		double y[NV]; // scaled dual variables
+		double q[NV], w[NV]; // linear term and right-hand side of the current solve
+		int iterations; // iterations of the last solve
+		double residual; // primal residual of the last solve
+		bool converged; // true if the last solve reached the tolerance
+};
+
+#endif // LINEARMPC_H
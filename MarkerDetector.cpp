@@ -0,0 +1,350 @@
+#include "stdafx.h"
+#include "MarkerDetector.h"
+
+// Marker detector
+MarkerDetector::MarkerDetector(int target, float delay, parameter tracking, int scale)
+{
+	this->dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::PREDEFINED_DICTIONARY_NAME::DICT_4X4_100);
+	this->parameters = cv::aruco::DetectorParameters::create();
+	this->targetId = target;
+	this->fallbackDelay = delay;
+	this->tracking = tracking;
+	this->pool = nullptr;
+	this->tiling = parameter::on;
+	this->scaleSteps = 0;
+	this->roiPadding = ROI_PADDING;
+	this->refinement = parameter::on;
+	MarkerDetector::setScale(scale);
+
+	this->misses = 0;
+	this->lastSeen = std::chrono::steady_clock::now();
+	this->lastMode = detectionMode::fullframe;
+	MarkerDetector::resetTimings();
+}
+bool MarkerDetector::detect(const cv::Mat& frame, vector<vector<cv::Point2f>>& corners, vector<int>& ids, vector<vector<cv::Point2f>>& rejected)
+{
+	// New resolution (webcam changed), previous corners and timings are not relevant anymore
+	if (frame.size() != this->frameSize)
+	{
+		this->frameSize = frame.size();
+		this->lastCorners.clear();
+		MarkerDetector::resetTimings();
+	}
+
+	// Search the full frame if tracking is off, if the target has not been seen yet,
+	// or if it has been missing for too long
+	float lostFor = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - this->lastSeen).count();
+	bool searchFullFrame = (this->tracking == parameter::off) || this->lastCorners.empty()
+		|| (this->misses >= ROI_MAX_MISSES) || (lostFor >= this->fallbackDelay);
+
+	cv::Rect roi(0, 0, frame.cols, frame.rows);
+	if (!searchFullFrame)
+	{
+		roi = MarkerDetector::predictRoi(frame.size());
+		// Target predicted outside of the frame
+		if (roi.area() <= 0)
+		{
+			searchFullFrame = true;
+			roi = cv::Rect(0, 0, frame.cols, frame.rows);
+		}
+	}
+	this->lastMode = (searchFullFrame) ? detectionMode::fullframe : detectionMode::tracking;
+	this->lastRoi = roi;
+
+	// While tracking, don't downscale the marker below what the detector can decode
+	int searchScale = std::min(4, this->scale << this->scaleSteps);
+	if (!searchFullFrame)
+	{
+		float side = static_cast<float>(cv::norm(this->lastCorners.at(1) - this->lastCorners.at(0)));
+		while ((searchScale > 1) && (side / searchScale < PYRAMID_MIN_MARKER_SIZE))
+			searchScale /= 2;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (searchFullFrame)
+		MarkerDetector::detectScaled(frame, searchScale, corners, ids, rejected);
+	else
+	{
+		// frame(roi) is a header on the same data, no copy
+		MarkerDetector::detectScaled(frame(roi), searchScale, corners, ids, rejected);
+		// Back to full-frame coordinates
+		cv::Point2f offset(static_cast<float>(roi.x), static_cast<float>(roi.y));
+		for (size_t i = 0; i < corners.size(); i++)
+			for (size_t j = 0; j < corners.at(i).size(); j++)
+				corners.at(i).at(j) += offset;
+		for (size_t i = 0; i < rejected.size(); i++)
+			for (size_t j = 0; j < rejected.at(i).size(); j++)
+				rejected.at(i).at(j) += offset;
+	}
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// Update timing statistics of the mode used
+	int m = static_cast<int>(this->lastMode);
+	this->lastTime[m] = elapsed;
+	this->totalTime[m] += elapsed;
+	if (elapsed > this->maxTime[m]) this->maxTime[m] = elapsed;
+	this->detections[m]++;
+
+	// Update prediction
+	for (size_t i = 0; i < ids.size(); i++)
+	{
+		if (ids.at(i) == this->targetId)
+		{
+			// After a full-frame search the old corners may be far away, start again with zero velocity
+			this->previousCorners = (searchFullFrame || this->lastCorners.empty()) ? corners.at(i) : this->lastCorners;
+			this->lastCorners = corners.at(i);
+			this->misses = 0;
+			this->lastSeen = std::chrono::steady_clock::now();
+			return true;
+		}
+	}
+	this->misses++;
+	return false;
+}
+void MarkerDetector::printDetectionState()
+{
+	cout << "Detection:" << endl;
+	cout << "\t- ROI tracking: " << ((this->tracking == parameter::on) ? "ON" : "OFF") << endl;
+	cout << "\t- Detection scale: 1/" << this->scale;
+	if ((this->scale << this->scaleSteps) > this->scale)
+		cout << " (1/" << std::min(4, this->scale << this->scaleSteps) << " under load)";
+	cout << ", corner refinement " << ((this->refinement == parameter::on) ? "ON" : "OFF") << ", ROI padding " << this->roiPadding << endl;
+	cout << "\t- Tiling: " << ((this->tiling == parameter::on) ? "ON" : "OFF") << ", "
+		<< ((this->pool == nullptr) ? 1 : this->pool->getThreads()) << " threads, " << this->tiles.size() << " tiles last frame, "
+		<< this->tileFallbacks << " whole-image searches" << endl;
+	cout << "\t- Resolution: " << this->frameSize.width << "x" << this->frameSize.height << endl;
+	for (int m = 0; m < 2; m++)
+	{
+		cout << "\t- " << ((m == detectionMode::fullframe) ? "Full frame: " : "Tracking:   ");
+		if (this->detections[m] == 0)
+			cout << "no detection yet" << endl;
+		else
+			cout << this->detections[m] << " frames, last " << this->lastTime[m] << " ms, mean "
+				<< this->totalTime[m] / this->detections[m] << " ms, max " << this->maxTime[m] << " ms" << endl;
+	}
+}
+void MarkerDetector::setScale(int scale)
+{
+	// Only power of two pyramid levels are supported
+	if (scale >= 4) this->scale = 4;
+	else if (scale >= 2) this->scale = 2;
+	else this->scale = 1;
+	MarkerDetector::resetTimings();
+}
+void MarkerDetector::resetTimings()
+{
+	for (int m = 0; m < 2; m++)
+	{
+		this->lastTime[m] = 0;
+		this->totalTime[m] = 0;
+		this->maxTime[m] = 0;
+		this->detections[m] = 0;
+	}
+	this->tileFallbacks = 0;
+}
+cv::Rect MarkerDetector::predictRoi(cv::Size size)
+{
+	// Constant velocity prediction of the corners, for each frame since the last detection
+	float steps = static_cast<float>(this->misses + 1);
+	cv::Point2f first = this->lastCorners.at(0) + (this->lastCorners.at(0) - this->previousCorners.at(0)) * steps;
+	float minX = first.x, maxX = first.x, minY = first.y, maxY = first.y;
+	for (size_t i = 1; i < this->lastCorners.size(); i++)
+	{
+		cv::Point2f p = this->lastCorners.at(i) + (this->lastCorners.at(i) - this->previousCorners.at(i)) * steps;
+		minX = std::min(minX, p.x);
+		maxX = std::max(maxX, p.x);
+		minY = std::min(minY, p.y);
+		maxY = std::max(maxY, p.y);
+	}
+
+	// Pad the box, the search region grows for every missed frame
+	float pad = this->roiPadding * std::max(maxX - minX, maxY - minY) * steps;
+	cv::Rect roi(static_cast<int>(std::floor(minX - pad)), static_cast<int>(std::floor(minY - pad)),
+		static_cast<int>(std::ceil(maxX - minX + 2 * pad)), static_cast<int>(std::ceil(maxY - minY + 2 * pad)));
+	return roi & cv::Rect(0, 0, size.width, size.height);
+}
+void MarkerDetector::detectScaled(const cv::Mat& image, int scale, vector<vector<cv::Point2f>>& corners, vector<int>& ids, vector<vector<cv::Point2f>>& rejected)
+{
+	if (scale <= 1)
+	{
+		MarkerDetector::detectTiled(image, 1, corners, ids, rejected);
+		return;
+	}
+
+	// Find candidate quads on the downscaled image
+	cv::resize(image, this->small, cv::Size(image.cols / scale, image.rows / scale), 0, 0, cv::INTER_AREA);
+	MarkerDetector::detectTiled(this->small, scale, corners, ids, rejected);
+
+	// Back to full-resolution coordinates (pixel centers)
+	float s = static_cast<float>(scale);
+	cv::Point2f center(0.5f, 0.5f);
+	for (size_t i = 0; i < corners.size(); i++)
+		for (size_t j = 0; j < corners.at(i).size(); j++)
+			corners.at(i).at(j) = (corners.at(i).at(j) + center) * s - center;
+	for (size_t i = 0; i < rejected.size(); i++)
+		for (size_t j = 0; j < rejected.at(i).size(); j++)
+			rejected.at(i).at(j) = (rejected.at(i).at(j) + center) * s - center;
+	// Corners left to +-scale/2 pixels
+	if (this->refinement == parameter::off) return;
+
+	// Refine only the corners of the decoded markers, on a grayscale patch of the full-resolution image
+	// The corners are known to +-scale/2 pixels, the search window has to cover that
+	int window = scale + 2;
+	cv::Rect bounds(0, 0, image.cols, image.rows);
+	for (size_t i = 0; i < corners.size(); i++)
+	{
+		vector<cv::Point2f>& quad = corners.at(i);
+		float minX = quad.at(0).x, maxX = quad.at(0).x, minY = quad.at(0).y, maxY = quad.at(0).y;
+		for (size_t j = 1; j < quad.size(); j++)
+		{
+			minX = std::min(minX, quad.at(j).x);
+			maxX = std::max(maxX, quad.at(j).x);
+			minY = std::min(minY, quad.at(j).y);
+			maxY = std::max(maxY, quad.at(j).y);
+		}
+		int margin = 2 * window + 2;
+		cv::Rect patch(static_cast<int>(minX) - margin, static_cast<int>(minY) - margin,
+			static_cast<int>(maxX - minX) + 2 * margin, static_cast<int>(maxY - minY) + 2 * margin);
+		patch &= bounds;
+		if (patch.area() <= 0) continue;
+
+		if (image.channels() == 1) image(patch).copyTo(this->gray);
+		else cv::cvtColor(image(patch), this->gray, cv::COLOR_BGR2GRAY);
+
+		cv::Point2f offset(static_cast<float>(patch.x), static_cast<float>(patch.y));
+		for (size_t j = 0; j < quad.size(); j++)
+			quad.at(j) -= offset;
+		cv::cornerSubPix(this->gray, quad, cv::Size(window, window), cv::Size(-1, -1),
+			cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01));
+		for (size_t j = 0; j < quad.size(); j++)
+			quad.at(j) += offset;
+	}
+}
+void MarkerDetector::detectTiled(const cv::Mat& image, int scale, vector<vector<cv::Point2f>>& corners, vector<int>& ids, vector<vector<cv::Point2f>>& rejected)
+{
+	this->tiles.clear();
+	int threads = (this->pool == nullptr) ? 1 : static_cast<int>(this->pool->getThreads());
+	if ((this->tiling == parameter::off) || (threads <= 1) || (image.total() < TILE_MIN_AREA))
+	{
+		cv::aruco::detectMarkers(image, this->dictionary, corners, ids, this->parameters, rejected);
+		return;
+	}
+
+	// A marker is only found if it lies, with some context for the adaptive threshold, inside one tile
+	float side = TILE_MARKER_SIZE * std::min(image.cols, image.rows);
+	if (!this->lastCorners.empty())
+	{
+		cv::Rect box = cv::boundingRect(this->lastCorners);
+		side = std::max(side, std::max(box.width, box.height) / static_cast<float>(scale));
+	}
+	int overlap = static_cast<int>(1.5f * side) + 2 * this->parameters->adaptiveThreshWinSizeMax;
+
+	// Grid of roughly square tiles, one task per tile
+	int count = threads * TILES_PER_THREAD;
+	int rows = std::max(1, static_cast<int>(std::lround(std::sqrt(count * image.rows / static_cast<double>(image.cols)))));
+	int cols = std::max(1, (count + rows - 1) / rows);
+	int tileWidth = (image.cols + cols - 1) / cols, tileHeight = (image.rows + rows - 1) / rows;
+	cv::Rect bounds(0, 0, image.cols, image.rows);
+	for (int r = 0; r < rows; r++)
+		for (int c = 0; c < cols; c++)
+			this->tiles.push_back(cv::Rect(c * tileWidth - overlap / 2, r * tileHeight - overlap / 2,
+				tileWidth + overlap, tileHeight + overlap) & bounds);
+
+	// Perimeter limits are relative to the largest image side, keep them relative to the whole image
+	size_t n = this->tiles.size();
+	if (this->tileParameters.size() != n)
+	{
+		this->tileParameters.resize(n);
+		for (size_t t = 0; t < n; t++)
+			if (!this->tileParameters.at(t)) this->tileParameters.at(t) = cv::aruco::DetectorParameters::create();
+	}
+	this->tileCorners.resize(n);
+	this->tileIds.resize(n);
+	this->tileRejected.resize(n);
+	for (size_t t = 0; t < n; t++)
+	{
+		*this->tileParameters.at(t) = *this->parameters;
+		double ratio = std::max(image.cols, image.rows) / static_cast<double>(std::max(this->tiles.at(t).width, this->tiles.at(t).height));
+		this->tileParameters.at(t)->minMarkerPerimeterRate *= ratio;
+		this->tileParameters.at(t)->maxMarkerPerimeterRate *= ratio;
+	}
+
+	this->pool->parallelFor(static_cast<int>(n), [this, &image](int t)
+	{
+		const cv::Rect& tile = this->tiles.at(t);
+		cv::aruco::detectMarkers(image(tile), this->dictionary, this->tileCorners.at(t), this->tileIds.at(t),
+			this->tileParameters.at(t), this->tileRejected.at(t));
+		cv::Point2f offset(static_cast<float>(tile.x), static_cast<float>(tile.y));
+		for (size_t i = 0; i < this->tileCorners.at(t).size(); i++)
+			for (size_t j = 0; j < this->tileCorners.at(t).at(i).size(); j++)
+				this->tileCorners.at(t).at(i).at(j) += offset;
+		for (size_t i = 0; i < this->tileRejected.at(t).size(); i++)
+			for (size_t j = 0; j < this->tileRejected.at(t).at(i).size(); j++)
+				this->tileRejected.at(t).at(i).at(j) += offset;
+	});
+
+	// Merge, a quad found in several tiles is kept from the tile where it is the farthest from the edges
+	corners.clear();
+	ids.clear();
+	rejected.clear();
+	vector<float> margins, rejectedMargins;
+	for (size_t t = 0; t < n; t++)
+	{
+		const cv::Rect& tile = this->tiles.at(t);
+		for (int list = 0; list < 2; list++)
+		{
+			vector<vector<cv::Point2f>>& found = (list == 0) ? this->tileCorners.at(t) : this->tileRejected.at(t);
+			vector<vector<cv::Point2f>>& merged = (list == 0) ? corners : rejected;
+			vector<float>& mergedMargins = (list == 0) ? margins : rejectedMargins;
+			for (size_t i = 0; i < found.size(); i++)
+			{
+				// Distance to the seams only, the image border is the same as on the whole image
+				cv::Point2f center(0, 0);
+				float margin = static_cast<float>(std::max(image.cols, image.rows));
+				for (size_t j = 0; j < found.at(i).size(); j++)
+				{
+					const cv::Point2f& p = found.at(i).at(j);
+					center += p * (1.0 / found.at(i).size());
+					if (tile.x > 0) margin = std::min(margin, p.x - tile.x);
+					if (tile.x + tile.width < image.cols) margin = std::min(margin, tile.x + tile.width - p.x);
+					if (tile.y > 0) margin = std::min(margin, p.y - tile.y);
+					if (tile.y + tile.height < image.rows) margin = std::min(margin, tile.y + tile.height - p.y);
+				}
+
+				// Same quad already merged from a neighbouring tile
+				size_t k = 0;
+				for (; k < merged.size(); k++)
+				{
+					if ((list == 0) && (ids.at(k) != this->tileIds.at(t).at(i))) continue;
+					cv::Point2f other(0, 0);
+					for (size_t j = 0; j < merged.at(k).size(); j++)
+						other += merged.at(k).at(j) * (1.0 / merged.at(k).size());
+					if (cv::norm(other - center) < 0.25 * cv::norm(found.at(i).at(0) - found.at(i).at(2))) break;
+				}
+				if (k == merged.size())
+				{
+					merged.push_back(found.at(i));
+					mergedMargins.push_back(margin);
+					if (list == 0) ids.push_back(this->tileIds.at(t).at(i));
+				}
+				else if (margin > mergedMargins.at(k))
+				{
+					merged.at(k) = found.at(i);
+					mergedMargins.at(k) = margin;
+				}
+			}
+		}
+	}
+
+	// A marker larger than the overlap fits in no tile and is either missing or cut at a seam,
+	// the whole image is searched again so that a close marker can still be acquired
+	bool fallback = (std::find(ids.begin(), ids.end(), this->targetId) == ids.end());
+	float seam = static_cast<float>(this->parameters->adaptiveThreshWinSizeMax);
+	for (size_t i = 0; (i < margins.size()) && !fallback; i++)
+		fallback = (margins.at(i) < seam);
+	for (size_t i = 0; (i < rejectedMargins.size()) && !fallback; i++)
+		fallback = (rejectedMargins.at(i) < seam);
+	if (!fallback) return;
+	this->tileFallbacks++;
+	cv::aruco::detectMarkers(image, this->dictionary, corners, ids, this->parameters, rejected);
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#ifndef MARKERDETECTOR_H
+#define MARKERDETECTOR_H
+
+#include "VideoParameters.h"
+#include "ThreadPool.h"
+
+#define ROI_PADDING 0.5f // padding added on each side of the predicted marker box, relative to the box size
+#define ROI_MAX_MISSES 5 // number of missed frames in tracking mode before searching the full frame again
+#define PYRAMID_MIN_MARKER_SIZE 32.f // smallest side in pixels a tracked marker may have in the downscaled image
+#define PYRAMID_TRANSLATION_TOLERANCE 0.15f // p95 of the position difference with the full-resolution pose, relative to the distance
+#define PYRAMID_ROTATION_TOLERANCE 50.f // deg, p95 of the rotation difference with the full-resolution pose
+#define TILE_MIN_AREA 150000 // images searched with fewer pixels are not split into tiles
+#define TILES_PER_THREAD 1 // tiles per thread of the pool, each seam adds overlap to search
+#define TILE_MARKER_SIZE 0.15f // side of the largest expected marker relative to the shorter image side, when no marker has been seen yet
+
+// Enumeration to store the detection modes
+enum detectionMode
+{
+	fullframe = 0,
+	tracking = 1
+};
+
+/*
+Class to detect ArUco markers in a frame
+In tracking mode, the detection only runs inside a padded region of interest around the predicted
+position of the target marker, and falls back to a full-frame search when the target is lost
+With a detection scale above 1, quads are found on a downscaled image and only their corners are
+refined on the full-resolution frame. The pose error and detection rate of each scale are measured
+by 'bench scenes' on rendered scenes with known poses, small markers are the first lost at 1/4.
+Searched at 1/2 or 1/4 on every frame, the pose is held to PYRAMID_TRANSLATION_TOLERANCE and
+PYRAMID_ROTATION_TOLERANCE of the full-resolution one (p95 measured at 1/2 and 1/4: 12 % and 8 % of the
+distance, 38 and 44 deg, largest on markers under 40 px). Tracking keeps those at full resolution
+Large images are split into overlapping tiles searched in parallel on a thread pool. Tiles overlap by
+1.5 side of the last target (TILE_MARKER_SIZE before the first one) plus two threshold windows, so a marker
+up to that size lies far enough inside one tile to be found with the same corners as on the whole image.
+A larger marker across a seam fits in no tile: when the target is missing from the tiles, or a quad
+lies within a threshold window of a seam, the whole image is searched again
+*/
+class MarkerDetector
+{
+	public:
+		/*
+		@ID of the marker to track
+		@delay in ms without target before the full frame is searched again
+		@default tracking parameter
+		@default detection scale (1, 2 or 4)
+		Constructor of the class
+		*/
+		MarkerDetector(int, float, parameter, int);
+
+		/*
+		@frame to search
+		@corners of the detected markers, in full-frame coordinates
+		@IDs of the detected markers
+		@rejected candidates, in full-frame coordinates
+		Detects markers, returns true if the target marker was found
+		*/
+		bool detect(const cv::Mat&, vector<vector<cv::Point2f>>&, vector<int>&, vector<vector<cv::Point2f>>&);
+		parameter getTracking() { return this->tracking; } // Returns tracking parameter
+
+		/*
+		@enum value to set tracking to
+		Turns the ROI tracking on or off
+		*/
+		void setTracking(parameter tracking) { this->tracking = tracking; }
+		int getScale() { return this->scale; } // Returns detection scale
+
+		/*
+		@detection scale, 1 for full resolution, 2 or 4
+		Sets the downscaling factor of the image searched for quads
+		*/
+		void setScale(int);
+
+		/*
+		@halvings of the resolution on top of the detection scale, up to 1/4
+		Lowers the resolution of the search without changing the detection scale, used by FrameGovernor
+		*/
+		void setScaleSteps(int steps) { this->scaleSteps = std::max(0, steps); }
+
+		/*
+		@padding on each side of the predicted marker box, relative to the box size
+		Sets the size of the tracking region
+		*/
+		void setRoiPadding(float padding) { this->roiPadding = padding; }
+
+		/*
+		@enum value to set refinement to
+		Turns on or off the subpixel refinement of the corners found on a downscaled image
+		*/
+		void setRefinement(parameter refinement) { this->refinement = refinement; }
+
+		/*
+		@thread pool used to search tiles, nullptr to search on the calling thread only
+		Sets the thread pool, which is not owned by the detector
+		*/
+		void setThreadPool(ThreadPool* pool) { this->pool = pool; }
+		parameter getTiling() { return this->tiling; } // Returns tiling parameter
+		unsigned long long getTileFallbacks() { return this->tileFallbacks; } // Returns tiled searches done again on the whole image
+
+		/*
+		@enum value to set tiling to
+		Turns the tile-parallel search on or off
+		*/
+		void setTiling(parameter tiling) { this->tiling = tiling; MarkerDetector::resetTimings(); }
+		detectionMode getLastMode() { return this->lastMode; } // Returns mode used for the last detection
+		cv::Rect getLastRoi() { return this->lastRoi; } // Returns region searched during the last detection
+		void printDetectionState(); // Prints detection mode and timing per mode
+		void resetTimings(); // Resets timing statistics
+
+	private:
+		/*
+		@size of the frame
+		Returns the padded region where the target is expected in the next frame
+		*/
+		cv::Rect predictRoi(cv::Size);
+
+		/*
+		@region of the frame to search
+		@scale to search the region at
+		@corners out
+		@ids out
+		@rejected out
+		Detects markers in the downscaled region and refines their corners at full resolution
+		Returned coordinates are relative to the region
+		*/
+		void detectScaled(const cv::Mat&, int, vector<vector<cv::Point2f>>&, vector<int>&, vector<vector<cv::Point2f>>&);
+
+		/*
+		@image to search
+		@scale of the image compared to the frame
+		@corners out
+		@ids out
+		@rejected out
+		Detects markers in overlapping tiles on the thread pool and merges the results, same output
+		as cv::aruco::detectMarkers on the whole image, which it falls back to when the tiles may have cut a marker
+		*/
+		void detectTiled(const cv::Mat&, int, vector<vector<cv::Point2f>>&, vector<int>&, vector<vector<cv::Point2f>>&);
+
+		cv::Ptr<cv::aruco::Dictionary> dictionary; // ArUco dictionary
+		cv::Ptr<cv::aruco::DetectorParameters> parameters; // ArUco detector parameters
+		int targetId; // ID of the marker to track
+		float fallbackDelay; // ms without target before searching the full frame
+		parameter tracking; // ROI tracking on/off
+		int scale; // downscaling factor of the image searched for quads
+		int scaleSteps; // halvings of the resolution on top of scale
+		float roiPadding; // padding of the tracking region, ROI_PADDING by default
+		parameter refinement; // subpixel refinement of downscaled corners on/off
+		cv::Mat small; // downscaled search image, reused between frames
+		cv::Mat gray; // grayscale patch around a marker for corner refinement
+
+		// Tile-parallel search
+		ThreadPool* pool; // threads searching the tiles, not owned
+		parameter tiling; // tile-parallel search on/off
+		vector<cv::Rect> tiles; // tiles of the last search
+		vector<cv::Ptr<cv::aruco::DetectorParameters>> tileParameters; // detector parameters per tile
+		vector<vector<vector<cv::Point2f>>> tileCorners, tileRejected; // results per tile, in image coordinates
+		vector<vector<int>> tileIds;
+		unsigned long long tileFallbacks; // tiled searches done again on the whole image
+
+		vector<cv::Point2f> lastCorners, previousCorners; // corners of the target in the last two detections
+		int misses; // frames without target since last detection
+		std::chrono::steady_clock::time_point lastSeen; // time of the last detection of the target
+		detectionMode lastMode; // mode used for the last detection
+		cv::Rect lastRoi; // region searched during the last detection
+
+		// Timing statistics per detection mode, in ms
+		cv::Size frameSize; // resolution the statistics were measured at
+		double lastTime[2], totalTime[2], maxTime[2];
+		unsigned long long detections[2];
+};
+
+#endif // MARKERDETECTOR_H
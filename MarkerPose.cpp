@@ -0,0 +1,343 @@
+#include "stdafx.h"
+#include "MarkerPose.h"
+
+std::mutex MarkerPose::gridMu;
+vector<std::weak_ptr<const UndistortGrid>> MarkerPose::grids;
+
+// Marker pose
+MarkerPose::MarkerPose(float markerLength)
+{
+	this->halfLength = markerLength / 2.0;
+	// Same corner order as cv::aruco::estimatePoseSingleMarkers, z pointing out of the marker
+	this->model[0] = cv::Vec3d(-this->halfLength, this->halfLength, 0);
+	this->model[1] = cv::Vec3d(this->halfLength, this->halfLength, 0);
+	this->model[2] = cv::Vec3d(this->halfLength, -this->halfLength, 0);
+	this->model[3] = cv::Vec3d(-this->halfLength, -this->halfLength, 0);
+
+	// Ideal camera until calibration is given
+	this->fx = this->fy = 1.0;
+	this->cx = this->cy = 0.0;
+	for (size_t i = 0; i < MAX_DISTORTION_COEFF; i++)
+		this->k[i] = 0.0;
+	this->distorted = false;
+	this->cacheValid = false;
+}
+void MarkerPose::setCalibration(const cv::Mat& cameraMatrix, const cv::Mat& distanceCoeff)
+{
+	if (cameraMatrix.empty()) return;
+
+	this->fx = cameraMatrix.at<double>(0, 0);
+	this->fy = cameraMatrix.at<double>(1, 1);
+	this->cx = cameraMatrix.at<double>(0, 2);
+	this->cy = cameraMatrix.at<double>(1, 2);
+
+	this->distorted = false;
+	for (size_t i = 0; i < MAX_DISTORTION_COEFF; i++)
+	{
+		this->k[i] = (i < distanceCoeff.total()) ? distanceCoeff.at<double>(static_cast<int>(i)) : 0.0;
+		if (this->k[i] != 0.0) this->distorted = true;
+	}
+	this->cacheValid = false;
+	MarkerPose::buildGrid();
+}
+void MarkerPose::setImageSize(cv::Size size)
+{
+	if (size == this->imageSize) return;
+	this->imageSize = size;
+	MarkerPose::buildGrid();
+}
+void MarkerPose::buildGrid()
+{
+	this->grid.reset();
+	if (!this->distorted || (this->imageSize.area() <= 0)) return;
+
+	// Grid of another solver with the same calibration and size, the grids no solver uses anymore are forgotten
+	std::lock_guard<std::mutex> lock(MarkerPose::gridMu);
+	for (size_t i = 0; i < MarkerPose::grids.size();)
+	{
+		std::shared_ptr<const UndistortGrid> shared = MarkerPose::grids.at(i).lock();
+		if (!shared)
+		{
+			MarkerPose::grids.erase(MarkerPose::grids.begin() + i);
+			continue;
+		}
+		if (MarkerPose::isGridOf(*shared))
+		{
+			this->grid = shared;
+			return;
+		}
+		i++;
+	}
+
+	std::shared_ptr<UndistortGrid> built = std::make_shared<UndistortGrid>();
+	built->fx = this->fx;
+	built->fy = this->fy;
+	built->cx = this->cx;
+	built->cy = this->cy;
+	for (size_t i = 0; i < MAX_DISTORTION_COEFF; i++)
+		built->k[i] = this->k[i];
+	built->imageSize = this->imageSize;
+	// One node of margin on each side, the last one at or past the far edge
+	built->cols = (this->imageSize.width - 1) / UNDISTORT_GRID_STEP + 3;
+	built->rows = (this->imageSize.height - 1) / UNDISTORT_GRID_STEP + 3;
+	built->nodes.resize(static_cast<size_t>(built->cols) * built->rows);
+	for (int r = 0; r < built->rows; r++)
+	{
+		double y0 = ((r - 1) * UNDISTORT_GRID_STEP - this->cy) / this->fy;
+		// Each node starts from its left neighbour, the first of a row from the node above
+		double x = 0.0, y = y0;
+		if (r > 0)
+		{
+			x = built->nodes.at((r - 1) * built->cols)[0];
+			y = built->nodes.at((r - 1) * built->cols)[1];
+		}
+		for (int c = 0; c < built->cols; c++)
+		{
+			double x0 = ((c - 1) * UNDISTORT_GRID_STEP - this->cx) / this->fx;
+			if ((r == 0) && (c == 0)) x = x0;
+			MarkerPose::iterateUndistortion(x0, y0, x, y);
+			built->nodes.at(r * built->cols + c) = cv::Vec2f(static_cast<float>(x), static_cast<float>(y));
+		}
+	}
+	this->grid = built;
+	MarkerPose::grids.push_back(this->grid);
+}
+bool MarkerPose::isGridOf(const UndistortGrid& grid)
+{
+	if ((grid.imageSize != this->imageSize) || (grid.fx != this->fx) || (grid.fy != this->fy) || (grid.cx != this->cx) || (grid.cy != this->cy))
+		return false;
+	for (size_t i = 0; i < MAX_DISTORTION_COEFF; i++)
+		if (grid.k[i] != this->k[i]) return false;
+	return true;
+}
+void MarkerPose::undistortPoints(const cv::Point2f* points, cv::Vec2d* undistorted, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		if (MarkerPose::lookupUndistortion(points[i], undistorted[i])) continue;
+		double x0 = (points[i].x - this->cx) / this->fx;
+		double y0 = (points[i].y - this->cy) / this->fy;
+		double x = x0, y = y0;
+		if (this->distorted) MarkerPose::iterateUndistortion(x0, y0, x, y);
+		undistorted[i] = cv::Vec2d(x, y);
+	}
+}
+bool MarkerPose::lookupUndistortion(const cv::Point2f& point, cv::Vec2d& undistorted)
+{
+	const UndistortGrid* grid = this->grid.get();
+	if (grid == nullptr) return false;
+	double gx = point.x / static_cast<double>(UNDISTORT_GRID_STEP) + 1.0;
+	double gy = point.y / static_cast<double>(UNDISTORT_GRID_STEP) + 1.0;
+	// NaN fails both tests
+	if (!((gx >= 0.0) && (gy >= 0.0))) return false;
+	int c = static_cast<int>(gx), r = static_cast<int>(gy);
+	if ((c >= grid->cols - 1) || (r >= grid->rows - 1)) return false;
+
+	double fx = gx - c, fy = gy - r;
+	const cv::Vec2f* node = &grid->nodes[r * grid->cols + c];
+	const cv::Vec2f* below = node + grid->cols;
+	for (int a = 0; a < 2; a++)
+	{
+		double top = node[0][a] + fx * (node[1][a] - node[0][a]);
+		double bottom = below[0][a] + fx * (below[1][a] - below[0][a]);
+		undistorted[a] = top + fy * (bottom - top);
+	}
+	return true;
+}
+bool MarkerPose::estimate(const vector<cv::Point2f>& corners, cv::Vec3d& rvec, cv::Vec3d& tvec)
+{
+	if (corners.size() != MARKER_CORNERS) return false;
+
+	cv::Vec2d p[MARKER_CORNERS];
+	MarkerPose::undistortCorners(&corners[0], p);
+
+	// Homography from the unit square (0,0), (1,0), (1,1), (0,1) to the quad (Heckbert, 1989)
+	double dx1 = p[1][0] - p[2][0], dx2 = p[3][0] - p[2][0], dx3 = p[0][0] - p[1][0] + p[2][0] - p[3][0];
+	double dy1 = p[1][1] - p[2][1], dy2 = p[3][1] - p[2][1], dy3 = p[0][1] - p[1][1] + p[2][1] - p[3][1];
+	double den = dx1 * dy2 - dx2 * dy1;
+	if (std::fabs(den) < 1e-12) return false;
+	double g = (dx3 * dy2 - dx2 * dy3) / den;
+	double h = (dx1 * dy3 - dx3 * dy1) / den;
+	cv::Matx33d unitToImage(p[1][0] - p[0][0] + g * p[1][0], p[3][0] - p[0][0] + h * p[3][0], p[0][0],
+		p[1][1] - p[0][1] + g * p[1][1], p[3][1] - p[0][1] + h * p[3][1], p[0][1],
+		g, h, 1.0);
+	// Marker plane to unit square, corner 0 is (-L/2, L/2)
+	double length = 2.0 * this->halfLength;
+	cv::Matx33d modelToUnit(1.0 / length, 0.0, 0.5,
+		0.0, -1.0 / length, 0.5,
+		0.0, 0.0, 1.0);
+	cv::Matx33d H = unitToImage * modelToUnit;
+	H = H * (1.0 / H(2, 2));
+
+	// Image of the marker center and jacobian of the homography there
+	double u0 = H(0, 2), v0 = H(1, 2);
+	double j00 = H(0, 0) - H(2, 0) * u0, j01 = H(0, 1) - H(2, 1) * u0;
+	double j10 = H(1, 0) - H(2, 0) * v0, j11 = H(1, 1) - H(2, 1) * v0;
+
+	// Rotation taking the line of sight of the center to the z axis
+	double norm = std::sqrt(u0 * u0 + v0 * v0 + 1.0);
+	double ax = u0 / norm, ay = v0 / norm, az = 1.0 / norm;
+	double d = 1.0 / (1.0 + az);
+	cv::Matx33d Rv(1.0 - ax * ax * d, -ax * ay * d, ax,
+		-ax * ay * d, 1.0 - ay * ay * d, ay,
+		-ax, -ay, 1.0 - (ax * ax + ay * ay) * d);
+
+	// 2x2 problem in the rotated frame
+	double b00 = Rv(0, 0) - u0 * Rv(2, 0), b01 = Rv(0, 1) - u0 * Rv(2, 1);
+	double b10 = Rv(1, 0) - v0 * Rv(2, 0), b11 = Rv(1, 1) - v0 * Rv(2, 1);
+	double det = b00 * b11 - b01 * b10;
+	if (std::fabs(det) < 1e-12) return false;
+	double a00 = (b11 * j00 - b01 * j10) / det, a01 = (b11 * j01 - b01 * j11) / det;
+	double a10 = (-b10 * j00 + b00 * j10) / det, a11 = (-b10 * j01 + b00 * j11) / det;
+
+	// Largest singular value of A
+	double ata00 = a00 * a00 + a10 * a10;
+	double ata01 = a00 * a01 + a10 * a11;
+	double ata11 = a01 * a01 + a11 * a11;
+	double gamma = std::sqrt(0.5 * (ata00 + ata11 + std::sqrt((ata00 - ata11) * (ata00 - ata11) + 4.0 * ata01 * ata01)));
+	if (gamma < 1e-12) return false;
+
+	// The two rotations only differ by the sign of the out of plane components
+	double r00 = a00 / gamma, r01 = a01 / gamma, r10 = a10 / gamma, r11 = a11 / gamma;
+	double c0 = std::sqrt(std::max(0.0, 1.0 - r00 * r00 - r10 * r10));
+	double c1 = std::sqrt(std::max(0.0, 1.0 - r01 * r01 - r11 * r11));
+	if (-r00 * r01 - r10 * r11 < 0) c1 = -c1;
+
+	cv::Vec3d bestT;
+	cv::Matx33d bestR;
+	double bestError = -1.0;
+	for (int sign = 1; sign >= -1; sign -= 2)
+	{
+		cv::Vec3d col0(r00, r10, sign * c0), col1(r01, r11, sign * c1);
+		cv::Vec3d col2 = col0.cross(col1);
+		cv::Matx33d Rt(col0[0], col1[0], col2[0],
+			col0[1], col1[1], col2[1],
+			col0[2], col1[2], col2[2]);
+		cv::Matx33d R = Rv * Rt;
+
+		cv::Vec3d t;
+		double error = MarkerPose::solveTranslation(R, p, t);
+		if ((bestError < 0) || (error < bestError))
+		{
+			bestError = error;
+			bestR = R;
+			bestT = t;
+		}
+	}
+
+	rvec = MarkerPose::rotationToVector(bestR);
+	tvec = bestT;
+	return true;
+}
+void MarkerPose::undistortCorners(const cv::Point2f* corners, cv::Vec2d* undistorted)
+{
+	for (size_t i = 0; i < MARKER_CORNERS; i++)
+	{
+		// Same corner as last call
+		if (this->cacheValid && (corners[i] == this->cachedCorners[i]))
+		{
+			undistorted[i] = this->cachedUndistorted[i];
+			continue;
+		}
+		if (MarkerPose::lookupUndistortion(corners[i], undistorted[i])) continue;
+
+		double x0 = (corners[i].x - this->cx) / this->fx;
+		double y0 = (corners[i].y - this->cy) / this->fy;
+		double x = x0, y = y0;
+		if (this->distorted)
+		{
+			// Warm start from the last solution, moved by the motion of the corner
+			if (this->cacheValid)
+			{
+				x = this->cachedUndistorted[i][0] + (x0 - (this->cachedCorners[i].x - this->cx) / this->fx);
+				y = this->cachedUndistorted[i][1] + (y0 - (this->cachedCorners[i].y - this->cy) / this->fy);
+			}
+			MarkerPose::iterateUndistortion(x0, y0, x, y);
+		}
+		undistorted[i] = cv::Vec2d(x, y);
+	}
+
+	for (size_t i = 0; i < MARKER_CORNERS; i++)
+	{
+		this->cachedCorners[i] = corners[i];
+		this->cachedUndistorted[i] = undistorted[i];
+	}
+	this->cacheValid = true;
+}
+void MarkerPose::iterateUndistortion(double x0, double y0, double& x, double& y)
+{
+	for (int it = 0; it < UNDISTORT_MAX_ITERATIONS; it++)
+	{
+		double r2 = x * x + y * y;
+		double icdist = (1.0 + ((this->k[7] * r2 + this->k[6]) * r2 + this->k[5]) * r2)
+			/ (1.0 + ((this->k[4] * r2 + this->k[1]) * r2 + this->k[0]) * r2);
+		double deltaX = 2.0 * this->k[2] * x * y + this->k[3] * (r2 + 2.0 * x * x);
+		double deltaY = this->k[2] * (r2 + 2.0 * y * y) + 2.0 * this->k[3] * x * y;
+		double nx = (x0 - deltaX) * icdist;
+		double ny = (y0 - deltaY) * icdist;
+		double change = (nx - x) * (nx - x) + (ny - y) * (ny - y);
+		x = nx;
+		y = ny;
+		if (change < UNDISTORT_EPSILON) break;
+	}
+}
+double MarkerPose::solveTranslation(const cv::Matx33d& R, const cv::Vec2d* p, cv::Vec3d& t)
+{
+	// For each corner: x = u * z and y = v * z give two equations linear in t
+	cv::Matx33d A;
+	cv::Vec3d b;
+	cv::Vec3d rotated[MARKER_CORNERS];
+	for (size_t i = 0; i < MARKER_CORNERS; i++)
+	{
+		rotated[i] = R * this->model[i];
+		double u = p[i][0], v = p[i][1];
+		double e0 = u * rotated[i][2] - rotated[i][0];
+		double e1 = v * rotated[i][2] - rotated[i][1];
+
+		A(0, 0) += 1.0;
+		A(0, 2) -= u;
+		A(1, 1) += 1.0;
+		A(1, 2) -= v;
+		A(2, 2) += u * u + v * v;
+		b[0] += e0;
+		b[1] += e1;
+		b[2] -= u * e0 + v * e1;
+	}
+	A(2, 0) = A(0, 2);
+	A(2, 1) = A(1, 2);
+	t = A.solve(b, cv::DECOMP_LU);
+
+	// Reprojection error in normalized coordinates
+	double error = 0.0;
+	for (size_t i = 0; i < MARKER_CORNERS; i++)
+	{
+		cv::Vec3d X = rotated[i] + t;
+		double du = X[0] / X[2] - p[i][0];
+		double dv = X[1] / X[2] - p[i][1];
+		error += du * du + dv * dv;
+	}
+	return error;
+}
+cv::Vec3d MarkerPose::rotationToVector(const cv::Matx33d& R)
+{
+	double c = std::max(-1.0, std::min(1.0, (R(0, 0) + R(1, 1) + R(2, 2) - 1.0) / 2.0));
+	double theta = std::acos(c);
+	cv::Vec3d w(R(2, 1) - R(1, 2), R(0, 2) - R(2, 0), R(1, 0) - R(0, 1));
+	double s = std::sin(theta);
+
+	// Small angle
+	if (theta < 1e-9)
+		return w * 0.5;
+	// General case
+	if (s > 1e-6)
+		return w * (theta / (2.0 * s));
+	// Angle close to pi: R = 2aa' - I, axis from the largest diagonal element
+	int i = 0;
+	if (R(1, 1) > R(i, i)) i = 1;
+	if (R(2, 2) > R(i, i)) i = 2;
+	cv::Vec3d axis;
+	axis[i] = std::sqrt(std::max(0.0, (R(i, i) + 1.0) / 2.0));
+	for (int j = 0; j < 3; j++)
+		if (j != i) axis[j] = (R(i, j) + R(j, i)) / (4.0 * axis[i]);
+	return axis * theta;
+}
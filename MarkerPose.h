@@ -0,0 +1,139 @@
+#pragma once
+
+#ifndef MARKERPOSE_H
+#define MARKERPOSE_H
+
+#include "stdafx.h"
+
+#define MARKER_CORNERS 4 // number of corners of a square marker
+#define MAX_DISTORTION_COEFF 8 // k1, k2, p1, p2, k3, k4, k5, k6
+#define UNDISTORT_MAX_ITERATIONS 20 // max iterations of the undistortion fixed point
+#define UNDISTORT_EPSILON 1e-12 // squared change (normalized coordinates) at which undistortion has converged
+#define UNDISTORT_GRID_STEP 4 // px between the nodes of the undistortion lookup grid, within 0.01 px of the iterative solution on webcam lenses
+
+// Undistortion lookup grid of a calibration and an image size, node (c, r) at pixel (c - 1, r - 1) * UNDISTORT_GRID_STEP
+struct UndistortGrid
+{
+	double fx, fy, cx, cy; // camera matrix the grid was built for
+	double k[MAX_DISTORTION_COEFF]; // distortion coefficients the grid was built for
+	cv::Size imageSize; // size of the frames the grid was built for
+	int cols, rows; // nodes per row and rows of the grid, one node of margin around the image
+	vector<cv::Vec2f> nodes; // undistorted normalized coordinates per node, row by row
+};
+
+/*
+Class to estimate the pose of a single square marker
+Closed form IPPE solution (Collins & Bartoli, 2014) for a planar square seen by a calibrated camera:
+the two rotations compatible with the homography jacobian at the marker center are computed,
+the translation of each is solved by least squares, and the one with the lowest reprojection error is kept
+Same marker frame as cv::aruco::estimatePoseSingleMarkers, nothing is allocated on the heap
+Once the image size is known, the corners are undistorted through a lookup grid of the undistorted
+normalized coordinates every UNDISTORT_GRID_STEP px of the image, built once per calibration and image
+size and interpolated bilinearly, the pose is then solved with a pinhole model. Corners outside of the
+image fall back to the iterative undistortion
+The grids are shared: a solver given the calibration and image size of another one takes its grid
+instead of building its own, a grid is freed with the last solver using it
+*/
+class MarkerPose
+{
+	public:
+		/*
+		@length of the side of the marker
+		Constructor of the class
+		*/
+		MarkerPose(float);
+
+		/*
+		@camera matrix
+		@distortion coefficients
+		Caches the intrinsics used to undistort the corners
+		*/
+		void setCalibration(const cv::Mat&, const cv::Mat&);
+
+		/*
+		@size of the frames the corners come from
+		Builds the undistortion lookup grid for the size, or takes the one of another solver with the same calibration and size
+		*/
+		void setImageSize(cv::Size);
+
+		/*
+		@points in pixels
+		@points out, undistorted normalized coordinates
+		@number of points
+		Undistorts points through the lookup grid, iteratively outside of it or without image size
+		*/
+		void undistortPoints(const cv::Point2f*, cv::Vec2d*, size_t);
+		size_t getGridSize() { return (this->grid) ? this->grid->nodes.size() : 0; } // Returns number of nodes of the lookup grid, 0 if none
+
+		/*
+		@corners of the marker, in the order given by cv::aruco::detectMarkers
+		@rotation vector out
+		@translation vector out
+		Estimates the pose of the marker, returns false if the corners are degenerate
+		*/
+		bool estimate(const vector<cv::Point2f>&, cv::Vec3d&, cv::Vec3d&);
+
+		/*
+		@rotation matrix
+		Returns the rotation vector (axis * angle) of the matrix
+		*/
+		static cv::Vec3d rotationToVector(const cv::Matx33d&);
+
+	private:
+		/*
+		@corners in pixels
+		@corners out, undistorted normalized coordinates
+		Undistorts the corners through the lookup grid, else iteratively from the last solution as corners move little between frames
+		*/
+		void undistortCorners(const cv::Point2f*, cv::Vec2d*);
+
+		/*
+		@distorted normalized x
+		@distorted normalized y
+		@undistorted normalized x, in: starting point, out: solution
+		@undistorted normalized y, in: starting point, out: solution
+		Same fixed point as cv::undistortPoints, iterated until convergence
+		*/
+		void iterateUndistortion(double, double, double&, double&);
+
+		/*
+		@point in pixels
+		@undistorted normalized coordinates out
+		Interpolates the lookup grid, returns false if there is no grid or the point is outside of it
+		*/
+		bool lookupUndistortion(const cv::Point2f&, cv::Vec2d&);
+		void buildGrid(); // Finds or builds the lookup grid for the calibration and image size, none without distortion
+
+		/*
+		@grid
+		Returns true if the grid was built for the calibration and image size of the solver
+		*/
+		bool isGridOf(const UndistortGrid&);
+
+		/*
+		@rotation matrix
+		@undistorted corners
+		@translation out
+		Returns the reprojection error of the least squares translation for a given rotation
+		*/
+		double solveTranslation(const cv::Matx33d&, const cv::Vec2d*, cv::Vec3d&);
+
+		double halfLength; // half the side of the marker
+		cv::Vec3d model[MARKER_CORNERS]; // corners in the marker frame
+		double fx, fy, cx, cy; // camera matrix
+		double k[MAX_DISTORTION_COEFF]; // distortion coefficients, zero when not given
+		bool distorted; // false if all distortion coefficients are zero
+
+		// Undistortion cache, last pixel corners and their undistorted values
+		cv::Point2f cachedCorners[MARKER_CORNERS];
+		cv::Vec2d cachedUndistorted[MARKER_CORNERS];
+		bool cacheValid;
+
+		cv::Size imageSize; // size of the frames, empty until given
+		std::shared_ptr<const UndistortGrid> grid; // lookup grid, shared with the solvers of the same calibration and size, null if none
+
+		static std::mutex gridMu; // protects the grids
+		static vector<std::weak_ptr<const UndistortGrid>> grids; // grids in use, by any solver
+};
+
+#endif // MARKERPOSE_H
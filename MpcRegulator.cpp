@@ -0,0 +1,109 @@
+#include "stdafx.h"
+#include "MpcRegulator.h"
+
+// MPC regulator
+MpcRegulator::MpcRegulator()
+{
+	// Double integrator per axis: position += rate dt + gain u dt^2 / 2, rate += gain u dt
+	double dt = 1.0 / MPC_RATE;
+	double gain[MPC_INPUTS] = { MPC_THRUST_GAIN, MPC_THRUST_GAIN, MPC_THRUST_GAIN, MPC_YAW_GAIN };
+	cv::Matx<double, MPC_STATES, MPC_STATES> A = cv::Matx<double, MPC_STATES, MPC_STATES>::eye();
+	cv::Matx<double, MPC_STATES, MPC_INPUTS> B;
+	for (int axis = 0; axis < MPC_INPUTS; axis++)
+	{
+		A(axis, MPC_INPUTS + axis) = dt;
+		B(axis, axis) = 0.5 * gain[axis] * dt * dt;
+		B(MPC_INPUTS + axis, axis) = gain[axis] * dt;
+	}
+
+	// Weights: 0.1 m of error costs about as much as 30 units of control
+	cv::Vec<double, MPC_STATES> Q(100.0, 100.0, 100.0, 50.0, 10.0, 10.0, 10.0, 5.0);
+	cv::Vec<double, MPC_INPUTS> R(1e-4, 1e-4, 1e-4, 1e-4);
+	cv::Vec<double, MPC_INPUTS> upper(PID_MAX_TILT, PID_MAX_THRUST, PID_MAX_TILT, PID_MAX_TILT);
+	this->mpc.setup(A, B, Q, R, -upper, upper);
+
+	this->solves = this->totalIterations = this->unconverged = this->totalTime = 0;
+	this->started = false;
+	this->restart = false;
+}
+bool MpcRegulator::update(const cv::Vec3d& tvec, const cv::Vec3d& rvec, const cv::Vec3d& setpoint, std::chrono::steady_clock::time_point timestamp,
+	int& throttle, int& roll, int& pitch, int& yaw)
+{
+	double measured[MPC_INPUTS] = { tvec[0], tvec[1], tvec[2], PidRegulator::yawAngle(rvec) };
+	double dt = std::chrono::duration<double>(timestamp - this->lastPose).count();
+	if (this->restart.exchange(false)) this->started = false;
+
+	// Same pose again, or an older one
+	if (this->started && (dt <= 0.0)) return false;
+	// First pose, or the drone was lost for too long: restart from the current pose at rest
+	if (!this->started || (dt > MPC_MAX_DT))
+	{
+		for (int axis = 0; axis < MPC_INPUTS; axis++)
+		{
+			this->state[axis] = measured[axis];
+			this->state[MPC_INPUTS + axis] = 0.0;
+		}
+		this->mpc.reset();
+		this->started = true;
+		this->lastPose = timestamp;
+		return false;
+	}
+	this->lastPose = timestamp;
+
+	// Rates from the poses, first order low pass, yaw wrapped to [-pi, pi]
+	double alpha = MPC_VELOCITY_FILTER / (MPC_VELOCITY_FILTER + dt);
+	for (int axis = 0; axis < MPC_INPUTS; axis++)
+	{
+		double delta = measured[axis] - this->state[axis];
+		if (axis == MPC_INPUTS - 1) delta = std::remainder(delta, 2.0 * CV_PI);
+		this->state[MPC_INPUTS + axis] = alpha * this->state[MPC_INPUTS + axis] + (1.0 - alpha) * delta / dt;
+		this->state[axis] = measured[axis];
+	}
+
+	// Yaw reference is the nearest turn of 0
+	cv::Vec<double, MPC_STATES> reference(setpoint[0], setpoint[1], setpoint[2], 0.0, 0.0, 0.0, 0.0, 0.0);
+	reference[3] = this->state[3] - std::remainder(this->state[3], 2.0 * CV_PI);
+
+	cv::Vec<double, MPC_INPUTS> u;
+	MpcRegulator::solve(this->state, reference, u);
+
+	// Camera y points down, more throttle moves the drone towards -y
+	roll = ROLL_DEF + static_cast<int>(std::lround(u[0]));
+	throttle = PID_HOVER_THROTTLE - static_cast<int>(std::lround(u[1]));
+	pitch = PITCH_DEF + static_cast<int>(std::lround(u[2]));
+	yaw = YAW_DEF + static_cast<int>(std::lround(u[3]));
+	return true;
+}
+void MpcRegulator::solve(const cv::Vec<double, MPC_STATES>& x0, const cv::Vec<double, MPC_STATES>& reference, cv::Vec<double, MPC_INPUTS>& u)
+{
+	// Cold start when reset since the last solve
+	if (this->restart.exchange(false))
+	{
+		this->started = false;
+		this->mpc.reset();
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	this->mpc.solve(x0, reference, u, MPC_MAX_ITERATIONS, MPC_TOLERANCE, MPC_TIME_BUDGET);
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+	this->solveTimes.record(elapsed);
+
+	this->solves++;
+	this->totalIterations += this->mpc.getIterations();
+	this->totalTime += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	if (!this->mpc.isConverged()) this->unconverged++;
+}
+void MpcRegulator::printMpcState()
+{
+	cout << "MPC (horizon " << MPC_HORIZON << " steps, " << MPC_HORIZON * MPC_INPUTS << " variables):" << endl;
+	if (this->solves.load() == 0)
+	{
+		cout << "\t- No solve yet" << endl;
+		return;
+	}
+	cout << "\t- Solves: " << this->solves.load() << ", mean iterations " << static_cast<double>(this->totalIterations.load()) / this->solves.load()
+		<< ", stopped before convergence (" << MPC_TIME_BUDGET << " ms budget or " << MPC_MAX_ITERATIONS << " iterations): " << this->unconverged.load() << endl;
+	if (this->totalIterations.load() > 0)
+		cout << "\t- Time per iteration: " << this->totalTime.load() / 1e6 / this->totalIterations.load() << " ms" << endl;
+	cout << "\t- Solve time: p50 " << this->solveTimes.percentile(0.5) << " ms, p99 " << this->solveTimes.percentile(0.99)
+		<< " ms, max " << this->solveTimes.getMax() << " ms" << endl;
+}
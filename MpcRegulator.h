@@ -0,0 +1,69 @@
+#pragma once
+
+#ifndef MPCREGULATOR_H
+#define MPCREGULATOR_H
+
+#include "PidRegulator.h"
+#include "LinearMpc.h"
+#include "LatencyMonitor.h"
+
+#define MPC_HORIZON 20 // steps predicted, 0.67 s at camera rate
+#define MPC_STATES 8 // x, y, z, yaw and their rates
+#define MPC_INPUTS 4 // offsets of roll, throttle, pitch and yaw from their hover value
+#define MPC_RATE 30.0 // Hz, sample rate of the model, one step per frame
+#define MPC_THRUST_GAIN 0.01 // m/s^2 per unit of roll, throttle or pitch offset, to be identified on the drone
+#define MPC_YAW_GAIN 0.01 // rad/s^2 per unit of yaw offset, to be identified on the drone
+#define MPC_MAX_ITERATIONS 200 // max ADMM iterations per solve
+#define MPC_TOLERANCE 0.05 // control value units, residual at which a solve has converged
+#define MPC_TIME_BUDGET 1.0 // ms, a solve stops iterating when it is spent
+#define MPC_VELOCITY_FILTER 0.05 // s, time constant of the low pass on the velocity estimate
+#define MPC_MAX_DT 0.2 // s, longer gaps between poses restart the regulator from the current pose
+
+/*
+Class to compute throttle, roll, pitch and yaw from the pose of the drone with a linear MPC
+Each axis is modeled as a double integrator driven by its control value offset (hover dynamics),
+states are the pose and the velocity estimated from the timestamped poses. Same axes, hover throttle
+and limits as PidRegulator. The QP is solved in process on every new pose within MPC_TIME_BUDGET
+*/
+class MpcRegulator
+{
+	public:
+		MpcRegulator(); // Constructor of the class, precomputes the QP
+		void reset() { this->restart = true; } // Restarts the regulator from the next pose, may be called from any thread
+
+		/*
+		@translation of the drone
+		@rotation vector of the drone
+		@setpoint, yaw setpoint is 0 (marker facing the camera)
+		@capture time of the pose
+		@throttle out
+		@roll out
+		@pitch out
+		@yaw out
+		Computes the control values from a new pose, returns false if the pose only (re)starts the regulator
+		*/
+		bool update(const cv::Vec3d&, const cv::Vec3d&, const cv::Vec3d&, std::chrono::steady_clock::time_point, int&, int&, int&, int&);
+
+		/*
+		@current state: x, y, z, yaw, then their rates
+		@reference state
+		@control value offsets out: roll, throttle, pitch, yaw
+		Solves the QP once and records its time, used by update and by the benchmark
+		*/
+		void solve(const cv::Vec<double, MPC_STATES>&, const cv::Vec<double, MPC_STATES>&, cv::Vec<double, MPC_INPUTS>&);
+		LatencyHistogram& getSolveTimes() { return this->solveTimes; } // Returns histogram of the solve times
+		void printMpcState(); // Prints solve time percentiles and iterations
+
+	private:
+		LinearMpc<MPC_HORIZON, MPC_STATES, MPC_INPUTS> mpc; // QP and solver
+		cv::Vec<double, MPC_STATES> state; // last estimated state
+		bool started; // false until a first pose has been seen
+		std::atomic<bool> restart; // set by reset, handled by the next update
+		std::chrono::steady_clock::time_point lastPose; // capture time of the last pose
+
+		LatencyHistogram solveTimes; // time per solve
+		std::atomic<unsigned long long> solves, totalIterations, unconverged; // solves, their iterations, and solves stopped before convergence
+		std::atomic<unsigned long long> totalTime; // time of all solves in ns
+};
+
+#endif // MPCREGULATOR_H
@@ -0,0 +1,130 @@
+#include "stdafx.h"
+#include "PidRegulator.h"
+
+// PID regulator
+PidRegulator::PidRegulator()
+{
+	// Conservative starting point, to be tuned on the drone
+	PidGains lateral = { 1.2, 150.0, 40.0, 8.0 };
+	PidGains vertical = { 1.5, 250.0, 80.0, 10.0 };
+	PidGains heading = { 2.0, 80.0, 10.0, 2.0 };
+	this->gains[pidAxis::xAxis] = lateral;
+	this->gains[pidAxis::yAxis] = vertical;
+	this->gains[pidAxis::zAxis] = lateral;
+	this->gains[pidAxis::yawAxis] = heading;
+	PidRegulator::reset();
+}
+void PidRegulator::reset()
+{
+	PidRegulator::mu.lock();
+	this->started = false;
+	for (size_t i = 0; i < PID_AXES; i++)
+		this->state[i].position = this->state[i].velocity = this->state[i].acceleration = this->state[i].integral = 0.0;
+	PidRegulator::mu.unlock();
+}
+bool PidRegulator::update(const cv::Vec3d& tvec, const cv::Vec3d& rvec, const cv::Vec3d& setpoint, std::chrono::steady_clock::time_point timestamp,
+	int& throttle, int& roll, int& pitch, int& yaw)
+{
+	double measured[PID_AXES] = { tvec[0], tvec[1], tvec[2], PidRegulator::yawAngle(rvec) };
+	double target[PID_AXES] = { setpoint[0], setpoint[1], setpoint[2], 0.0 };
+	double dt = std::chrono::duration<double>(timestamp - this->lastPose).count();
+
+	PidRegulator::mu.lock();
+	// Same pose again, or an older one
+	if (this->started && (dt <= 0.0))
+	{
+		PidRegulator::mu.unlock();
+		return false;
+	}
+	// First pose, or the drone was lost for too long: restart from the current pose
+	if (!this->started || (dt > PID_MAX_DT))
+	{
+		for (size_t i = 0; i < PID_AXES; i++)
+		{
+			this->state[i].position = measured[i];
+			this->state[i].velocity = this->state[i].acceleration = this->state[i].integral = 0.0;
+		}
+		this->started = true;
+		this->lastPose = timestamp;
+		PidRegulator::mu.unlock();
+		return false;
+	}
+	this->lastPose = timestamp;
+
+	double x = PidRegulator::updateAxis(pidAxis::xAxis, measured[0], target[0], dt, PID_MAX_TILT);
+	double y = PidRegulator::updateAxis(pidAxis::yAxis, measured[1], target[1], dt, PID_MAX_THRUST);
+	double z = PidRegulator::updateAxis(pidAxis::zAxis, measured[2], target[2], dt, PID_MAX_TILT);
+	double psi = PidRegulator::updateAxis(pidAxis::yawAxis, measured[3], target[3], dt, PID_MAX_TILT);
+	PidRegulator::mu.unlock();
+
+	// Camera y points down, more throttle moves the drone towards -y
+	throttle = PID_HOVER_THROTTLE - static_cast<int>(std::lround(y));
+	roll = ROLL_DEF + static_cast<int>(std::lround(x));
+	pitch = PITCH_DEF + static_cast<int>(std::lround(z));
+	yaw = YAW_DEF + static_cast<int>(std::lround(psi));
+	return true;
+}
+PidGains PidRegulator::getGains(pidAxis axis)
+{
+	PidRegulator::mu.lock();
+	PidGains axisGains = this->gains[axis];
+	PidRegulator::mu.unlock();
+	return axisGains;
+}
+void PidRegulator::setGains(pidAxis axis, PidGains axisGains)
+{
+	PidRegulator::mu.lock();
+	this->gains[axis] = axisGains;
+	this->state[axis].integral = 0.0;
+	PidRegulator::mu.unlock();
+}
+void PidRegulator::printGains()
+{
+	const char* names[PID_AXES] = { "x (roll)    ", "y (throttle)", "z (pitch)   ", "yaw         " };
+	cout << "PID gains (kpos, kp, ki, kd):" << endl;
+	for (size_t i = 0; i < PID_AXES; i++)
+	{
+		PidGains axisGains = PidRegulator::getGains(static_cast<pidAxis>(i));
+		cout << "\t- " << names[i] << ": " << axisGains.kpos << ", " << axisGains.kp << ", " << axisGains.ki << ", " << axisGains.kd << endl;
+	}
+}
+double PidRegulator::yawAngle(const cv::Vec3d& rvec)
+{
+	// Normal of the marker, (0, 0, -1) when it faces the camera
+	cv::Matx33d R;
+	cv::Rodrigues(rvec, R);
+	return std::atan2(-R(0, 2), -R(2, 2));
+}
+double PidRegulator::updateAxis(pidAxis axis, double measured, double target, double dt, double limit)
+{
+	PidAxisState& axisState = this->state[axis];
+	const PidGains& axisGains = this->gains[axis];
+
+	// Yaw error is wrapped to [-pi, pi]
+	double delta = measured - axisState.position;
+	double error = target - measured;
+	if (axis == pidAxis::yawAxis)
+	{
+		delta = std::remainder(delta, 2.0 * CV_PI);
+		error = std::remainder(error, 2.0 * CV_PI);
+	}
+
+	// Velocity and acceleration from the poses, first order low pass
+	double alpha = PID_DERIVATIVE_FILTER / (PID_DERIVATIVE_FILTER + dt);
+	double velocity = alpha * axisState.velocity + (1.0 - alpha) * delta / dt;
+	axisState.acceleration = alpha * axisState.acceleration + (1.0 - alpha) * (velocity - axisState.velocity) / dt;
+	axisState.velocity = velocity;
+	axisState.position = measured;
+
+	// Outer loop: position error to velocity setpoint
+	double targetVelocity = std::max(-PID_MAX_VELOCITY, std::min(PID_MAX_VELOCITY, axisGains.kpos * error));
+
+	// Inner loop: PID on the velocity error
+	double velocityError = targetVelocity - velocity;
+	double unsaturated = axisGains.kp * velocityError + axisGains.ki * axisState.integral - axisGains.kd * axisState.acceleration;
+	double output = std::max(-limit, std::min(limit, unsaturated));
+	// Anti-windup: no integration while saturated in the direction of the error
+	if ((output == unsaturated) || ((unsaturated > output) != (velocityError > 0.0)))
+		axisState.integral += velocityError * dt;
+	return output;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#ifndef PIDREGULATOR_H
+#define PIDREGULATOR_H
+
+#include "ControlMode.h"
+
+#define PID_AXES 4 // x, y, z and yaw
+#define PID_HOVER_THROTTLE 1500 // throttle holding the drone in the air, the regulator adds to it
+#define PID_MAX_THRUST 400 // max offset of the throttle from hover
+#define PID_MAX_TILT 300 // max offset of roll, pitch and yaw from their default
+#define PID_MAX_VELOCITY 0.5 // m/s (rad/s for yaw), max velocity the outer loop asks for
+#define PID_DERIVATIVE_FILTER 0.05 // s, time constant of the low pass on the velocity and acceleration estimates
+#define PID_MAX_DT 0.2 // s, longer gaps between poses restart the regulator from the current pose
+
+// Enumeration to store the axes of the regulator
+enum pidAxis
+{
+	xAxis = 0, // camera x (right), roll
+	yAxis = 1, // camera y (down), throttle
+	zAxis = 2, // camera z (forward), pitch
+	yawAxis = 3 // rotation about camera y, yaw
+};
+
+// Gains of one axis
+struct PidGains
+{
+	double kpos; // 1/s, position error to velocity setpoint (outer loop)
+	double kp; // proportional gain on the velocity error
+	double ki; // integral gain on the velocity error
+	double kd; // derivative gain, on the measured acceleration
+};
+
+// State of one axis between two poses
+struct PidAxisState
+{
+	double position; // last measured position (angle for yaw)
+	double velocity; // filtered velocity
+	double acceleration; // filtered acceleration
+	double integral; // integral of the velocity error
+};
+
+/*
+Class to compute throttle, roll, pitch and yaw from the pose of the drone with cascaded PIDs
+Each axis has an outer proportional loop turning the position error into a velocity setpoint,
+and an inner PID on the velocity estimated from the poses. The derivative acts on the measured
+acceleration only (no kick on setpoint changes) and velocity and acceleration are low pass filtered.
+The integral stops growing while the output is saturated in the direction of the error (anti-windup)
+The camera is assumed behind the drone looking forward: camera x is the right of the drone,
+y points down and z forward, and the marker faces the camera. Negative gains reverse an axis
+The default gains settle each axis of a simulated double integrator, see 'bench pid'
+*/
+class PidRegulator
+{
+	public:
+		PidRegulator(); // Constructor of the class, default gains
+		void reset(); // Restarts the regulator from the next pose
+
+		/*
+		@translation of the drone
+		@rotation vector of the drone
+		@setpoint, yaw setpoint is 0 (marker facing the camera)
+		@capture time of the pose
+		@throttle out
+		@roll out
+		@pitch out
+		@yaw out
+		Computes the control values from a new pose, returns false if the pose only (re)starts the regulator
+		*/
+		bool update(const cv::Vec3d&, const cv::Vec3d&, const cv::Vec3d&, std::chrono::steady_clock::time_point, int&, int&, int&, int&);
+
+		/*
+		@axis
+		Returns the gains of an axis
+		*/
+		PidGains getGains(pidAxis);
+
+		/*
+		@axis
+		@gains to set
+		Sets the gains of an axis and restarts its integral
+		*/
+		void setGains(pidAxis, PidGains);
+		void printGains(); // Prints the gains of every axis
+
+		/*
+		@rotation vector of the drone
+		Returns the yaw of the drone in rad, 0 when the marker faces the camera, positive to the right
+		*/
+		static double yawAngle(const cv::Vec3d&);
+
+	private:
+		/*
+		@axis
+		@measured position
+		@target position
+		@time since the last pose in s
+		@max absolute output
+		Returns the output of the cascaded PID of one axis
+		*/
+		double updateAxis(pidAxis, double, double, double, double);
+
+		PidGains gains[PID_AXES]; // gains per axis
+		PidAxisState state[PID_AXES]; // state per axis
+		bool started; // false until a first pose has been seen
+		std::chrono::steady_clock::time_point lastPose; // capture time of the last pose
+		std::mutex mu; // gains are set by the console thread
+};
+
+#endif // PIDREGULATOR_H
@@ -0,0 +1,166 @@
+#include "stdafx.h"
+#include "PoseFilter.h"
+
+// Pose filter
+PoseFilter::PoseFilter()
+{
+	this->updates = this->rejected = this->restarts = 0;
+	this->updateTime = this->maxUpdateTime = 0.0;
+	PoseFilter::reset();
+}
+void PoseFilter::reset()
+{
+	this->initialized = false;
+	this->consecutiveRejects = 0;
+	for (int a = 0; a < KALMAN_AXES; a++)
+		this->position[a] = this->velocity[a] = this->angularVelocity[a] = 0.0;
+	this->rotation = cv::Matx33d::eye();
+	for (int a = 0; a < 2 * KALMAN_AXES; a++)
+		this->covariance[a][0] = this->covariance[a][1] = this->covariance[a][2] = 0.0;
+}
+void PoseFilter::initialize(const cv::Vec3d& rvec, const cv::Vec3d& tvec, std::chrono::steady_clock::time_point time)
+{
+	const double noise[KALMAN_AXES] = { KALMAN_LATERAL_NOISE, KALMAN_LATERAL_NOISE, KALMAN_DEPTH_NOISE };
+	for (int a = 0; a < KALMAN_AXES; a++)
+	{
+		this->position[a] = tvec[a];
+		this->velocity[a] = this->angularVelocity[a] = 0.0;
+		this->covariance[a][0] = noise[a] * noise[a];
+		this->covariance[KALMAN_AXES + a][0] = KALMAN_ANGLE_NOISE * KALMAN_ANGLE_NOISE;
+		this->covariance[a][1] = this->covariance[KALMAN_AXES + a][1] = 0.0;
+		this->covariance[a][2] = this->covariance[KALMAN_AXES + a][2] = KALMAN_INITIAL_VELOCITY * KALMAN_INITIAL_VELOCITY;
+	}
+	this->rotation = PoseFilter::vectorToRotation(rvec);
+	this->timestamp = time;
+	this->initialized = true;
+	this->consecutiveRejects = 0;
+	this->restarts++;
+}
+void PoseFilter::predictCovariance(double* P, double dt, double q)
+{
+	// Constant velocity driven by white acceleration: F = [1 dt; 0 1], Q = q [dt^3/3 dt^2/2; dt^2/2 dt]
+	P[0] += dt * (2.0 * P[1] + dt * P[2]) + q * dt * dt * dt / 3.0;
+	P[1] += dt * P[2] + q * dt * dt / 2.0;
+	P[2] += q * dt;
+}
+bool PoseFilter::update(const cv::Vec3d& rvec, const cv::Vec3d& tvec, std::chrono::steady_clock::time_point time)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	float gap = std::chrono::duration<float, std::milli>(time - this->timestamp).count();
+	// Older than the state, nothing to correct
+	if (this->initialized && (gap < 0.f)) return false;
+	if (!this->initialized || (gap > KALMAN_MAX_GAP) || (this->consecutiveRejects >= KALMAN_MAX_REJECTS))
+	{
+		PoseFilter::initialize(rvec, tvec, time);
+		this->updates++;
+		return true;
+	}
+
+	// Prediction to the capture time, on copies until the detection is accepted
+	double dt = gap / 1000.0;
+	double P[2 * KALMAN_AXES][3];
+	double predicted[KALMAN_AXES];
+	std::copy(&this->covariance[0][0], &this->covariance[0][0] + 6 * KALMAN_AXES, &P[0][0]);
+	for (int a = 0; a < KALMAN_AXES; a++)
+	{
+		predicted[a] = this->position[a] + this->velocity[a] * dt;
+		PoseFilter::predictCovariance(P[a], dt, KALMAN_ACCELERATION * KALMAN_ACCELERATION);
+		PoseFilter::predictCovariance(P[KALMAN_AXES + a], dt, KALMAN_ANGULAR_ACCELERATION * KALMAN_ANGULAR_ACCELERATION);
+	}
+	cv::Matx33d rotationPredicted = this->rotation * PoseFilter::vectorToRotation(cv::Vec3d(this->angularVelocity[0], this->angularVelocity[1], this->angularVelocity[2]) * dt);
+
+	// Innovations: position difference, and rotation from the prediction to the detection in the marker frame
+	const double noise[2 * KALMAN_AXES] = { KALMAN_LATERAL_NOISE, KALMAN_LATERAL_NOISE, KALMAN_DEPTH_NOISE, KALMAN_ANGLE_NOISE, KALMAN_ANGLE_NOISE, KALMAN_ANGLE_NOISE };
+	cv::Vec3d angle = MarkerPose::rotationToVector(rotationPredicted.t() * PoseFilter::vectorToRotation(rvec));
+	double innovation[2 * KALMAN_AXES], variance[2 * KALMAN_AXES];
+	for (int a = 0; a < 2 * KALMAN_AXES; a++)
+	{
+		innovation[a] = (a < KALMAN_AXES) ? tvec[a] - predicted[a] : angle[a - KALMAN_AXES];
+		variance[a] = P[a][0] + noise[a] * noise[a];
+		if (innovation[a] * innovation[a] > KALMAN_GATE * KALMAN_GATE * variance[a])
+		{
+			this->rejected++;
+			this->consecutiveRejects++;
+			return false;
+		}
+	}
+
+	// Correction, P = (I - KH) P per axis
+	cv::Vec3d correction;
+	for (int a = 0; a < 2 * KALMAN_AXES; a++)
+	{
+		double k0 = P[a][0] / variance[a], k1 = P[a][1] / variance[a];
+		if (a < KALMAN_AXES)
+		{
+			this->position[a] = predicted[a] + k0 * innovation[a];
+			this->velocity[a] += k1 * innovation[a];
+		}
+		else
+		{
+			correction[a - KALMAN_AXES] = k0 * innovation[a];
+			this->angularVelocity[a - KALMAN_AXES] += k1 * innovation[a];
+		}
+		this->covariance[a][2] = P[a][2] - k1 * P[a][1];
+		this->covariance[a][1] = (1.0 - k0) * P[a][1];
+		this->covariance[a][0] = (1.0 - k0) * P[a][0];
+	}
+	this->rotation = rotationPredicted * PoseFilter::vectorToRotation(correction);
+	this->timestamp = time;
+	this->consecutiveRejects = 0;
+	this->updates++;
+
+	double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	this->updateTime += elapsed;
+	this->maxUpdateTime = std::max(this->maxUpdateTime, elapsed);
+	return true;
+}
+bool PoseFilter::predict(std::chrono::steady_clock::time_point time, cv::Vec3d& rvec, cv::Vec3d& tvec)
+{
+	if (!this->initialized) return false;
+	float ahead = std::chrono::duration<float, std::milli>(time - this->timestamp).count();
+	if (ahead > KALMAN_MAX_PREDICTION) return false;
+	double dt = std::max(0.f, ahead) / 1000.0;
+	for (int a = 0; a < KALMAN_AXES; a++)
+		tvec[a] = this->position[a] + this->velocity[a] * dt;
+	rvec = MarkerPose::rotationToVector(this->rotation * PoseFilter::vectorToRotation(cv::Vec3d(this->angularVelocity[0], this->angularVelocity[1], this->angularVelocity[2]) * dt));
+	return true;
+}
+cv::Vec3d PoseFilter::getPositionDeviation()
+{
+	return cv::Vec3d(std::sqrt(this->covariance[0][0]), std::sqrt(this->covariance[1][0]), std::sqrt(this->covariance[2][0]));
+}
+cv::Vec3d PoseFilter::getVelocityDeviation()
+{
+	return cv::Vec3d(std::sqrt(this->covariance[0][2]), std::sqrt(this->covariance[1][2]), std::sqrt(this->covariance[2][2]));
+}
+cv::Vec3d PoseFilter::getRotationDeviation()
+{
+	return cv::Vec3d(std::sqrt(this->covariance[3][0]), std::sqrt(this->covariance[4][0]), std::sqrt(this->covariance[5][0]));
+}
+cv::Matx33d PoseFilter::vectorToRotation(const cv::Vec3d& w)
+{
+	// Rodrigues formula, R = I + sin(t) K + (1 - cos(t)) K^2 with K the cross product matrix of the unit axis
+	double theta = std::sqrt(w.dot(w));
+	cv::Matx33d K(0.0, -w[2], w[1],
+		w[2], 0.0, -w[0],
+		-w[1], w[0], 0.0);
+	if (theta < 1e-9)
+		return cv::Matx33d::eye() + K;
+	double a = std::sin(theta) / theta, b = (1.0 - std::cos(theta)) / (theta * theta);
+	return cv::Matx33d::eye() + K * a + K * K * b;
+}
+void PoseFilter::printFilterState()
+{
+	cout << "Kalman filter:" << endl;
+	if (!this->initialized)
+	{
+		cout << "\t- Waiting for a detection." << endl;
+		return;
+	}
+	cout << "\t- Velocity: " << PoseFilter::getVelocity() << " m/s (deviation " << PoseFilter::getVelocityDeviation() << "), angular velocity "
+		<< PoseFilter::getAngularVelocity() << " rad/s" << endl;
+	cout << "\t- Deviation: position " << PoseFilter::getPositionDeviation() * 1000.0 << " mm, rotation " << PoseFilter::getRotationDeviation() * (180.0 / CV_PI) << " deg" << endl;
+	cout << "\t- Detections: " << this->updates << " accepted, " << this->rejected << " rejected, " << this->restarts << " restarts" << endl;
+	if (this->updates > this->restarts)
+		cout << "\t- Update time: mean " << this->updateTime / (this->updates - this->restarts) << " us, max " << this->maxUpdateTime << " us" << endl;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#ifndef POSEFILTER_H
+#define POSEFILTER_H
+
+#include "stdafx.h"
+#include "MarkerPose.h"
+
+#define KALMAN_AXES 3 // x, y, z for the translation, and the same for the rotation
+#define KALMAN_LATERAL_NOISE 0.002 // m, standard deviation of x and y measured by MarkerPose
+#define KALMAN_DEPTH_NOISE 0.01 // m, standard deviation of z, the distance to the camera is the least accurate
+#define KALMAN_ANGLE_NOISE 0.02 // rad, standard deviation of the measured rotation around each axis
+#define KALMAN_ACCELERATION 1.0 // m/s^2, standard deviation of the unmodelled acceleration
+#define KALMAN_ANGULAR_ACCELERATION 3.0 // rad/s^2, standard deviation of the unmodelled angular acceleration
+#define KALMAN_INITIAL_VELOCITY 1.0 // m/s (rad/s for the rotation), standard deviation of the velocity when the filter starts
+#define KALMAN_GATE 5.0 // standard deviations of the innovation beyond which a detection is rejected (e.g. a flipped pose)
+#define KALMAN_MAX_REJECTS 3 // consecutive rejected detections after which the filter restarts from the next one
+#define KALMAN_MAX_GAP 500.f // ms without detection after which the filter restarts from the next one
+#define KALMAN_MAX_PREDICTION 100.f // ms after the last detection the pose is still predicted, about 3 frames at 30 fps
+
+/*
+Class of a constant velocity Kalman filter on the 6-DoF pose of a marker
+Translation: one filter of position and velocity per camera axis, with the depth noisier than x and y
+Rotation: error state filter, the orientation is kept as a matrix with a body angular velocity, and each
+detection is compared to the prediction through the rotation vector of their difference, so the filter
+never sees the wrap of the rotation vector at pi of a marker facing the camera
+Axes are independent 2x2 filters, everything is in the object and an update takes well under a microsecond.
+Detections whose innovation is beyond KALMAN_GATE standard deviations are rejected
+*/
+class PoseFilter
+{
+	public:
+		PoseFilter(); // Constructor of the class
+		void reset(); // Forgets the state, the next detection starts the filter again
+
+		/*
+		@rotation vector of the detection
+		@translation vector of the detection
+		@capture time of the frame
+		Predicts the state to the capture time and corrects it with the detection, returns false if the detection was rejected
+		*/
+		bool update(const cv::Vec3d&, const cv::Vec3d&, std::chrono::steady_clock::time_point);
+
+		/*
+		@time to predict the pose at
+		@rotation vector out
+		@translation vector out
+		Predicts the pose at a time without changing the state, returns false if the filter has no state
+		or the last detection is more than KALMAN_MAX_PREDICTION ms before that time
+		*/
+		bool predict(std::chrono::steady_clock::time_point, cv::Vec3d&, cv::Vec3d&);
+		bool isInitialized() { return this->initialized; } // Returns true once a detection started the filter
+		std::chrono::steady_clock::time_point getTimestamp() { return this->timestamp; } // Returns capture time of the last accepted detection
+		cv::Vec3d getVelocity() { return cv::Vec3d(this->velocity[0], this->velocity[1], this->velocity[2]); } // Returns velocity in m/s, camera frame
+		cv::Vec3d getAngularVelocity() { return cv::Vec3d(this->angularVelocity[0], this->angularVelocity[1], this->angularVelocity[2]); } // Returns angular velocity in rad/s, marker frame
+		cv::Vec3d getPositionDeviation(); // Returns standard deviation of the position in m per axis
+		cv::Vec3d getVelocityDeviation(); // Returns standard deviation of the velocity in m/s per axis
+		cv::Vec3d getRotationDeviation(); // Returns standard deviation of the rotation in rad per axis
+		void printFilterState(); // Prints state, deviations, rejected detections and update time
+
+		/*
+		@rotation vector (axis * angle)
+		Returns the rotation matrix of the vector
+		*/
+		static cv::Matx33d vectorToRotation(const cv::Vec3d&);
+
+	private:
+		/*
+		@covariance of the axis, P00 P01 P11
+		@elapsed time in s
+		@spectral density of the acceleration
+		Propagates the covariance of a position and velocity pair over the elapsed time
+		*/
+		static void predictCovariance(double*, double, double);
+
+		/*
+		@rotation vector of the detection
+		@translation vector of the detection
+		@capture time of the frame
+		Starts the filter from a detection, velocities unknown
+		*/
+		void initialize(const cv::Vec3d&, const cv::Vec3d&, std::chrono::steady_clock::time_point);
+
+		bool initialized; // true once a detection started the filter
+		std::chrono::steady_clock::time_point timestamp; // capture time the state is valid at
+		double position[KALMAN_AXES], velocity[KALMAN_AXES]; // translation state, camera frame
+		cv::Matx33d rotation; // orientation state
+		double angularVelocity[KALMAN_AXES]; // marker frame
+		double covariance[2 * KALMAN_AXES][3]; // P00 P01 P11 per axis, translation then rotation
+
+		// Statistics
+		unsigned long long updates, rejected, restarts; // accepted and rejected detections, restarts
+		int consecutiveRejects; // rejected detections since the last accepted one
+		double updateTime, maxUpdateTime; // total and max duration of an update in us
+};
+
+#endif // POSEFILTER_H
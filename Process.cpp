@@ -4,19 +4,23 @@
 // Process
 Process::Process(mode mode, regulator reg, filter filt, cv::Vec3d sp, parameter vid, parameter mark, parameter axes) : 
 	ControlMode(mode, reg, filt, sp),
-	VideoParameters(vid, mark, axes)
+	VideoParameters(vid, mark, axes),
+	pool(0),
+	detector(this->droneMarker, ROI_FALLBACK_DELAY, parameter::on, DETECTION_SCALE),
+	markerPose(QR_CODE_SIZE),
+	rig(this->droneMarker),
+	display(DISPLAY_RATE, PREVIEW_WIDTH),
+	governor(GOVERNOR_RATE),
+	scheduler(CONTROL_RATE)
 {
 	cout << "INITIALIZING PROGRAM." << endl;
 	cout << "-----------------------------------------------------------------------------------------------------------------" << endl << endl;
 	Process::setSystemState(systemState::idle); // Standard system state upon program start
+	Process::initialize();
 
 	// Initialize communication with Arduino
 	Process::connectToArduino();
 
-	// Initializing position/orientation vectors
-	this->lastTranslationVector.push_back(cv::Vec3d(0, 0, 0));
-	this->lastRotationVector.push_back(cv::Vec3d(0, 0, 0));
-
 	cout << "-----------------------------------------------------------------------------------------------------------------" << endl << endl;
 	cout << "Calibration routine..." << endl;
 	std::ifstream calib_file(CALIBDATA_FILE);
@@ -44,11 +48,12 @@ Process::Process(mode mode, regulator reg, filter filt, cv::Vec3d sp, parameter
 
 	// Load calibration file
 	VideoParameters::loadCameraCalibration();
+	Process::shareCalibration();
 	cout << "-----------------------------------------------------------------------------------------------------------------" << endl << endl;
 
 	// Commands
 	this->valid_command_str = { "start", "stop", "help", "pause", "resume", "state", "vid", "markers", "axes", "webcam",  "pose", "pc",
-						  "print sp", "set sp", "mode", "reg off", "pid", "mpc", "filter off", "kalman", "log" };
+						  "print sp", "set sp", "mode", "reg off", "pid", "mpc", "filter off", "kalman", "log", "roi", "detection", "pyramid", "multicam", "tiles", "preview", "stats", "channel", "pid gains", "control", "protocol", "drones", "compensation", "governor", "undistort" };
 	this->command_description = {"Starts program.",
 						   "Stops drone and halt program.",
 						   "Displays this help ('h' can also be used).",
@@ -65,34 +70,116 @@ Process::Process(mode mode, regulator reg, filter filt, cv::Vec3d sp, parameter
 						   "Lets the user enter the setpoint.",
 						   "Goes to automatic mode if manual, to manual if automatic (default manual, 'm' can also be used).\n\tIn manual mode, use:\n\t\tx/z to increase/decrease throttle,\n\t\td/a to roll right/left,\n\t\tw/s to pitch towrds/backwards and\n\t\tq/e to yaw right/left.\n\t\tIn automatic mode, only roll pitch and yaw can be modified.\n\t\tWrite e.g. x=1500 to give step input.",
 						   "Disable regulator.",
-						   "Sets PID as regulator (default regulator). TODO: change PID settings.",
-						   "Sets MPC as regulator.",
+						   "Sets the in-process PID as regulator (default regulator) and prints its gains, see 'pid gains'.",
+						   "Sets the in-process MPC as regulator and prints its solve times.",
 						   "Disables filtering (default filter).",
-						   "Enables Kalman filtering.",
-						   "Starts or stops data registration"};
+						   "Enables Kalman filtering of the pose, the controller keeps flying through one or two missed frames.",
+						   "Starts or stops data registration",
+						   "Turns on ROI tracking of the drone marker if off, turn off if on (default on).",
+						   "Prints detection mode and detection time per frame for each mode.",
+						   "Changes detection scale, searches markers at 1/1, 1/2 or 1/4 resolution (default 1/2).",
+						   "Turns on detection on all other webcams and pose fusion if off, turn off if on (default off).",
+						   "Turns on tile-parallel detection on all cores if off, turn off if on (default on).",
+						   "Changes preview rate of the webcam window, 5, 15 or 30 Hz (default 15 Hz).",
+						   "Prints p50/p99/max latency of each stage from capture to serial write.",
+						   "Exchanges pose and commands with the external controller through files if through shared memory,\n\tthrough shared memory if through files (default shared memory, see draco_channel.h).",
+						   "Lets the user enter the PID gains of an axis (x, y, z or yaw).",
+						   "Lets the user enter the rate of the control thread, whether it also runs on every new pose,\n\tand its real-time priority (default 33.3 Hz, timed only, normal priority).",
+						   "Sends commands to the Arduino as text if as binary frames, as binary frames if as text\n\t(default text, binary frames once the Arduino sends the hello frame of draco_serial.h:\n\t14 bytes per command instead of 255).",
+						   "Lists the other drones, or adds (a) or removes (r) one by the ID of its marker.\n\tEach drone has its own setpoint, PID and Arduino, and flies in automatic mode like the main drone.",
+						   "Turns on latency compensation if off, turn off if on (default off). The pose is predicted with the\n\tKalman motion model to the time the command computed from it reaches the wire, its timestamp stays\n\tthe capture time and the shared memory channel publishes the prediction horizon.",
+						   "Lets the user enter the minimum pose rate the frame governor holds by lowering the detection and preview\n\tquality under load, 0 turns it off (default 25 Hz).",
+						   "Turns on undistortion of the webcam window if off, turn off if on (default on). Marker corners are\n\talways undistorted through the lookup grid of MarkerPose, see 'bench undistort'."};
 
-	// Data registration
-	this->logData = false;
-
-	// Shared time-related variables
-	this->markerTimer = clock();
-	this->dataTimer = clock();
+	// Controller channel, files if shared memory is refused
+	this->sharedMemory = (this->channel.open()) ? parameter::on : parameter::off;
+	if (this->sharedMemory == parameter::off)
+		cout << "Could not create the shared memory channel (refused, or used by another DRACO), the controller will use " << POSE_FILE << " and " << TRPY_FILE << "." << endl;
 
 	cout << "PROGRAM INITIALIZED." << endl;
 	cout << "-----------------------------------------------------------------------------------------------------------------" << endl << endl;
 
 	initiateThreads();
 }
+Process::Process(string path, bool realtime) :
+	ControlMode(mode::manual, regulator::regoff, filter::filteroff, cv::Vec3d(0, 0, 0.8)),
+	VideoParameters(parameter::off, parameter::off, parameter::off),
+	pool(0),
+	detector(this->droneMarker, ROI_FALLBACK_DELAY, parameter::on, DETECTION_SCALE),
+	markerPose(QR_CODE_SIZE),
+	rig(this->droneMarker),
+	display(DISPLAY_RATE, PREVIEW_WIDTH),
+	governor(GOVERNOR_RATE),
+	scheduler(CONTROL_RATE)
+{
+	cout << "REPLAYING " << path << ((realtime) ? " at recorded pace." : " as fast as possible.") << endl;
+	cout << "-----------------------------------------------------------------------------------------------------------------" << endl << endl;
+	// No serial port and no controller channel, nothing is sent
+	Process::initialize();
+
+	// Calibration of the camera the recording was made with, an ideal camera if none
+	VideoParameters::loadCameraCalibrationOrIdeal();
+	Process::shareCalibration();
+
+	// As fast as possible, the throughput is measured at full quality
+	this->governor.setEnabled(realtime);
+	this->replay = true;
+	this->replayPath = path;
+	this->replayRealtime = realtime;
+
+	// Run the pipeline on this thread until the end of the recording
+	Process::setSystemState(systemState::start);
+	Process::videoProcessing();
+	Process::printReplaySummary();
+}
 Process::~Process()
 {
 	// Print stop message
 	cout << "-----------------------------------------------------------------------------------------------------------------" << endl
 		<< "STOPPING PROCEDURE . . ." << endl
 		<< "-----------------------------------------------------------------------------------------------------------------" << endl << endl;
-	// stop drone
-	this->arduino->writeSerialPort(&this->droneStop[0u], MAX_DATA_LENGTH);
-	// close communication
-	delete this->arduino;
+	// The control thread may still write to the serial port
+	this->scheduler.stop();
+	// Stop the other drones and close their ports
+	this->drones.clear();
+	// stop drone and close communication, the stop is written before the port closes (no serial port in replay)
+	Process::sendCommand(this->droneStop);
+	this->link.close();
+	// Latency over the whole run (printed with the summary in replay)
+	if (!this->replay)
+		this->latency.printLatencyState();
+}
+void Process::initialize()
+{
+	this->detector.setThreadPool(&this->pool);
+	this->sharedMemory = parameter::off;
+
+	// Initializing position/orientation vectors
+	this->lastTranslationVector.push_back(cv::Vec3d(0, 0, 0));
+	this->lastRotationVector.push_back(cv::Vec3d(0, 0, 0));
+
+	// Data registration
+	this->logData = false;
+	this->replay = false;
+	this->replayRealtime = false;
+	this->compensation = parameter::off;
+	this->processedFrames = 0;
+
+	// Shared time-related variables
+	this->markerTimer = std::chrono::steady_clock::now();
+	this->latestPose.sequence = 0;
+	this->latestPose.detected = false;
+	this->latestPose.predicted = false;
+	this->latestPose.horizon = 0.f;
+	this->latestPose.lastSeen = this->markerTimer;
+	this->controlPose = this->latestPose;
+	this->timeline.decided = this->timeline.written = true; // no frame yet
+}
+void Process::shareCalibration()
+{
+	this->markerPose.setCalibration(this->cameraMatrix, this->distanceCoeff);
+	this->drones.setCalibration(this->cameraMatrix, this->distanceCoeff);
+	this->display.setCalibration(this->cameraMatrix, this->distanceCoeff);
 }
 void Process::initiateThreads()
 {
@@ -226,17 +313,18 @@ void Process::consoleInput()
 				{
 					if ((lastPrintedTranslationVec.at(0) != this->lastTranslationVector.at(0)) && this->droneDetected)
 					{
-						cout << "t,r,p,y: " << this->newData << "\txyz: " << this->lastTranslationVector.at(0) << endl;
-						for (size_t i = 0; i < (9 + this->newData.size()); i++)
+						cout << "t,r,p,y: " << this->newData.text << "\txyz: " << this->lastTranslationVector.at(0) << endl;
+						for (size_t i = 0; i < (9 + this->newData.length); i++)
 							cout << " ";
 						cout << "\terror_xyz: " << this->lastTranslationVector.at(0) - ControlMode::getSetPoint() << endl;
-						for (size_t i = 0; i < (9 + this->newData.size()); i++)
+						for (size_t i = 0; i < (9 + this->newData.length); i++)
 							cout << " ";
 						cout << "\ttheta_xyz: " << this->lastRotationVector.at(0) << endl << endl;
 						lastPrintedTranslationVec.at(0) = this->lastTranslationVector.at(0);
 						lastPrintedRotationVec.at(0) = this->lastRotationVector.at(0);
 					}
 				}
+				restoreConsole();
 			}
 			// Display setpoint
 			else if ((input == this->valid_command_str[12]) && startedOrPaused)
@@ -298,7 +386,11 @@ void Process::consoleInput()
 			else if (((input == this->valid_command_str[14]) || (input == "m")) && startedOrPaused)
 			{
 				if (ControlMode::getOperatingMode() == mode::manual)
+				{
+					this->pidRegulator.reset();
+					this->mpcRegulator.reset();
 					ControlMode::setOperatingMode(mode::automatic);
+				}
 				else ControlMode::setOperatingMode(mode::manual);
 				cout << "\tOperating mode: " << ((ControlMode::getOperatingMode() == mode::manual) ? "manual." : "automatic.\n\tPose file is being updated, you can start Matlab controll script.") << endl;
 			}
@@ -311,15 +403,18 @@ void Process::consoleInput()
 			// PID
 			else if ((input == this->valid_command_str[16]) && startedOrPaused)
 			{
-				// TODO: program PID values in here
+				this->pidRegulator.reset();
 				ControlMode::setOperatingReg(regulator::pid);
 				cout << "\tRegulator: PID." << endl;
+				this->pidRegulator.printGains();
 			}
 			// MPC
 			else if ((input == this->valid_command_str[17]) && startedOrPaused)
 			{
+				this->mpcRegulator.reset();
 				ControlMode::setOperatingReg(regulator::mpc);
 				cout << "\tRegulator: MPC." << endl;
+				this->mpcRegulator.printMpcState();
 			}
 			// Filter off
 			else if ((input == this->valid_command_str[18]) && startedOrPaused)
@@ -331,7 +426,7 @@ void Process::consoleInput()
 			else if ((input == this->valid_command_str[19]) && startedOrPaused)
 			{
 				ControlMode::setOperatingFilter(filter::kalman);
-				cout << "\tFilter: Kalman." << endl;
+				cout << "\tFilter: Kalman, the pose is predicted up to " << KALMAN_MAX_PREDICTION << " ms after the last detection." << endl;
 			}
 			// Log/Don't log data
 			else if ((input == this->valid_command_str[20]) && started)
@@ -340,49 +435,294 @@ void Process::consoleInput()
 				else this->logData = true;
 				cout << ((this->logData)? "\tLogging data." : "\tNot logging data.") << endl;
 			}
+			// ROI tracking on/off
+			else if ((input == this->valid_command_str[21]) && started)
+			{
+				if (this->detector.getTracking() == parameter::on) this->detector.setTracking(parameter::off);
+				else if (this->drones.size() > 0) cout << "\tThe region of interest only follows the main drone, remove the other drones first." << endl;
+				else this->detector.setTracking(parameter::on);
+				cout << "\tROI tracking: " << ((this->detector.getTracking() == parameter::on) ? "on." : "off.") << endl;
+			}
+			// Detection timings
+			else if ((input == this->valid_command_str[22]) && startedOrPaused)
+				this->detector.printDetectionState();
+			// Pyramid scale 1 -> 2 -> 4 -> 1
+			else if ((input == this->valid_command_str[23]) && started)
+			{
+				this->detector.setScale((this->detector.getScale() >= 4) ? 1 : this->detector.getScale() * 2);
+				cout << "\tDetection scale: 1/" << this->detector.getScale() << "." << endl;
+			}
+			// Multi-camera on/off
+			else if ((input == this->valid_command_str[24]) && started)
+			{
+				if (this->rig.isRunning()) this->rig.stop();
+				else if (this->rig.start(VideoParameters::getCurrentWebcam()) == 0)
+					cout << "\tNo other webcam found." << endl;
+				cout << "\tMulti-camera: " << ((this->rig.isRunning()) ? "on." : "off.") << endl;
+			}
+			// Tile-parallel detection on/off
+			else if ((input == this->valid_command_str[25]) && started)
+			{
+				if (this->detector.getTiling() == parameter::on) this->detector.setTiling(parameter::off);
+				else this->detector.setTiling(parameter::on);
+				cout << "\tTiled detection: " << ((this->detector.getTiling() == parameter::on) ? "on (" : "off (")
+					<< this->pool.getThreads() << " threads)." << endl;
+			}
+			// Preview rate 5 -> 15 -> 30 -> 5 Hz
+			else if ((input == this->valid_command_str[26]) && started)
+			{
+				this->display.setRate((this->display.getRate() >= 30.f) ? 5.f : ((this->display.getRate() >= 15.f) ? 30.f : 15.f));
+				cout << "\tPreview rate: " << this->display.getRate() << " Hz." << endl;
+			}
+			// Latency statistics
+			else if ((input == this->valid_command_str[27]) && startedOrPaused)
+			{
+				this->latency.printLatencyState();
+				this->scheduler.printSchedulerState();
+				this->link.printLinkState();
+				if (ControlMode::getOperatingReg() == regulator::mpc) this->mpcRegulator.printMpcState();
+			}
+			// Controller channel shared memory/files
+			else if ((input == this->valid_command_str[28]) && startedOrPaused)
+			{
+				if (this->sharedMemory == parameter::on) this->sharedMemory = parameter::off;
+				else if (this->channel.isOpen() || this->channel.open()) this->sharedMemory = parameter::on;
+				cout << "\tController channel: " << ((this->sharedMemory == parameter::on) ? "shared memory." : "files.") << endl;
+			}
+			// Set PID gains of an axis
+			else if ((input == this->valid_command_str[29]) && startedOrPaused)
+			{
+				cout << "\tAxis (x, y, z or yaw): ";
+				std::getline(cin, value_str);
+				int axis = (value_str == "x") ? pidAxis::xAxis : ((value_str == "y") ? pidAxis::yAxis :
+					((value_str == "z") ? pidAxis::zAxis : ((value_str == "yaw") ? pidAxis::yawAxis : -1)));
+				if (axis < 0)
+					cout << "ERROR: Unknown axis, try again." << endl;
+				else
+				{
+					PidGains gains = this->pidRegulator.getGains(static_cast<pidAxis>(axis));
+					double* gain[4] = { &gains.kpos, &gains.kp, &gains.ki, &gains.kd };
+					const char* names[4] = { "kpos", "kp", "ki", "kd" };
+					bool valid = true;
+					cout << "Enter new gains (empty field and 'ENTER' keeps old value): " << endl;
+					for (size_t i = 0; (i < 4) && valid; i++)
+					{
+						cout << "\t" << names[i] << " (" << *gain[i] << "): ";
+						std::getline(cin, value_str);
+						if (!Process::isInputSigned(value_str)) valid = false;
+						else if (!value_str.empty()) *gain[i] = std::stod(value_str, 0);
+					}
+					if (!valid)
+						cout << "ERROR: Wrong Input (maybe alph), try again." << endl;
+					else
+					{
+						this->pidRegulator.setGains(static_cast<pidAxis>(axis), gains);
+						this->pidRegulator.printGains();
+					}
+				}
+			}
+			// Control thread rate, event mode and priority
+			else if ((input == this->valid_command_str[30]) && startedOrPaused)
+			{
+				float rate = this->scheduler.getRate();
+				bool eventDriven = this->scheduler.getEventDriven(), realtime = this->scheduler.getRealtime(), valid = true;
+				int core = -1;
+				cout << "Enter control thread settings (empty field and 'ENTER' keeps old value): " << endl;
+				cout << "\trate in Hz (" << rate << "): ";
+				std::getline(cin, value_str);
+				if (!Process::isInputDigit(value_str)) valid = false;
+				else if (!value_str.empty()) rate = std::stof(value_str, 0);
+				if (valid)
+				{
+					cout << "\trun on every new pose (" << ((eventDriven) ? "y" : "n") << "): ";
+					std::getline(cin, value_str);
+					if ((value_str == "y") || (value_str == "Y")) eventDriven = true;
+					else if ((value_str == "n") || (value_str == "N")) eventDriven = false;
+					else if (!value_str.empty()) valid = false;
+				}
+				if (valid)
+				{
+					cout << "\treal-time priority (" << ((realtime) ? "y" : "n") << "): ";
+					std::getline(cin, value_str);
+					if ((value_str == "y") || (value_str == "Y")) realtime = true;
+					else if ((value_str == "n") || (value_str == "N")) realtime = false;
+					else if (!value_str.empty()) valid = false;
+				}
+				if (valid && realtime)
+				{
+					cout << "\tcore to pin the thread to (empty for any): ";
+					std::getline(cin, value_str);
+					if (!Process::isInputDigit(value_str)) valid = false;
+					else if (!value_str.empty()) core = std::stoi(value_str, 0);
+				}
+				if (!valid)
+					cout << "ERROR: Wrong Input (maybe alph), try again." << endl;
+				else
+				{
+					this->scheduler.setRate(rate);
+					this->scheduler.setEventDriven(eventDriven);
+					if ((realtime != this->scheduler.getRealtime()) || realtime)
+						this->scheduler.setRealtime(realtime, core);
+					this->scheduler.printSchedulerState();
+				}
+			}
+			// Serial protocol binary/text
+			else if ((input == this->valid_command_str[31]) && startedOrPaused)
+			{
+				if (this->link.getBinary() == parameter::on) this->link.setBinary(parameter::off);
+				else this->link.setBinary(parameter::on);
+				cout << "\tSerial protocol: " << ((this->link.getBinary() == parameter::on) ? "binary frames (" : "text (")
+					<< ((this->link.getBinary() == parameter::on) ? DRACO_FRAME_SIZE : MAX_DATA_LENGTH) << " bytes per command)." << endl;
+			}
+			// Other drones
+			else if ((input == this->valid_command_str[32]) && startedOrPaused)
+			{
+				this->drones.printRegistryState();
+				cout << "Add (a) or remove (r) a drone (empty field and 'ENTER' leaves): ";
+				std::getline(cin, input);
+				if ((input == "a") || (input == "r"))
+				{
+					cout << "\tID of its marker: ";
+					std::getline(cin, value_str);
+					if (value_str.empty() || !Process::isInputDigit(value_str) || (value_str.find('.') != string::npos))
+						cout << "ERROR: Wrong Input (maybe alph), try again." << endl;
+					else if (input == "r")
+						cout << ((this->drones.remove(std::stoi(value_str))) ? "\tDrone stopped and removed." : "\tNo drone with this marker.") << endl;
+					else if (std::stoi(value_str) == this->droneMarker)
+						cout << "\tMarker " << this->droneMarker << " is the one of the main drone." << endl;
+					else
+					{
+						int id = std::stoi(value_str);
+						double setpoint[3] = { 0.0, 0.0, ControlMode::getSetPoint()[2] };
+						bool valid = true;
+						cout << "Enter its setpoint (empty field and 'ENTER' keeps 0, 0, " << setpoint[2] << "): " << endl;
+						for (size_t i = 0; (i < 3) && valid; i++)
+						{
+							cout << "\t" << ((i == 0) ? "x" : ((i == 1) ? "y" : "z")) << "-value: ";
+							std::getline(cin, value_str);
+							if (!Process::isInputDigit(value_str) || (value_str == ".")) valid = false;
+							else if (!value_str.empty()) setpoint[i] = std::stod(value_str, 0);
+						}
+#ifdef _WIN32
+						cout << "\tCOM port number of its arduino (empty field and 'ENTER' for none): COM";
+						std::getline(cin, value_str);
+						string port;
+						if (!Process::isInputDigit(value_str) || (value_str.find('.') != string::npos)) valid = false;
+						else if (!value_str.empty()) port = ((std::stoi(value_str, 0) > 9) ? "\\\\.\\COM" : "COM") + value_str;
+#else
+						cout << "\tDevice of its arduino (empty field and 'ENTER' for none): ";
+						std::getline(cin, value_str);
+						string port = value_str;
+#endif
+						SerialPort* arduino = nullptr;
+						if (valid && !port.empty())
+						{
+							arduino = new SerialPort(&port[0u]);
+							if (!arduino->isConnected())
+							{
+								cout << "\tArduino not found . . ." << endl;
+								delete arduino;
+								valid = false;
+							}
+							// The hello frame after the ready byte is left for the link of the drone
+							else if (!arduino->isReady())
+								cout << "\tNo ready byte from the arduino after " << ARDUINO_WAIT_TIME << " ms, its commands are sent anyway." << endl;
+						}
+						if (!valid)
+							cout << "ERROR: Wrong Input (maybe alph), try again." << endl;
+						else if (!this->drones.add(id, cv::Vec3d(setpoint[0], setpoint[1], setpoint[2]), arduino))
+							cout << "\tA drone already has this marker, or there are already " << MAX_DRONES << " drones." << endl;
+						else
+						{
+							// Every drone has to be searched on the whole frame
+							this->detector.setTracking(parameter::off);
+							cout << "\tDrone of marker " << id << " added" << ((arduino == nullptr) ? " without serial port" : "") << ", ROI tracking off." << endl;
+						}
+					}
+				}
+			}
+			// Latency compensation on/off
+			else if ((input == this->valid_command_str[33]) && startedOrPaused)
+			{
+				if (this->compensation == parameter::on) this->compensation = parameter::off;
+				else this->compensation = parameter::on;
+				cout << "\tLatency compensation: " << ((this->compensation == parameter::on) ? "on, expected transmit delay " : "off, transmit delay ")
+					<< std::chrono::duration<float, std::milli>(this->link.getTransmitDelay()).count() << " ms." << endl;
+			}
+			// Minimum pose rate of the frame governor
+			else if ((input == this->valid_command_str[34]) && startedOrPaused)
+			{
+				this->governor.printGovernorState();
+				cout << "Enter the minimum pose rate in Hz, 0 turns the governor off (empty field and 'ENTER' keeps "
+					<< ((this->governor.isEnabled()) ? this->governor.getRate() : 0.f) << "): ";
+				std::getline(cin, value_str);
+				if (!Process::isInputDigit(value_str))
+					cout << "ERROR: Wrong Input (maybe alph), try again." << endl;
+				else if (!value_str.empty())
+				{
+					float rate = std::stof(value_str, 0);
+					this->governor.setEnabled(rate > 0.f);
+					if (rate > 0.f) this->governor.setRate(rate);
+					cout << "\tFrame governor: " << ((this->governor.isEnabled()) ? "on, minimum pose rate " : "off, full quality from the next frame.");
+					if (this->governor.isEnabled()) cout << this->governor.getRate() << " Hz." << endl;
+					else cout << endl;
+				}
+			}
+			// Undistortion of the preview on/off
+			else if ((input == this->valid_command_str[35]) && startedOrPaused)
+			{
+				this->display.setUndistort(!this->display.getUndistort());
+				cout << "\tPreview undistortion: " << ((this->display.getUndistort()) ? "on" : "off") << "." << endl;
+			}
 			// When the input is a type 'x=1500', register the '=', the first letter (info on which input to step), and the value
 			else if ((input[1] == '=') && started)
 			{
 				string cmd;
 				cmd.insert(0, input, 2, input.size() - 2); // copy the rest of the input after '=' to cmd string
 				if (((input[0] == 'x') || (input[0] == 'z')) && (ControlMode::getOperatingMode() == mode::manual))
-					ControlMode::setControlValue("throttle", std::stoi(cmd));
+					ControlMode::setControlValue(controlChannel::throttleChannel, std::stoi(cmd));
 				else if ((input[0] == 'd') || (input[0] == 'a'))
-					ControlMode::setControlValue("roll", std::stoi(cmd));
+					ControlMode::setControlValue(controlChannel::rollChannel, std::stoi(cmd));
 				else if ((input[0] == 'w') || (input[0] == 's'))
-					ControlMode::setControlValue("pitch", std::stoi(cmd));
+					ControlMode::setControlValue(controlChannel::pitchChannel, std::stoi(cmd));
 				else if ((input[0] == 'e') || (input[0] == 'q'))
-					ControlMode::setControlValue("yaw", std::stoi(cmd));
+					ControlMode::setControlValue(controlChannel::yawChannel, std::stoi(cmd));
 
 				// in this case can newData be accessed and written by both this thread and the controller thread, we want to reserve this ressurse for the writing periode
 				// exclusive access to newData signaled by locking mu
 				Process::mu.lock();
-				this->newData = ControlMode::convertControlValuesToStr();
+				this->newData = ControlMode::getCommand();
+				// Sent now, the controller only posts it again if the link refused it
+				if (Process::sendCommand(this->newData) || !this->link.isOpen())
+					this->oldData = this->newData;
 				Process::mu.unlock();
-				cout << "\tData sent: " << this->newData << endl;
+				cout << "\tData sent: " << this->newData.text << endl;
 			}
 			// Commands to control drone manually with x/z, w/s, q/e and a/d
 			else if (started)
 			{
-				if ((input == "x") && (ControlMode::getOperatingMode() == mode::manual)) ControlMode::setControlValue("throttle", ControlMode::getControlValue("throttle") + 25);
-				else if ((input == "z") && (ControlMode::getOperatingMode() == mode::manual)) ControlMode::setControlValue("throttle", ControlMode::getControlValue("throttle") - 25);
-				else if (input == "d") ControlMode::setControlValue("roll", ControlMode::getControlValue("roll") + 25);
-				else if (input == "a") ControlMode::setControlValue("roll", ControlMode::getControlValue("roll") - 25);
-				else if (input == "w") ControlMode::setControlValue("pitch", ControlMode::getControlValue("pitch") + 25);
-				else if (input == "s") ControlMode::setControlValue("pitch", ControlMode::getControlValue("pitch") - 25);
-				else if (input == "e") ControlMode::setControlValue("yaw", ControlMode::getControlValue("yaw") + 25);
-				else if (input == "q") ControlMode::setControlValue("yaw", ControlMode::getControlValue("yaw") - 25);
+				if ((input == "x") && (ControlMode::getOperatingMode() == mode::manual)) ControlMode::setControlValue(controlChannel::throttleChannel, ControlMode::getControlValue(controlChannel::throttleChannel) + 25);
+				else if ((input == "z") && (ControlMode::getOperatingMode() == mode::manual)) ControlMode::setControlValue(controlChannel::throttleChannel, ControlMode::getControlValue(controlChannel::throttleChannel) - 25);
+				else if (input == "d") ControlMode::setControlValue(controlChannel::rollChannel, ControlMode::getControlValue(controlChannel::rollChannel) + 25);
+				else if (input == "a") ControlMode::setControlValue(controlChannel::rollChannel, ControlMode::getControlValue(controlChannel::rollChannel) - 25);
+				else if (input == "w") ControlMode::setControlValue(controlChannel::pitchChannel, ControlMode::getControlValue(controlChannel::pitchChannel) + 25);
+				else if (input == "s") ControlMode::setControlValue(controlChannel::pitchChannel, ControlMode::getControlValue(controlChannel::pitchChannel) - 25);
+				else if (input == "e") ControlMode::setControlValue(controlChannel::yawChannel, ControlMode::getControlValue(controlChannel::yawChannel) + 25);
+				else if (input == "q") ControlMode::setControlValue(controlChannel::yawChannel, ControlMode::getControlValue(controlChannel::yawChannel) - 25);
 				// reset throttle
-				else if (input == "c") ControlMode::resetControlValue("throttle");
+				else if (input == "c") ControlMode::resetControlValue(controlChannel::throttleChannel);
 				// reset values
 				else if (input == "r") ControlMode::resetAllControlValues();
 
 				// in this case can newData be accessed and written by both this thread and the controller thread, we want to reserve this ressurse for the writing periode
 				// exclusive access to newData signaled by locking mu
 				Process::mu.lock();
-				this->newData = ControlMode::convertControlValuesToStr();
+				this->newData = ControlMode::getCommand();
+				// Sent now, the controller only posts it again if the link refused it
+				if (Process::sendCommand(this->newData) || !this->link.isOpen())
+					this->oldData = this->newData;
 				Process::mu.unlock();
-				cout << "\tData sent: " << this->newData << endl;
+				cout << "\tData sent: " << this->newData.text << endl;
 			}
 			// Unvalid command while system is paused
 			else if (paused)
@@ -417,6 +757,13 @@ bool Process::isInputDigit(string input)
 			inputIsDigit = false;
 	return inputIsDigit;
 }
+bool Process::isInputSigned(string input)
+{
+	if (input.empty()) return true;
+	string magnitude = (input[0] == '-') ? input.substr(1) : input;
+	// At least one digit, "-" or "." alone is not a number
+	return Process::isInputDigit(magnitude) && (magnitude.find_first_of("0123456789") != string::npos);
+}
 bool Process::isCommandValid(string command)
 {
 	bool valid_cmd = false;
@@ -437,87 +784,157 @@ void Process::videoProcessing()
 	// Initialize all variables if user doesn't request to stop the program even before staring video
 	if (Process::getSystemState() == systemState::start)
 	{
-		this->loopTimer = clock(); // clock to measure loop time
-		std::fstream logFile; // File used to log input, pose, setpoint and error
-		std::fstream poseFile; // File use to communicate to matlab run, reg and pose
-		std::ifstream trpyFile;// file containing throttle, roll, pitch and yaw calculated in matlab
+		this->loopTimer = std::chrono::steady_clock::now(); // time to measure loop time
 
-		Process::writeToFile(poseFile, POSE_FILE, false, true, false, true, false, true);
+		Process::publishPose(this->poseFile);
 
-		cv::Ptr<cv::aruco::Dictionary> markerDictionary = cv::aruco::getPredefinedDictionary(cv::aruco::PREDEFINED_DICTIONARY_NAME::DICT_4X4_100);
 		vector<vector<cv::Point2f>> markerCorners, rejectedCandidates;
-		cv::aruco::DetectorParameters parameters;
 		vector<int> markerIds;
 
-		vector<cv::Vec3d> rotationVector, translationVector; // vectors for continuous detection of translation and rotation
+		vector<cv::Vec3d> rotationVector(1), translationVector(1); // vectors for continuous detection of translation and rotation
 
-		cv::Mat frame;
-		cv::VideoCapture vid(static_cast<int>(VideoParameters::getCurrentWebcam()));
-		cv::namedWindow(WEBCAM_WINDOW, CV_WINDOW_AUTOSIZE);
-		if (!vid.isOpened()) return;
+		CapturedFrame* captured; // newest frame handed over by the capture thread
+		FrameTimeline frameTimeline; // timestamps of the frame being processed, handed to the control thread with the pose
+		std::chrono::steady_clock::time_point processingStart; // time the processing of the frame started
+		bool cameraLost = false; // no webcam open, the control thread gets a pose without drone
+		// Start capture thread, frames are grabbed independently of the processing below
+		if (this->replay)
+		{
+			if (!this->grabber.startReplay(this->replayPath, this->replayRealtime))
+			{
+				cout << "ERROR: Could not open " << this->replayPath << "." << endl;
+				return;
+			}
+		}
+		// A webcam that doesn't open is reported as lost in the loop below, which still runs to stop the drone
+		else this->grabber.start(VideoParameters::getCurrentWebcam());
+		// Start display thread, the window is drawn and shown outside of this loop (headless replay: no window)
+		if (!this->replay) this->display.start();
+		// Start control thread, commands are computed and sent at its own rate from the newest pose
+		this->scheduler.start([this]() { Process::controlTick(); });
 
 		while (Process::getSystemState() != systemState::stop)
 		{
 			if (VideoParameters::getNewWebcam() != VideoParameters::getCurrentWebcam())
 			{
 				VideoParameters::setCurrentWebcam(VideoParameters::getNewWebcam());
-				vid.open(VideoParameters::getCurrentWebcam());
-				if (!vid.isOpened()) return;
+				cameraLost = false;
+				// The rig is registered relative to the current webcam
+				if (this->grabber.start(VideoParameters::getCurrentWebcam()) && this->rig.isRunning())
+					this->rig.start(VideoParameters::getCurrentWebcam());
 			}
 
-			// Go through video processing if system isn't paused (or stopped)
-			if (Process::getSystemState() == systemState::start)
+			// Go through video processing if system isn't paused (or stopped) and a new frame has been captured
+			// Always work on the newest frame, older frames have been overwritten by the capture thread
+			captured = nullptr;
+			if ((Process::getSystemState() == systemState::start) && ((captured = this->grabber.getLatestFrame()) != nullptr))
 			{
-				if (!vid.read(frame)) return;
-
-				//detectMarkers detects all possible markers
-				cv::aruco::detectMarkers(frame, markerDictionary, markerCorners, markerIds, cv::aruco::DetectorParameters::create(), rejectedCandidates);
-
-				// Start web cam if vid is on
-				if (VideoParameters::getParameter("video") == parameter::on)
+				cv::Mat& frame = captured->image;
+				processingStart = std::chrono::steady_clock::now();
+				if (this->processedFrames++ == 0) this->firstFrame = processingStart;
+				frameTimeline.capture = captured->timestamp;
+				// Undistortion lookups of the pose solvers, built again when the resolution of the webcam changes,
+				// the drones take the grid of the main solver instead of building theirs under the registry lock
+				if (frame.size() != this->frameSize)
 				{
-					if (!vid.isOpened()) vid.open(VideoParameters::getCurrentWebcam());
+					this->frameSize = frame.size();
+					this->markerPose.setImageSize(this->frameSize);
+					this->drones.setImageSize(this->frameSize);
+				}
 
-					// Draws all attempts to detect markers
-					if (VideoParameters::getParameter("markers") == parameter::on)
-						cv::aruco::drawDetectedMarkers(frame, rejectedCandidates);
+				// Detects all possible markers, only around the last drone position when tracking
+				this->detector.detect(frame, markerCorners, markerIds, rejectedCandidates);
+				frameTimeline.detection = std::chrono::steady_clock::now();
+				this->latency.record(latencyStage::detectionLatency, frameTimeline.detection - frameTimeline.capture);
 
-					// If detected marker is the drone marker
-					for (size_t i = 0; i < markerIds.size(); i++)
+				// Calculates rotation and translation vectors if dected marker is drone marker
+				this->droneDetected = false; // set bool for detected drone
+				for (size_t i = 0; i < markerIds.size(); i++)
+				{
+					if (markerIds.at(i) == this->droneMarker)
 					{
-						if (markerIds.at(i) == this->droneMarker)
+						// Calculates rotation and translation vectors of the drone marker only,
+						// a degenerate quad leaves the vectors of the previous frame and is no detection
+						this->droneDetected = this->markerPose.estimate(markerCorners.at(i), rotationVector.at(0), translationVector.at(0));
+						if (this->droneDetected)
 						{
-							this->markerTimer = clock(); // update timer
-							this->droneDetected = true; // set bool for detected drone
-							// Calculates rotation and translation vectors
-							cv::aruco::estimatePoseSingleMarkers(markerCorners, QR_CODE_SIZE, cameraMatrix, distanceCoeff, rotationVector, translationVector);
-
-							// Draws the axis on the marker
-							if (VideoParameters::getParameter("axes") == parameter::on)
-								cv::aruco::drawAxis(frame, this->cameraMatrix, this->distanceCoeff, rotationVector.at(0), translationVector.at(0), QR_CODE_SIZE);
+							this->markerTimer = std::chrono::steady_clock::now(); // update timer
+							this->poseTimestamp = captured->timestamp; // pose is as old as the frame
 						}
-						else this->droneDetected = false; // set bool for detected drone
+						break;
 					}
-					cv::imshow(WEBCAM_WINDOW, frame);
-					cv::waitKey(1);
 				}
-				// Keep estimating pose while vid id off
-				else
-				{
-					if (vid.isOpened()) cv::destroyWindow(WEBCAM_WINDOW);
 
-					// Calculates rotation and translation vectors if dected marker is drone marker
-					for (size_t i = 0; i < markerIds.size(); i++)
+				// Fuse with the poses seen by the other webcams, in the frame of the current webcam
+				if (this->rig.isRunning())
+				{
+					if (this->droneDetected)
+						this->rig.addReferenceObservation(rotationVector.at(0), translationVector.at(0), this->poseTimestamp);
+					cv::Vec3d fusedRotation, fusedTranslation;
+					std::chrono::steady_clock::time_point fusedTimestamp;
+					if (this->rig.getFusedPose(fusedRotation, fusedTranslation, fusedTimestamp)
+						&& (std::chrono::duration<float, std::milli>(captured->timestamp - fusedTimestamp).count() <= FUSION_WINDOW))
 					{
-						if (markerIds.at(i) == this->droneMarker)
-						{
-							this->markerTimer = clock(); // update timer
-							this->droneDetected = true; // set bool for detected drone
-							cv::aruco::estimatePoseSingleMarkers(markerCorners, QR_CODE_SIZE, this->cameraMatrix, this->distanceCoeff, rotationVector, translationVector);
-						}
-						else this->droneDetected = false; // set bool for detected drone
+						// The drone may be out of view of the current webcam only
+						this->markerTimer = std::chrono::steady_clock::now();
+						this->droneDetected = true;
+						this->poseTimestamp = fusedTimestamp;
+						rotationVector.at(0) = fusedRotation;
+						translationVector.at(0) = fusedTranslation;
 					}
 				}
+				// Markers of the other drones found by the same detection
+				this->drones.dispatch(markerIds, markerCorners, captured->timestamp);
+				frameTimeline.pose = std::chrono::steady_clock::now();
+				this->latency.record(latencyStage::poseLatency, frameTimeline.pose - frameTimeline.detection);
+
+				// Hand the pose to the control thread, and wake it if it runs on every new pose
+				Process::poseMu.lock();
+				this->latestPose.sequence++;
+				this->latestPose.detected = this->droneDetected;
+				this->latestPose.rvec = rotationVector.at(0);
+				this->latestPose.tvec = translationVector.at(0);
+				this->latestPose.timestamp = this->poseTimestamp;
+				this->latestPose.lastSeen = this->markerTimer;
+				this->latestPose.timeline = frameTimeline;
+				Process::poseMu.unlock();
+				this->scheduler.notify();
+
+				// Pose trace of the recording
+				if (this->replay)
+				{
+					ReplayPose pose = { captured->sequence, std::chrono::duration<double, std::milli>(processingStart - this->firstFrame).count(),
+						this->droneDetected, rotationVector.at(0), translationVector.at(0) };
+					this->replayTrace.push_back(pose);
+				}
+
+				// Hand a snapshot to the display thread if vid is on, at the preview rate only
+				this->display.setVisible(VideoParameters::getParameter("video") == parameter::on);
+				if ((VideoParameters::getParameter("video") == parameter::on) && this->display.isDue())
+					this->display.submit(frame, rejectedCandidates, (VideoParameters::getParameter("markers") == parameter::on) && this->governor.getOverlay(),
+						this->droneDetected, rotationVector.at(0), translationVector.at(0), (VideoParameters::getParameter("axes") == parameter::on) && this->governor.getOverlay());
+
+				// Processing time of the frame against the budget of the minimum pose rate
+				this->governor.update(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - processingStart).count(), this->detector, this->display);
+			}
+			else if (Process::getSystemState() == systemState::start)
+			{
+				// End of the recording
+				if (this->replay && !this->grabber.isRunning())
+					Process::setSystemState(systemState::stop);
+				// Webcam lost, or none could be opened: the control thread keeps running to stop the drone
+				else if (!this->grabber.isRunning())
+				{
+					if (!cameraLost)
+						cout << "ERROR: Webcam lost or could not be opened, an automatic flight is stopped after " << MARKER_TIMEOUT << " ms, type 'webcam' to switch." << endl;
+					cameraLost = true;
+					Process::loseCamera();
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+				// Next recorded frame is being decoded
+				else if (this->replay) std::this_thread::yield();
+				// No new frame since last iteration, give the capture thread some time
+				else std::this_thread::sleep_for(std::chrono::milliseconds(1));
 			}
 			// Update position variable
 			if ((translationVector != this->lastTranslationVector) & (translationVector.size() > 0))
@@ -526,21 +943,26 @@ void Process::videoProcessing()
 			if ((rotationVector != this->lastRotationVector) & (rotationVector.size() > 0))
 				this->lastRotationVector = rotationVector;
 
-			Process::controller(poseFile, logFile, trpyFile);
+			if (captured != nullptr) this->lastFrame = std::chrono::steady_clock::now();
 		}
+		// Stop control, capture and display threads
+		this->scheduler.stop();
+		this->rig.stop();
+		this->grabber.stop();
+		this->display.stop();
 		// close log file
-		logFile.close();
+		this->logFile.close();
 		// Procedure to send stop signal to matlab (run = 0 because system_state = stop)
-		Process::writeToFile(poseFile, POSE_FILE, false, true, false, true, false, true);
+		Process::publishPose(this->poseFile);
 
 		// Little routine to get rid of possible unwanted empty lines in the log file
 		std::ofstream tempFile;
 		string line;
-		logFile.open(LOG_FILE, std::ifstream::in);
+		this->logFile.open(LOG_FILE, std::ifstream::in);
 		tempFile.open("temp.csv", std::ofstream::out);
 		int* i = new int;
 		*i = 0;
-		while (std::getline(logFile, line))
+		while (std::getline(this->logFile, line))
 		{
 			if (!line.empty())
 			{
@@ -552,7 +974,7 @@ void Process::videoProcessing()
 		}
 		delete i;
 		tempFile.close();
-		logFile.close();
+		this->logFile.close();
 		remove(LOG_FILE);
 		rename("temp.csv", LOG_FILE);
 	}
@@ -565,70 +987,203 @@ void Process::controller(std::fstream& pose, std::fstream& logfile, std::ifstrea
 		// file containing log information on all registered position, orientation
 		logfile.open("drone_log.csv", std::ofstream::out);
 	}
-	// When system is paused, stop drone
-	if ((Process::getSystemState() == systemState::pause) && Process::isReady(this->dataTimer, DELAY_BETWEEN_DATA) && Process::isDroneFlying())
+	// When system is paused, stop drone (every tick of the control thread is a slot to send data)
+	if ((Process::getSystemState() == systemState::pause) && Process::isDroneFlying())
 	{
 		// Write data to be used in matlab
-		Process::writeToFile(pose, POSE_FILE, false, true, false, true, false, true);
-		this->arduino->writeSerialPort(&this->droneStop[0u], MAX_DATA_LENGTH);
-		this->dataTimer = clock();
+		Process::publishPose(pose);
+		Process::sendCommand(this->droneStop);
 	}
 	// When system is running
 	else if (Process::getSystemState() == systemState::start)
 	{
+		// Pose of every new frame goes to the controller at once through shared memory
+		if ((this->sharedMemory == parameter::on) && !this->timeline.decided)
+			Process::publishPose(pose);
+
 		// Assess if the video process detects the drone, and if we are in automatic mode
 		if (ControlMode::getOperatingMode() == mode::automatic)
 		{
+			// In-process PID or MPC, once per new pose
+			if (this->controlPose.detected && ((ControlMode::getOperatingReg() == regulator::pid) || (ControlMode::getOperatingReg() == regulator::mpc)))
+			{
+				int t, r, p, y;
+				bool updated = false;
+				if (!this->timeline.decided && (ControlMode::getOperatingReg() == regulator::pid))
+					updated = this->pidRegulator.update(this->controlPose.tvec, this->controlPose.rvec,
+						ControlMode::getSetPoint(), this->controlPose.timestamp, t, r, p, y);
+				else if (!this->timeline.decided)
+					updated = this->mpcRegulator.update(this->controlPose.tvec, this->controlPose.rvec,
+						ControlMode::getSetPoint(), this->controlPose.timestamp, t, r, p, y);
+				if (updated)
+				{
+					ControlMode::setAllControlValues(t, r, p, y);
+					Process::mu.lock();
+					this->newData = ControlMode::getCommand();
+					Process::mu.unlock();
+				}
+			}
+			// Read the newest command written by the controller in shared memory
+			else if (this->controlPose.detected && (this->sharedMemory == parameter::on))
+			{
+				draco_command_record command;
+				if (this->channel.readCommand(command))
+				{
+					Process::mu.lock();
+					this->newData.set(command.throttle, command.roll, command.pitch, command.yaw);
+					Process::mu.unlock();
+				}
+			}
 			// Read from trpy file to send t,r,p and y to drone
-			if (this->droneDetected)
+			else if (this->controlPose.detected)
 			{
 				// variable to read from csv file
 				string line;
 				trpyfile.open(TRPY_FILE, std::ifstream::in); // Open file and read content
 				while (std::getline(trpyfile, line))
 				{
+					// Lines that are not four integers are ignored
 					Process::mu.lock();
-					this->newData = line;
+					this->newData.parse(line.data(), line.size());
 					Process::mu.unlock();
 				}
 				trpyfile.close();
 			}
 			// Send stop command to drone if out of reach
-			else if (!this->droneDetected && Process::isReady(this->markerTimer, MARKER_TIMEOUT) && Process::isDroneFlying())
+			else if (!this->controlPose.detected && Process::isReady(this->controlPose.lastSeen, MARKER_TIMEOUT) && Process::isDroneFlying())
 			{
 				Process::mu.lock();
 				this->newData = ControlMode::droneStop;
 				Process::mu.unlock();
 			}
 		}
-		if (Process::isReady(this->dataTimer, DELAY_BETWEEN_DATA))
+		// First run of the controller since the newest frame
+		if (!this->timeline.decided)
 		{
-			// Write in the log file
-			if (this->logData)
-				Process::writeToFile(logfile, LOG_FILE, true, false, true, true, true, false);
+			this->timeline.decision = std::chrono::steady_clock::now();
+			this->latency.record(latencyStage::decisionLatency, this->timeline.decision - this->timeline.pose);
+			this->timeline.decided = true;
+		}
+		// Write in the log file
+		if (this->logData)
+			Process::writeToFile(logfile, LOG_FILE, true, false, true, true, true, true, true, false);
 
-			// Write data to be used in matlab
-			Process::writeToFile(pose, POSE_FILE, false, true, false, true, false, true);
-				
-			// Check for valid data to send
-			if (this->oldData != this->newData)
+		// Write data to be used in matlab (every frame is published through shared memory)
+		if (this->sharedMemory == parameter::off)
+			Process::publishPose(pose);
+
+		// Check for valid data to send, the console also posts and updates oldData under mu
+		Process::mu.lock();
+		if (this->oldData != this->newData)
+		{
+			// Post to the serial writer & update oldData variable, a command refused behind a pending stop is posted again next tick
+			// A regulated command carries the capture time of its frame, the writer measures the delay to the wire
+			bool regulated = (ControlMode::getOperatingMode() == mode::automatic) && this->controlPose.detected && !this->timeline.written;
+			bool queued = Process::sendCommand(this->newData, (regulated) ? this->timeline.capture : std::chrono::steady_clock::time_point());
+			// Only the first command computed from a frame counts for its latency
+			if (queued && !this->timeline.written)
 			{
-				// Send to arduino & update oldData variable
-				this->arduino->writeSerialPort(&this->newData[0u], MAX_DATA_LENGTH);
-				this->oldData = this->newData;
+				std::chrono::steady_clock::time_point written = std::chrono::steady_clock::now();
+				this->latency.record(latencyStage::writeLatency, written - this->timeline.decision);
+				this->latency.record(latencyStage::endToEndLatency, written - this->timeline.capture);
+				this->timeline.written = true;
 			}
-			// Reset data Timer clock (lets us know when we can send to arduino)
-			this->dataTimer = clock();
+			if (queued || !this->link.isOpen())
+				this->oldData = this->newData;
 		}
+		Process::mu.unlock();
+	}
+}
+void Process::controlTick()
+{
+	// Newest pose, the video thread only holds the lock while it copies one in
+	Process::poseMu.lock();
+	bool newPose = (this->latestPose.sequence != this->controlPose.sequence);
+	this->controlPose = this->latestPose;
+	Process::poseMu.unlock();
+	// Latency is measured on the frame the pose comes from
+	if (newPose)
+	{
+		this->timeline = this->controlPose.timeline;
+		this->timeline.decided = this->timeline.written = false;
+	}
+	// The Kalman filter is also the motion model of the latency compensation, it forgets its state while both are off
+	if ((ControlMode::getOperatingFilter() == filter::kalman) || (this->compensation == parameter::on))
+	{
+		Process::filterPose(newPose);
+		Process::compensatePose();
+	}
+	else if (this->poseFilter.isInitialized())
+		this->poseFilter.reset();
+	Process::controller(this->poseFile, this->logFile, this->trpyFile);
+	// Other drones, on the same tick, stopped while paused
+	this->drones.control(Process::getSystemState() == systemState::start, ControlMode::getOperatingMode() == mode::automatic);
+}
+void Process::loseCamera()
+{
+	this->droneDetected = false;
+	Process::poseMu.lock();
+	// A new pose only when the last one still had the drone, later calls only move its capture time
+	// forward so that the Kalman prediction from the last detection expires too
+	bool detected = this->latestPose.detected;
+	if (detected)
+	{
+		this->latestPose.sequence++;
+		this->latestPose.detected = false;
+		this->latestPose.lastSeen = this->markerTimer;
+	}
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	this->latestPose.timeline.capture = this->latestPose.timeline.detection = this->latestPose.timeline.pose = now;
+	Process::poseMu.unlock();
+	if (detected) this->scheduler.notify();
+}
+void Process::filterPose(bool newPose)
+{
+	if (newPose && this->controlPose.detected)
+		this->poseFilter.update(this->controlPose.rvec, this->controlPose.tvec, this->controlPose.timestamp);
+	if (ControlMode::getOperatingFilter() != filter::kalman) return;
+
+	// Pose at the capture time of the newest frame: filtered if the drone was detected (a rejected detection
+	// gives the prediction), predicted if it was missed and the last detection is recent enough
+	std::chrono::steady_clock::time_point frameTime = (this->controlPose.detected) ? this->controlPose.timestamp : this->controlPose.timeline.capture;
+	cv::Vec3d rvec, tvec;
+	if (this->poseFilter.predict(frameTime, rvec, tvec))
+	{
+		this->controlPose.predicted = !this->controlPose.detected;
+		this->controlPose.detected = true;
+		this->controlPose.rvec = rvec;
+		this->controlPose.tvec = tvec;
+		this->controlPose.timestamp = frameTime;
+		this->controlPose.velocity = this->poseFilter.getVelocity();
+		this->controlPose.deviation = this->poseFilter.getPositionDeviation();
 	}
 }
+void Process::compensatePose()
+{
+	if ((this->compensation == parameter::off) || !this->controlPose.detected) return;
+
+	// Time the command computed now leaves the serial port, the pose is moved by the motion predicted
+	// between its capture and then (translation in the camera frame, rotation in the marker frame)
+	std::chrono::steady_clock::time_point transmit = std::chrono::steady_clock::now() + this->link.getTransmitDelay();
+	cv::Vec3d rvecCapture, tvecCapture, rvecTransmit, tvecTransmit;
+	if (!this->poseFilter.predict(this->controlPose.timestamp, rvecCapture, tvecCapture)
+		|| !this->poseFilter.predict(transmit, rvecTransmit, tvecTransmit))
+		return;
+	cv::Matx33d motion = PoseFilter::vectorToRotation(rvecCapture).t() * PoseFilter::vectorToRotation(rvecTransmit);
+	this->controlPose.tvec += tvecTransmit - tvecCapture;
+	this->controlPose.rvec = MarkerPose::rotationToVector(PoseFilter::vectorToRotation(this->controlPose.rvec) * motion);
+	// The timestamp stays the capture time, the regulators derive velocities from it
+	this->controlPose.horizon = std::chrono::duration<float, std::milli>(transmit - this->controlPose.timestamp).count();
+}
 void Process::connectToArduino()
 {
 	cout << "Welcome to the PC-to-Arduino interface." << endl;
 	string port, input = "";
+	SerialPort* arduino; // Arduino port, handed to the serial writer once the drone is connected
 
 	while (true)
 	{
+#ifdef _WIN32
 		port = "COM";
 		cout << "\nEnter COM port number your arduino is connected to: " << port;
 		std::getline(cin, input);
@@ -641,68 +1196,118 @@ void Process::connectToArduino()
 
 			if (*int_input > 9) { port = "\\\\.\\COM"; } // If port number is bigger than 9, the backslashes have to be included
 			port += input; // gives COM<X> or COM<XX>
-
-			cout << "Waiting for connection with arduino . . ." << endl;
-			this->arduino = new SerialPort(&port[0u]); // creates connection with arduino at given port 
-			if (this->arduino->isConnected())
-			{
-				cout << "Arduino connected at port " << port << "." << endl;
-				break;
-			}
-			else
-			{
-				cout << "Arduino not found . . ." << endl;
-				delete this->arduino;
-			}
 			delete int_input; // free dynamic memory
 		}
 		else
+		{
 			cout << "ERROR: Input is not digit! COM port has to be a number" << endl;
+			continue;
+		}
+#else
+		vector<string> ports = SerialPort::listPorts();
+		cout << "\nSerial ports found:";
+		for (size_t i = 0; i < ports.size(); i++)
+			cout << " " << ports.at(i);
+		cout << ((ports.empty()) ? " none" : "") << endl;
+		cout << "Enter device your arduino is connected to (empty field and 'ENTER' takes the first one found): ";
+		std::getline(cin, input);
+		if (input.empty() && ports.empty()) continue;
+		port = (input.empty()) ? ports.at(0) : input; // /dev/ttyACM<X>, /dev/ttyUSB<X> or a pty
+#endif
+
+		cout << "Waiting for connection with arduino . . ." << endl;
+		arduino = new SerialPort(&port[0u]); // creates connection with arduino at given port 
+		if (arduino->isConnected())
+		{
+			cout << "Arduino connected at port " << port << "." << endl;
+			break;
+		}
+		else
+		{
+			cout << "Arduino not found . . ." << endl;
+			delete arduino;
+		}
 	}
 	cout << "Waiting for connection with drone . . ." << endl;
-	// Waiting for feedback from Arduino
-	while (true)
-	{
-		char feedback[MAX_DATA_LENGTH];
-		int bytes_in = this->arduino->readSerialPort(feedback, MAX_DATA_LENGTH);
-		if (bytes_in > 0) break;
-	}
+	// Ready byte of the Arduino, what it sends after it (the hello frame) is left for the link
+	while (!arduino->isReady())
+		arduino->waitReady(ARDUINO_WAIT_TIME);
+	// From now on the port belongs to the writer thread
+	this->link.open(arduino);
 	cout << "The drone should now be connected to arduino." << endl
 		<< "At any time, if the drone is disconnected, restart the drone, and press the restart button on arduino." << endl
 		<< "This will not affect the process. Wait for the drone to be connected before sending data through Serial port." << endl << endl;
 }
+void Process::publishPose(std::fstream& pose)
+{
+	if (this->sharedMemory == parameter::off)
+	{
+		Process::writeToFile(pose, POSE_FILE, false, true, false, true, false, false, false, true);
+		return;
+	}
+
+	draco_pose_record record;
+	record.detected = (this->controlPose.detected) ? 1 : 0;
+	record.horizon = static_cast<int64_t>(this->controlPose.horizon * 1000.f);
+	record.state = static_cast<int32_t>(Process::getSystemState());
+	record.mode = static_cast<int32_t>(ControlMode::getOperatingMode());
+	record.regulator = static_cast<int32_t>(ControlMode::getOperatingReg());
+	record.filter = static_cast<int32_t>(ControlMode::getOperatingFilter());
+	for (size_t i = 0; i < 3; i++)
+	{
+		record.translation[i] = this->controlPose.tvec[i];
+		record.rotation[i] = this->controlPose.rvec[i];
+		record.setpoint[i] = ControlMode::getSetPoint()[i];
+	}
+	// State changes without a frame carry the time of the last pose
+	this->channel.publishPose(record, (this->controlPose.timestamp.time_since_epoch().count() != 0) ? this->controlPose.timestamp : std::chrono::steady_clock::now());
+}
+bool Process::sendCommand(ControlCommand& command, std::chrono::steady_clock::time_point capture)
+{
+	return this->link.post(command, command == this->droneStop, capture);
+}
 bool Process::isDroneFlying()
 {
-	if (ControlMode::getControlValue("throttle") > 1000) return true;
+	if (ControlMode::getControlValue(controlChannel::throttleChannel) > 1000) return true;
 	else return false;
 }
 void Process::writeToFile(std::fstream& file, string fileName, bool pClock,
-	bool pState, bool pThrottle, bool pRPY, bool pEndl, bool openCloseFile)
+	bool pState, bool pThrottle, bool pRPY, bool pFilter, bool pLatency, bool pEndl, bool openCloseFile)
 {
 	if (openCloseFile)
 		file.open(fileName, std::fstream::out);
 	if (pClock)
-		file << ((float)(clock() - this->loopTimer)) / CLOCKS_PER_SEC << ",";
+		file << std::chrono::duration<float>(std::chrono::steady_clock::now() - this->loopTimer).count() << ",";
 	if (pState)
 		file << static_cast<int>(Process::getSystemState()) << "," << static_cast<int>(ControlMode::getOperatingMode()) << "," << static_cast<int>(ControlMode::getOperatingReg()) << "," << static_cast<int>(ControlMode::getOperatingFilter()) << ",";
 	if (pThrottle)
-		file << ControlMode::getControlValue("throttle") << ",";
+		file << ControlMode::getControlValue(controlChannel::throttleChannel) << ",";
 	if (pRPY)
-		file << ControlMode::getControlValue("roll") << "," << ControlMode::getControlValue("pitch") << "," << ControlMode::getControlValue("yaw") << ",";
+		file << ControlMode::getControlValue(controlChannel::rollChannel) << "," << ControlMode::getControlValue(controlChannel::pitchChannel) << "," << ControlMode::getControlValue(controlChannel::yawChannel) << ",";
 	for (size_t i = 0; i < 3; i++)
-		file << this->lastTranslationVector.at(0)[i] << ",";
+		file << this->controlPose.tvec[i] << ",";
 	for (size_t i = 0; i < 3; i++)
-		file << this->lastRotationVector.at(0)[i] << ",";
+		file << this->controlPose.rvec[i] << ",";
 	for (size_t i = 0; i < 3; i++)
 		file << ControlMode::getSetPoint()[i] << ((i == 2) ? "" : ",");
+	if (pFilter)
+	{
+		for (size_t i = 0; i < 3; i++)
+			file << "," << this->controlPose.velocity[i];
+		for (size_t i = 0; i < 3; i++)
+			file << "," << this->controlPose.deviation[i];
+		file << "," << ((this->controlPose.predicted) ? 1 : 0);
+	}
+	if (pLatency)
+		file << "," << this->controlPose.horizon << "," << this->link.getLastCaptureToWire();
 	if (pEndl)
 		file << endl;
 	if (openCloseFile)
 		file.close();
 }
-bool Process::isReady(clock_t currentTime, float delay)
+bool Process::isReady(std::chrono::steady_clock::time_point start, float delay)
 {
-	if (((float)(clock() - currentTime) * 1000.f / CLOCKS_PER_SEC) >= delay) return true;
+	if (std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() >= delay) return true;
 	else return false;
 }
 void Process::printSystemState()
@@ -719,6 +1324,19 @@ void Process::printSystemState()
 			cout << ((logData) ? "\tLogging data." : "\tNot logging data.") << endl;
 			ControlMode::printControlState();
 			VideoParameters::printVideoState();
+			this->grabber.printCaptureState();
+			this->detector.printDetectionState();
+			this->governor.printGovernorState();
+			this->rig.printRigState();
+			this->display.printDisplayState();
+			this->channel.printChannelState();
+			this->scheduler.printSchedulerState();
+			this->link.printLinkState();
+			cout << "\tLatency compensation: " << ((this->compensation == parameter::on) ? "on" : "off") << ", expected transmit delay "
+				<< std::chrono::duration<float, std::milli>(this->link.getTransmitDelay()).count() << " ms." << endl;
+			if ((ControlMode::getOperatingFilter() == filter::kalman) || (this->compensation == parameter::on))
+				this->poseFilter.printFilterState();
+			this->drones.printRegistryState();
 			break;
 		case systemState::stop:
 			cout << "\tStop sequence initiated...\n\n" << endl;
@@ -731,6 +1349,48 @@ void Process::printSystemState()
 	}
 	cout << "-----------------------------------------------------------------------------------------------------------------\n" << endl;
 }
+void Process::printReplaySummary()
+{
+	cout << endl << "-----------------------------------------------------------------------------------------------------------------" << endl
+		<< "Replay summary:" << endl;
+	if (this->processedFrames == 0)
+	{
+		cout << "	No frame processed." << endl;
+		return;
+	}
+
+	double duration = std::chrono::duration<double>(this->lastFrame - this->firstFrame).count();
+	size_t detections = 0;
+	for (size_t i = 0; i < this->replayTrace.size(); i++)
+		if (this->replayTrace.at(i).detected) detections++;
+	cout << "	- Frames processed: " << this->processedFrames << " (" << this->grabber.getOverwrittenFrames() << " skipped)" << endl;
+	cout << "	- Drone detected in: " << detections << " frames" << endl;
+	if (duration > 0)
+		cout << "	- Throughput: " << this->processedFrames / duration << " frames/s" << endl;
+
+	this->latency.printLatencyState();
+	this->detector.printDetectionState();
+
+	// Pose trace, one line per frame: sequence, time, detected, x, y, z, rx, ry, rz
+	std::ofstream trace(REPLAY_POSE_FILE);
+	if (trace)
+	{
+		trace << "frame,time_ms,detected,x,y,z,rx,ry,rz" << endl;
+		for (size_t i = 0; i < this->replayTrace.size(); i++)
+		{
+			const ReplayPose& pose = this->replayTrace.at(i);
+			trace << pose.sequence << "," << pose.time << "," << pose.detected;
+			for (size_t j = 0; j < 3; j++)
+				trace << "," << pose.tvec[j];
+			for (size_t j = 0; j < 3; j++)
+				trace << "," << pose.rvec[j];
+			trace << endl;
+		}
+		trace.close();
+		cout << "	- Pose trace written to " << REPLAY_POSE_FILE << endl;
+	}
+	cout << "-----------------------------------------------------------------------------------------------------------------" << endl << endl;
+}
 void Process::displayHelp()
 {
 	// This first little loop is just a trick to get a clean console output
@@ -755,6 +1415,9 @@ void Process::displayHelp()
 			else if (i == 6) cout << "Video commands:" << endl;
 			else if (i == 10) cout << "Pose commands:" << endl;
 			else if (i == 14) cout << "Control mode and regulator commands:" << endl;
+			else if (i == 21) cout << "Detection commands:" << endl;
+			else if (i == 27) cout << "Diagnostic commands:" << endl;
+			else if (i == 28) cout << "Controller commands:" << endl;
 			cout << "\t- '" << this->valid_command_str[i] << "' ";
 			for (size_t j = 0; j < (max_size - this->valid_command_str.at(i).size()); j++)
 			{
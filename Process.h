@@ -6,12 +6,51 @@
 #include "VideoParameters.h"
 #include "ControlMode.h"
 #include "SerialPort.h"
+#include "FrameGrabber.h"
+#include "MarkerDetector.h"
+#include "MarkerPose.h"
+#include "CameraRig.h"
+#include "ThreadPool.h"
+#include "FrameDisplay.h"
+#include "LatencyMonitor.h"
+#include "SharedChannel.h"
+#include "PidRegulator.h"
+#include "MpcRegulator.h"
+#include "ControlScheduler.h"
+#include "SerialLink.h"
+#include "DroneRegistry.h"
+#include "PoseFilter.h"
+#include "FrameGovernor.h"
 
-#define MARKER_TIMEOUT 2000.f
-#define DELAY_BETWEEN_DATA 30.f
+#define ROI_FALLBACK_DELAY (MARKER_TIMEOUT / 4.f) // search the full frame well before the marker times out
 #define POSE_FILE "pose.csv"
 #define LOG_FILE "drone_log"
 #define TRPY_FILE "trpy.csv"
+#define REPLAY_POSE_FILE "replay_pose.csv" // pose trace written at the end of a replay
+
+// Pose estimated on one replayed frame
+struct ReplayPose
+{
+	unsigned long long sequence; // number of the frame in the recording
+	double time; // ms since the first frame
+	bool detected; // true if the drone was detected
+	cv::Vec3d rvec, tvec; // pose of the drone
+};
+
+// Newest pose handed from the video thread to the control thread
+struct PoseSnapshot
+{
+	unsigned long long sequence; // number of the pose, incremented on every processed frame
+	bool detected; // true if the drone was detected, the pose is the last known one otherwise
+	cv::Vec3d rvec, tvec; // pose of the drone
+	std::chrono::steady_clock::time_point timestamp; // capture time of the frame the pose was estimated from
+	std::chrono::steady_clock::time_point lastSeen; // time the drone was last detected
+	FrameTimeline timeline; // capture, detection and pose timestamps of the frame
+	bool predicted; // true if the drone was missed and the pose is predicted by the Kalman filter
+	cv::Vec3d velocity; // velocity estimated by the Kalman filter, zero when the filter is off
+	cv::Vec3d deviation; // standard deviation of the position estimated by the Kalman filter
+	float horizon; // ms the pose was predicted forward to the transmit time of the command, 0 if not compensated
+};
 
 // Enumeration to store system states
 enum systemState
@@ -40,8 +79,20 @@ class Process : private ControlMode, private VideoParameters
 		Constructor of the class
 		*/
 		Process(mode, regulator, filter, cv::Vec3d, parameter, parameter, parameter);
+
+		/*
+		@video file, image sequence pattern or directory of images to replay
+		@true to replay at the recorded frame rate, false as fast as possible
+		Constructor of the class for headless replay: no console, no window and no serial port
+		The vision and control path runs on the recording, and a summary is printed at the end
+		*/
+		Process(string, bool);
 		// destructor of the class, Routine to free dynamic memory and close the program
 		~Process();
+		// Initialization shared by both constructors: defaults of the flags, poses and timers
+		void initialize();
+		// Hands the loaded calibration to the pose solvers and the preview
+		void shareCalibration();
 		// Starts and joins threads
 		void initiateThreads();
 		// Routine to read from console/terminal and update global variables
@@ -53,6 +104,12 @@ class Process : private ControlMode, private VideoParameters
 		*/
 		bool isInputDigit(string);
 
+		/*
+		@string input to verify if is a signed number
+		Returns true if input is empty or digits with an optional leading '-'
+		*/
+		bool isInputSigned(string);
+
 		/*
 		@command to assess
 		Returns true if command is valid
@@ -68,10 +125,39 @@ class Process : private ControlMode, private VideoParameters
 			Controller function
 		*/
 		void controller(std::fstream&, std::fstream&, std::ifstream&);
+		// Routine run by the control thread on every tick: takes the newest pose and runs the controller
+		void controlTick();
+		// Hands the control thread a pose without drone, stamped now, while there is no webcam, so that the last
+		// detection isn't flown on and the stop after MARKER_TIMEOUT fires. Called on every loop until a webcam opens
+		void loseCamera();
+
+		/*
+			@ true if the pose is new since the last tick
+			Updates the Kalman filter, and replaces the pose of the controller by the filtered one (predicted
+			through short dropouts) if the filter is kalman
+		*/
+		void filterPose(bool);
+		// Predicts the pose of the controller forward to the time the command computed from it reaches the wire,
+		// keeps its capture timestamp and records the prediction in its horizon
+		void compensatePose();
 		// Routine to open connection to arduino (and drone)
 		void connectToArduino();
 		// Returns true if last command gotten by the drone is > 1000
 		bool isDroneFlying();
+
+		/*
+			@ command to send
+			@ capture time of the frame the command was computed from, default for none
+			Posts a command to the serial writer, a command equal to the stop command preempts any other
+			Returns false if there is no serial port or a stop is waiting to be sent
+		*/
+		bool sendCommand(ControlCommand&, std::chrono::steady_clock::time_point = std::chrono::steady_clock::time_point());
+
+		/*
+			@ pose file to write to when the shared memory channel is off
+			Hands the pose and the system state to the external controller
+		*/
+		void publishPose(std::fstream&);
 		/*
 			@ file to write to
 			@ name of file
@@ -80,17 +166,19 @@ class Process : private ControlMode, private VideoParameters
 				@ state (run, mode, reg & filt)
 				@ throttle
 				@ RPY
+				@ velocity and position deviation of the Kalman filter
+				@ compensation horizon and measured capture to wire delay
 				@ endl
 				@ open and close file
 			Writes process variables to a file
 		*/
-		void writeToFile(std::fstream&, string, bool, bool, bool, bool, bool, bool);
+		void writeToFile(std::fstream&, string, bool, bool, bool, bool, bool, bool, bool, bool);
 		/*
-			@ clock time
+			@ start time
 			@ delay in ms
-			Returns true if clock time is bigger or equal delay time
+			Returns true if at least delay ms have passed since start time
 		*/
-		bool isReady(clock_t, float);
+		bool isReady(std::chrono::steady_clock::time_point, float);
 		// Routine to print system state
 		void printSystemState();
 		// Returns system state	
@@ -102,23 +190,61 @@ class Process : private ControlMode, private VideoParameters
 		void setSystemState(systemState state) { this->system_state = state;  }
 		// Displays help message.
 		void displayHelp();
+		// Prints throughput, latency per stage and writes the pose trace after a replay
+		void printReplaySummary();
 
 	private:
 		systemState system_state; // Variable to store current system state
 
-		SerialPort* arduino; // Arduino port to communicate with
+		SerialLink link; // Writer thread owning the Arduino port, always sends the newest command
+		DroneRegistry drones; // Other drones by marker ID, each with its own pose, regulator and serial link
+		FrameGrabber grabber; // Capture thread delivering the newest webcam frame
+		ThreadPool pool; // Threads shared by the parallel stages of the processing, one per core
+		MarkerDetector detector; // ArUco detection, full frame or tracking the drone marker
+		MarkerPose markerPose; // Pose solver for the drone marker
+		CameraRig rig; // Other webcams, their poses are fused with the current webcam
+		FrameDisplay display; // Display thread drawing the webcam window
+		FrameGovernor governor; // Steps detection and preview quality down under load to hold the minimum pose rate
+		SharedChannel channel; // Shared memory with the external controller, replaces POSE_FILE and TRPY_FILE when open
+		parameter sharedMemory; // Controller channel through shared memory (on) or files (off)
+		PidRegulator pidRegulator; // In-process regulator used when the regulator is PID
+		MpcRegulator mpcRegulator; // In-process regulator used when the regulator is MPC
+		PoseFilter poseFilter; // Kalman filter of the pose of the drone, only used by the control thread
+		parameter compensation; // Latency compensation of the pose (on) or pose as old as its frame (off)
+		ControlScheduler scheduler; // Control thread, runs the controller at a fixed rate independently of the video
 		std::mutex mu; // Variable to reserve the access of ressources between threads
 		
 		// Position/orientation var
 		vector<cv::Vec3d> lastRotationVector, lastTranslationVector; // vectors to store last valid translation and rotation		
+		std::chrono::steady_clock::time_point poseTimestamp; // capture time of the frame the last pose was estimated from
+		cv::Size frameSize; // resolution the undistortion lookups are built for
+
+		// Pose exchange between the video and control threads
+		std::mutex poseMu; // protects latestPose
+		PoseSnapshot latestPose; // written by the video thread on every processed frame
+		PoseSnapshot controlPose; // copy of latestPose the control thread works on during a tick
+		std::fstream poseFile, logFile; // pose and log files, written by the control thread
+		std::ifstream trpyFile; // throttle, roll, pitch and yaw calculated by the external controller
 
 		vector<string> valid_command_str; // String that contains all valid commands
 		vector<string> command_description; // String that contains description of the commands
 		
 		bool logData; // Bool, true to register data
 
-		clock_t markerTimer; // Clock to register time when marker detected
-		clock_t dataTimer; // Clock to store time between sent data to arduino
-		clock_t loopTimer; // Clock to time videoProcessing loop and write time to log file
+		std::chrono::steady_clock::time_point markerTimer; // Time when marker detected
+		std::chrono::steady_clock::time_point loopTimer; // Start of videoProcessing loop, to write time to log file
+
+		// Latency from capture to serial write
+		LatencyMonitor latency; // Histograms per stage, read by the console thread
+		FrameTimeline timeline; // Timestamps of the frame the control thread works on
+
+		// Replay
+		bool replay; // true when frames come from a recording instead of a webcam
+		string replayPath; // recording to replay
+		bool replayRealtime; // true to replay at the recorded frame rate
+		vector<ReplayPose> replayTrace; // pose estimated on each replayed frame
+
+		unsigned long long processedFrames; // frames that went through detection
+		std::chrono::steady_clock::time_point firstFrame, lastFrame; // processing time of the first and last frames
 };
 #endif // PROCESS_H
\ No newline at end of file
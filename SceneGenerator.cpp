@@ -0,0 +1,229 @@
+#include "stdafx.h"
+#include "SceneGenerator.h"
+
+// Scene generator
+SceneGenerator::SceneGenerator(int distractorCount, unsigned int seed) : VideoParameters(parameter::off, parameter::off, parameter::off)
+{
+	// Ideal camera if no calibration is available
+	VideoParameters::loadCameraCalibrationOrIdeal();
+	// Webcam resolutions are multiples of 16, the principal point is close to the center
+	this->size = cv::Size(16 * static_cast<int>(std::lround(this->cameraMatrix.at<double>(0, 2) / 8.0)),
+		16 * static_cast<int>(std::lround(this->cameraMatrix.at<double>(1, 2) / 8.0)));
+	this->dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::PREDEFINED_DICTIONARY_NAME::DICT_4X4_100);
+	std::mt19937 generator(seed);
+	cv::theRNG().state = seed;
+
+	// Mid-grey background with random rectangles, the detector has to reject them
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	cv::Size big(this->size.width * SCENE_SUPERSAMPLING, this->size.height * SCENE_SUPERSAMPLING);
+	this->background.create(big, CV_8UC3);
+	this->background.setTo(cv::Scalar::all(140));
+	for (int i = 0; i < SCENE_CLUTTER; i++)
+	{
+		cv::Rect box(static_cast<int>(big.width * uniform(generator)), static_cast<int>(big.height * uniform(generator)),
+			static_cast<int>(big.width * (0.02 + 0.15 * uniform(generator))), static_cast<int>(big.height * (0.02 + 0.15 * uniform(generator))));
+		double grey = 40 + 180 * uniform(generator);
+		cv::rectangle(this->background, box & cv::Rect(0, 0, big.width, big.height), cv::Scalar::all(grey), -1);
+	}
+
+	// Distractors behind the drone and to the sides, out of the way of the trajectories
+	for (int i = 0; i < distractorCount; i++)
+	{
+		double side = (i % 2 == 0) ? -1.0 : 1.0;
+		cv::Vec3d tvec(side * (0.45 + 0.25 * uniform(generator)), 0.5 * (uniform(generator) - 0.5), 1.6 + 1.0 * uniform(generator));
+		cv::Vec3d rvec(CV_PI + 0.6 * (uniform(generator) - 0.5), 0.6 * (uniform(generator) - 0.5), 0.0);
+		this->distractors.push_back(std::make_pair(10 + i, std::make_pair(rvec, tvec)));
+	}
+
+	// Inverse distortion map, remap() needs the undistorted position of every distorted pixel
+	this->distorted = cv::countNonZero(this->distanceCoeff) > 0;
+	if (this->distorted)
+	{
+		vector<cv::Point2f> pixels, undistorted;
+		for (int y = 0; y < this->size.height; y++)
+			for (int x = 0; x < this->size.width; x++)
+				pixels.push_back(cv::Point2f(static_cast<float>(x), static_cast<float>(y)));
+		cv::undistortPoints(pixels, undistorted, this->cameraMatrix, this->distanceCoeff, cv::noArray(), this->cameraMatrix);
+		this->mapX.create(this->size, CV_32FC1);
+		this->mapY.create(this->size, CV_32FC1);
+		for (int y = 0; y < this->size.height; y++)
+			for (int x = 0; x < this->size.width; x++)
+			{
+				this->mapX.at<float>(y, x) = undistorted.at(y * this->size.width + x).x;
+				this->mapY.at<float>(y, x) = undistorted.at(y * this->size.width + x).y;
+			}
+	}
+
+	SceneConditions clean = { 0.0, 0.0, 1.0, 0.0, 0.0 };
+	SceneGenerator::setConditions(clean);
+}
+void SceneGenerator::setConditions(SceneConditions conditions)
+{
+	this->conditions = conditions;
+	this->shading.create(this->size, CV_8UC3);
+	for (int x = 0; x < this->size.width; x++)
+		this->shading.col(x).setTo(cv::Scalar::all(255.0 * (1.0 - conditions.gradient * x / this->size.width)));
+}
+std::pair<cv::Vec3d, cv::Vec3d> SceneGenerator::trajectoryPose(sceneTrajectory trajectory, double t)
+{
+	cv::Vec3d tvec, tilt;
+	double yaw = 0.0;
+	switch (trajectory)
+	{
+		case sceneTrajectory::hover:
+			tvec = cv::Vec3d(0.05 * std::sin(0.7 * t), 0.03 * std::sin(1.1 * t), 1.2 + 0.05 * std::sin(0.5 * t));
+			tilt = cv::Vec3d(0.1 * std::sin(0.9 * t), 0.1 * std::cos(0.8 * t), 0.0);
+			yaw = 0.2 * std::sin(0.3 * t);
+			break;
+		case sceneTrajectory::orbit:
+			tvec = cv::Vec3d(0.35 * std::cos(0.6 * t), 0.2 * std::sin(0.6 * t), 1.3 + 0.3 * std::sin(0.3 * t));
+			tilt = cv::Vec3d(0.3 * std::sin(0.9 * t), 0.3 * std::cos(0.7 * t), 0.0);
+			yaw = 0.6 * t;
+			break;
+		case sceneTrajectory::approach:
+		default:
+			tvec = cv::Vec3d(0.1 * std::sin(0.8 * t), 0.05 * std::sin(0.6 * t), 2.5 - 2.0 * (0.5 - 0.5 * std::cos(0.4 * t)));
+			tilt = cv::Vec3d(0.5 * std::sin(0.5 * t), 0.2 * std::sin(0.9 * t), 0.0);
+			yaw = 0.2 * t;
+			break;
+	}
+
+	// Marker facing the camera (rotation of pi around x), tilted, then turned around its own z axis
+	cv::Matx33d tilted, turned;
+	cv::Rodrigues(cv::Vec3d(CV_PI, 0, 0) + tilt, tilted);
+	cv::Rodrigues(cv::Vec3d(0, 0, yaw), turned);
+	cv::Vec3d rvec;
+	cv::Rodrigues(tilted * turned, rvec);
+	return std::make_pair(rvec, tvec);
+}
+void SceneGenerator::render(cv::Vec3d rvec, cv::Vec3d tvec, cv::Mat& frame)
+{
+	this->background.copyTo(this->canvas);
+
+	// Painter's algorithm, farthest marker first
+	vector<std::pair<double, int>> order;
+	for (size_t i = 0; i < this->distractors.size(); i++)
+		order.push_back(std::make_pair(this->distractors.at(i).second.second[2], static_cast<int>(i)));
+	order.push_back(std::make_pair(tvec[2], -1));
+	std::sort(order.rbegin(), order.rend());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		if (order.at(i).second < 0)
+			SceneGenerator::drawMarker(this->droneMarker, rvec, tvec);
+		else
+		{
+			const std::pair<int, std::pair<cv::Vec3d, cv::Vec3d>>& distractor = this->distractors.at(order.at(i).second);
+			SceneGenerator::drawMarker(distractor.first, distractor.second.first, distractor.second.second);
+		}
+	}
+
+	// Area average to the frame resolution, then lens, blur, lighting and sensor noise
+	cv::resize(this->canvas, frame, this->size, 0, 0, cv::INTER_AREA);
+	if (this->distorted)
+	{
+		cv::remap(frame, this->noisy, this->mapX, this->mapY, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+		this->noisy.copyTo(frame);
+	}
+	if (this->conditions.blur > 0)
+		cv::GaussianBlur(frame, frame, cv::Size(0, 0), this->conditions.blur);
+	if ((this->conditions.gain != 1.0) || (this->conditions.offset != 0.0))
+		frame.convertTo(frame, -1, this->conditions.gain, this->conditions.offset);
+	if (this->conditions.gradient > 0)
+		cv::multiply(frame, this->shading, frame, 1.0 / 255.0);
+	if (this->conditions.noise > 0)
+	{
+		frame.convertTo(this->noisy, CV_16SC3);
+		this->noise.create(this->size, CV_16SC3);
+		cv::randn(this->noise, cv::Scalar::all(0), cv::Scalar::all(this->conditions.noise));
+		cv::add(this->noisy, this->noise, this->noisy);
+		this->noisy.convertTo(frame, CV_8UC3);
+	}
+}
+int SceneGenerator::writeSequence(string prefix, sceneTrajectory trajectory, int frames)
+{
+	std::ofstream truth(prefix + SCENE_TRUTH_FILE);
+	if (!truth) return 0;
+	truth << "frame,time_ms,x,y,z,rx,ry,rz" << endl;
+	truth.precision(10);
+
+	cv::Mat frame;
+	char name[16];
+	int written = 0;
+	for (int f = 1; f <= frames; f++)
+	{
+		double time = (f - 1) / SCENE_FPS;
+		std::pair<cv::Vec3d, cv::Vec3d> pose = SceneGenerator::trajectoryPose(trajectory, time);
+		SceneGenerator::render(pose.first, pose.second, frame);
+		std::snprintf(name, sizeof(name), "_%04d.png", f);
+		if (!cv::imwrite(prefix + name, frame)) break;
+
+		// Same frame numbers as the replay pose trace
+		truth << f << "," << 1000.0 * time;
+		for (size_t j = 0; j < 3; j++)
+			truth << "," << pose.second[j];
+		for (size_t j = 0; j < 3; j++)
+			truth << "," << pose.first[j];
+		truth << endl;
+		written++;
+	}
+	truth.close();
+	return written;
+}
+void SceneGenerator::drawMarker(int id, cv::Vec3d rvec, cv::Vec3d tvec)
+{
+	if (tvec[2] <= 0.0) return;
+
+	// Marker image about the size it will have on the canvas, bilinear sampling then doesn't alias
+	double projected = SCENE_SUPERSAMPLING * this->cameraMatrix.at<double>(0, 0) * QR_CODE_SIZE / tvec[2];
+	int side = 32;
+	while ((side < 1024) && (side < projected)) side *= 2;
+	std::pair<int, int> key(id, side);
+	if (this->textures.find(key) == this->textures.end())
+	{
+		cv::Mat marker, texture;
+		cv::aruco::drawMarker(this->dictionary, id, side, marker, 1);
+		cv::copyMakeBorder(marker, marker, side / 6, side / 6, side / 6, side / 6, cv::BORDER_CONSTANT, cv::Scalar::all(255));
+		cv::cvtColor(marker, texture, cv::COLOR_GRAY2BGR);
+		this->textures[key] = texture;
+	}
+	const cv::Mat& texture = this->textures[key];
+	int margin = side / 6;
+
+	// Texture pixel centers to the marker plane, corner 0 of the marker at (-L/2, L/2)
+	double length = QR_CODE_SIZE;
+	cv::Matx33d textureToModel(length / side, 0.0, -length / 2.0 - length * (margin - 0.5) / side,
+		0.0, -length / side, length / 2.0 + length * (margin - 0.5) / side,
+		0.0, 0.0, 1.0);
+	// Marker plane to the image, then to the supersampled canvas (pixel centers)
+	cv::Matx33d R;
+	cv::Rodrigues(rvec, R);
+	cv::Matx33d K(this->cameraMatrix.at<double>(0, 0), 0.0, this->cameraMatrix.at<double>(0, 2),
+		0.0, this->cameraMatrix.at<double>(1, 1), this->cameraMatrix.at<double>(1, 2),
+		0.0, 0.0, 1.0);
+	cv::Matx33d modelToImage = K * cv::Matx33d(R(0, 0), R(0, 1), tvec[0], R(1, 0), R(1, 1), tvec[1], R(2, 0), R(2, 1), tvec[2]);
+	double s = SCENE_SUPERSAMPLING, c = (SCENE_SUPERSAMPLING - 1) / 2.0;
+	cv::Matx33d imageToCanvas(s, 0.0, c, 0.0, s, c, 0.0, 0.0, 1.0);
+	cv::Matx33d textureToCanvas = imageToCanvas * modelToImage * textureToModel;
+
+	// Only warp the bounding box of the marker
+	float last = static_cast<float>(texture.cols - 1);
+	cv::Vec3d outline[4] = { cv::Vec3d(0, 0, 1), cv::Vec3d(last, 0, 1), cv::Vec3d(last, last, 1), cv::Vec3d(0, last, 1) };
+	double minX = this->canvas.cols, minY = this->canvas.rows, maxX = 0, maxY = 0;
+	for (size_t i = 0; i < 4; i++)
+	{
+		cv::Vec3d p = textureToCanvas * outline[i];
+		if (p[2] <= 0.0) return;
+		minX = std::min(minX, p[0] / p[2]);
+		maxX = std::max(maxX, p[0] / p[2]);
+		minY = std::min(minY, p[1] / p[2]);
+		maxY = std::max(maxY, p[1] / p[2]);
+	}
+	cv::Rect box(static_cast<int>(std::floor(minX)) - 1, static_cast<int>(std::floor(minY)) - 1,
+		static_cast<int>(std::ceil(maxX - minX)) + 3, static_cast<int>(std::ceil(maxY - minY)) + 3);
+	box &= cv::Rect(0, 0, this->canvas.cols, this->canvas.rows);
+	if (box.area() <= 0) return;
+
+	cv::Matx33d canvasToBox(1.0, 0.0, -box.x, 0.0, 1.0, -box.y, 0.0, 0.0, 1.0);
+	cv::Mat roi = this->canvas(box);
+	cv::warpPerspective(texture, roi, cv::Mat(canvasToBox * textureToCanvas), box.size(), cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#ifndef SCENEGENERATOR_H
+#define SCENEGENERATOR_H
+
+#include "VideoParameters.h"
+
+#define SCENE_SUPERSAMPLING 4 // scenes are drawn at this many times the resolution, then area averaged
+#define SCENE_FPS 30.0 // frame rate of the generated sequences
+#define SCENE_CLUTTER 40 // number of random rectangles on the background
+#define SCENE_TRUTH_FILE "_truth.csv" // suffix of the ground truth file of a sequence
+
+// Enumeration to store the scripted drone trajectories
+enum sceneTrajectory
+{
+	hover = 0, // small oscillations around a point 1.2 m in front of the camera
+	orbit = 1, // ellipse across the field of view while turning around its z axis
+	approach = 2 // from 2.5 m to 0.5 m and back, tilting more and more
+};
+
+// Image degradations applied to the rendered scene
+struct SceneConditions
+{
+	double blur; // sigma of the gaussian blur in pixels, 0 for none
+	double noise; // standard deviation of the sensor noise in grey levels, 0 for none
+	double gain; // global lighting, 1 for none
+	double offset; // added to every grey level after the gain
+	double gradient; // lighting falls by this fraction from the left to the right of the image, 0 for none
+};
+
+/*
+Class to render synthetic frames of the drone marker with known poses
+Markers are drawn with cv::aruco::drawMarker, warped with the homography of their pose at SCENE_SUPERSAMPLING
+times the resolution and area averaged down, so that edges land within 0.01 px of their projection.
+The lens distortion of the calibration is applied to the whole image afterwards
+Intrinsics come from CALIBDATA_FILE, or an ideal 640x480 camera if there is none
+*/
+class SceneGenerator : private VideoParameters
+{
+	public:
+		/*
+		@number of distractor markers
+		@seed of the random background, distractors and noise
+		Constructor of the class, the image size follows from the principal point of the calibration
+		*/
+		SceneGenerator(int, unsigned int);
+
+		/*
+		@degradations to apply
+		Sets blur, noise and lighting of the next frames
+		*/
+		void setConditions(SceneConditions);
+
+		/*
+		@trajectory
+		@time in s
+		Returns the rotation and translation vectors of the drone marker at a time of the trajectory
+		*/
+		std::pair<cv::Vec3d, cv::Vec3d> trajectoryPose(sceneTrajectory, double);
+
+		/*
+		@rotation vector of the drone marker
+		@translation vector of the drone marker
+		@frame out, 8 bit BGR
+		Renders the drone marker and the distractors
+		*/
+		void render(cv::Vec3d, cv::Vec3d, cv::Mat&);
+
+		/*
+		@prefix of the files
+		@trajectory
+		@number of frames
+		Writes <prefix>_0001.png... and <prefix>_truth.csv with the pose of every frame, returns the number of frames written
+		The frames can be replayed with: DRACO replay <prefix>_%04d.png
+		*/
+		int writeSequence(string, sceneTrajectory, int);
+		cv::Size getSize() { return this->size; } // Returns size of the frames
+		cv::Mat getCameraMatrix() { return this->cameraMatrix; } // Returns camera matrix used to render
+		cv::Mat getDistanceCoeff() { return this->distanceCoeff; } // Returns distortion coefficients used to render
+
+	private:
+		/*
+		@marker ID
+		@rotation vector
+		@translation vector
+		Warps a marker and its white margin on the supersampled canvas
+		*/
+		void drawMarker(int, cv::Vec3d, cv::Vec3d);
+
+		cv::Size size; // size of the frames
+		cv::Ptr<cv::aruco::Dictionary> dictionary; // dictionary of the drone marker
+		vector<std::pair<int, std::pair<cv::Vec3d, cv::Vec3d>>> distractors; // ID and pose of the other markers
+		SceneConditions conditions; // degradations applied to the frames
+		std::map<std::pair<int, int>, cv::Mat> textures; // marker images per ID and side, drawn once
+
+		cv::Mat background; // supersampled background with clutter
+		cv::Mat canvas; // supersampled scene
+		cv::Mat mapX, mapY; // undistorted position of every pixel of the distorted frame, empty without distortion
+		cv::Mat shading; // lighting gradient, 255 for full light
+		cv::Mat noisy, noise; // 16 bit frame and noise
+		bool distorted; // true if the calibration has distortion
+};
+
+#endif // SCENEGENERATOR_H
@@ -0,0 +1,339 @@
+#include "stdafx.h"
+#include "SerialLink.h"
+
+// Layout of the mailbox word
+#define MAILBOX_CHANNEL_BITS 10 // bits per channel, values MIN_CONTROL_VALUE to MIN_CONTROL_VALUE + 1023
+#define MAILBOX_VALID (1ull << 40) // set on a pending command
+#define MAILBOX_FAILSAFE (1ull << 41) // set on a stop command
+#define MAILBOX_TIME_SHIFT 42 // post time in us, on the remaining bits
+#define MAILBOX_TIME_MASK ((1ull << (64 - MAILBOX_TIME_SHIFT)) - 1)
+#define ORIGIN_TIME_MASK ((1ull << MAILBOX_TIME_SHIFT) - 1) // capture time in us, below the post time of the origin word
+
+/*
+Returns the time in us on the steady clock, truncated to the bits of the mailbox
+*/
+static uint64_t mailboxTime()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()) & MAILBOX_TIME_MASK;
+}
+
+// Serial link
+SerialLink::SerialLink()
+{
+	this->port = nullptr;
+	this->running = false;
+	this->mailbox = 0;
+	// The deployed sketch may only parse text, frames wait for its hello
+	this->binary = parameter::off;
+	this->negotiated = false;
+	this->origin = 0;
+	this->transmitDelay = this->lastCaptureToWire = 0;
+	this->frameSequence = 0;
+	this->posted = this->sent = this->superseded = this->rejected = this->failed = this->failsafes = 0;
+	this->head = this->tail = 0;
+	for (size_t i = 0; i < SERIAL_ACK_WINDOW; i++)
+		this->sentFrames[i] = 0;
+	this->acked = this->telemetryReceived = false;
+	this->lastAck = this->lastTelemetry = 0;
+	this->framesSent = this->acks = this->unmatchedAcks = this->lostAcks = this->radioFailures = this->radioRetries = 0;
+	this->telemetryFrames = this->lostTelemetry = this->rejectedBytes = 0;
+	this->battery = this->linkQuality = this->radioLost = 0;
+}
+SerialLink::~SerialLink()
+{
+	SerialLink::close();
+}
+void SerialLink::open(SerialPort* port)
+{
+	SerialLink::close();
+	this->port = port;
+	this->mailbox = 0;
+	this->running = true;
+	this->head = this->tail = 0;
+	this->acked = this->telemetryReceived = false;
+	this->negotiated = false;
+	this->thread = std::thread(&SerialLink::writerLoop, this);
+	this->reader = std::thread(&SerialLink::readerLoop, this);
+}
+void SerialLink::close()
+{
+	if (this->port == nullptr) return;
+	{
+		std::lock_guard<std::mutex> lock(this->mu);
+		this->running = false;
+	}
+	this->wake.notify_one();
+	if (this->thread.joinable()) this->thread.join();
+	if (this->reader.joinable()) this->reader.join();
+	delete this->port;
+	this->port = nullptr;
+}
+bool SerialLink::post(const ControlCommand& command, bool failsafe, std::chrono::steady_clock::time_point capture)
+{
+	if (!this->running.load()) return false;
+	uint64_t word = SerialLink::pack(command, failsafe);
+	// Capture time tagged with the post time of the word, the writer only uses it for this word
+	if (capture.time_since_epoch().count() != 0)
+	{
+		uint64_t us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(capture.time_since_epoch()).count());
+		this->origin = ((word >> MAILBOX_TIME_SHIFT) << MAILBOX_TIME_SHIFT) | (us & ORIGIN_TIME_MASK);
+	}
+	uint64_t pending = this->mailbox.load();
+	do
+	{
+		// A stop waiting to be sent is never replaced by a normal command
+		if (!failsafe && (pending & MAILBOX_FAILSAFE))
+		{
+			this->rejected++;
+			return false;
+		}
+	} while (!this->mailbox.compare_exchange_weak(pending, word));
+	if (pending & MAILBOX_VALID) this->superseded++;
+	this->posted++;
+	// The writer either hasn't checked the mailbox yet or is already asleep, the wake up can't be missed
+	{
+		std::lock_guard<std::mutex> lock(this->mu);
+	}
+	this->wake.notify_one();
+	return true;
+}
+void SerialLink::printLinkState()
+{
+	cout << "Serial link:" << endl;
+	cout << "\t- Protocol: " << ((this->binary.load() == parameter::on) ? "binary frames (" : "text (")
+		<< ((this->binary.load() == parameter::on) ? DRACO_FRAME_SIZE : MAX_DATA_LENGTH) << " bytes per command)"
+		<< ((this->negotiated.load()) ? ", announced by the Arduino" : ", no hello from the Arduino")
+		<< ((SerialLink::isOpen()) ? "" : ", no port open") << endl;
+	cout << "\t- Commands: " << this->posted.load() << " posted, " << this->sent.load() << " sent (" << this->failsafes.load() << " stops), "
+		<< this->superseded.load() << " superseded before sending, " << this->rejected.load() << " rejected behind a stop, "
+		<< this->failed.load() << " failed writes" << endl;
+	if (this->queueToWire.getCount() > 0)
+		cout << "\t- Queue to wire: p50 " << this->queueToWire.percentile(0.5) << " ms, p99 " << this->queueToWire.percentile(0.99)
+			<< " ms, max " << this->queueToWire.getMax() << " ms" << endl;
+	if (this->writeTime.getCount() > 0)
+		cout << "\t- Write time: p50 " << this->writeTime.percentile(0.5) << " ms, p99 " << this->writeTime.percentile(0.99)
+			<< " ms, max " << this->writeTime.getMax() << " ms" << endl;
+	if (this->sent.load() > 0)
+		cout << "\t- Transmit delay (post to last byte on the wire): " << this->transmitDelay.load() / 1000.0 << " ms" << endl;
+	if (this->captureToWire.getCount() > 0)
+		cout << "\t- Capture to wire: p50 " << this->captureToWire.percentile(0.5) << " ms, p99 " << this->captureToWire.percentile(0.99)
+			<< " ms, max " << this->captureToWire.getMax() << " ms (" << this->captureToWire.getCount() << " commands)" << endl;
+
+	// Uplink, binary protocol only
+	unsigned long long framesSent = this->framesSent.load(), acks = this->acks.load();
+	cout << "\t- Acks: " << acks << " for " << framesSent << " frames sent";
+	if (framesSent > 0)
+		cout << " (" << 100.0 * (framesSent - std::min(framesSent, acks)) / framesSent << " % unanswered)";
+	cout << ", " << this->lostAcks.load() << " missing in the sequence, " << this->unmatchedAcks.load() << " too old to match, "
+		<< this->rejectedBytes.load() << " bytes rejected" << endl;
+	if (this->roundTrip.getCount() > 0)
+		cout << "\t- Round trip (frame written to ack received): p50 " << this->roundTrip.percentile(0.5) << " ms, p99 "
+			<< this->roundTrip.percentile(0.99) << " ms, max " << this->roundTrip.getMax() << " ms" << endl;
+	if (this->radioTime.getCount() > 0)
+		cout << "\t- Radio time on the Arduino: p50 " << this->radioTime.percentile(0.5) << " ms, p99 " << this->radioTime.percentile(0.99)
+			<< " ms, max " << this->radioTime.getMax() << " ms (" << this->radioFailures.load() << " commands not delivered, "
+			<< this->radioRetries.load() << " retries)" << endl;
+	if (this->telemetryFrames.load() > 0)
+		cout << "\t- Telemetry: battery " << this->battery.load() << " mV, link quality " << this->linkQuality.load() << "/255, "
+			<< this->radioLost.load() << " radio packets lost (" << this->telemetryFrames.load() << " frames, "
+			<< this->lostTelemetry.load() << " missing)" << endl;
+}
+uint64_t SerialLink::pack(const ControlCommand& command, bool failsafe)
+{
+	uint64_t word = MAILBOX_VALID | ((failsafe) ? MAILBOX_FAILSAFE : 0) | (mailboxTime() << MAILBOX_TIME_SHIFT);
+	for (int i = 0; i < CONTROL_CHANNELS; i++)
+	{
+		uint64_t value = static_cast<uint64_t>(std::max(0, std::min((1 << MAILBOX_CHANNEL_BITS) - 1, command.values[i] - MIN_CONTROL_VALUE)));
+		word |= value << (i * MAILBOX_CHANNEL_BITS);
+	}
+	return word;
+}
+void SerialLink::writerLoop()
+{
+	uint64_t failedStop = 0; // failsafe word being written again
+	std::chrono::steady_clock::time_point failedSince; // time of its first failed write
+	while (true)
+	{
+		uint64_t word = this->mailbox.exchange(0);
+		if (word & MAILBOX_VALID)
+		{
+			if (SerialLink::write(word) || !(word & MAILBOX_FAILSAFE))
+			{
+				failedStop = 0;
+				continue;
+			}
+			// A stop is never lost to a busy adapter: back in the mailbox over a command posted meanwhile,
+			// unless a newer stop took it, until the timeout. The loop only exits on an empty mailbox, so close waits for it too
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (word != failedStop)
+			{
+				failedStop = word;
+				failedSince = now;
+			}
+			if (std::chrono::duration<float, std::milli>(now - failedSince).count() < SERIAL_FAILSAFE_TIMEOUT)
+			{
+				uint64_t pending = this->mailbox.load();
+				do
+				{
+					if (pending & MAILBOX_FAILSAFE) break;
+				} while (!this->mailbox.compare_exchange_weak(pending, word));
+				if ((pending & MAILBOX_VALID) && !(pending & MAILBOX_FAILSAFE)) this->superseded++;
+				std::this_thread::sleep_for(std::chrono::milliseconds(SERIAL_FAILSAFE_RETRY));
+			}
+			continue;
+		}
+		// Nothing pending: the pending command was sent before stopping
+		if (!this->running.load()) break;
+		std::unique_lock<std::mutex> lock(this->mu);
+		this->wake.wait(lock, [this]() { return (this->mailbox.load() != 0) || !this->running.load(); });
+	}
+}
+bool SerialLink::write(uint64_t word)
+{
+	int values[CONTROL_CHANNELS];
+	for (int i = 0; i < CONTROL_CHANNELS; i++)
+		values[i] = MIN_CONTROL_VALUE + static_cast<int>((word >> (i * MAILBOX_CHANNEL_BITS)) & ((1u << MAILBOX_CHANNEL_BITS) - 1));
+
+	bool written;
+	bool binary = (this->binary.load() == parameter::on);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (binary)
+	{
+		uint8_t frame[DRACO_FRAME_SIZE];
+		uint16_t channels[DRACO_FRAME_CHANNELS];
+		for (int i = 0; i < DRACO_FRAME_CHANNELS; i++)
+			channels[i] = static_cast<uint16_t>(values[i]);
+		uint16_t sequence = this->frameSequence++;
+		draco_encode(frame, sequence, channels);
+		written = this->port->writeSerialPort(reinterpret_cast<char*>(frame), DRACO_FRAME_SIZE);
+		// Send time for the round trip, once the frame is out of the program
+		if (written)
+		{
+			uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+			this->sentFrames[sequence & (SERIAL_ACK_WINDOW - 1)] = (static_cast<uint64_t>(sequence) << 48) | (now & ((1ull << 48) - 1));
+			this->framesSent++;
+		}
+	}
+	else
+	{
+		ControlCommand command;
+		command.set(values[0], values[1], values[2], values[3]);
+		written = this->port->writeSerialPort(command.text, MAX_DATA_LENGTH);
+	}
+	this->writeTime.record(std::chrono::steady_clock::now() - start);
+
+	if (!written)
+	{
+		this->failed++;
+		return false;
+	}
+	this->sent++;
+	if (word & MAILBOX_FAILSAFE) this->failsafes++;
+	uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	uint64_t elapsed = ((now & MAILBOX_TIME_MASK) - (word >> MAILBOX_TIME_SHIFT)) & MAILBOX_TIME_MASK;
+	this->queueToWire.record(std::chrono::microseconds(elapsed));
+
+	// The write returns once the bytes are in the driver, the last one is on the wire 10 bits per byte later
+	// (an empty output buffer is assumed, the writer never queues more than one command)
+	unsigned int baud = this->port->getBaudRate();
+	uint64_t wire = (baud > 0) ? 10000000ull * ((binary) ? DRACO_FRAME_SIZE : MAX_DATA_LENGTH) / baud : 0;
+	long long delay = static_cast<long long>(elapsed + wire), smoothed = static_cast<long long>(this->transmitDelay.load());
+	this->transmitDelay = static_cast<unsigned int>((smoothed == 0) ? delay : smoothed + (delay - smoothed) / SERIAL_TRANSMIT_SMOOTHING);
+
+	// Capture to wire, if the command was posted with the capture time of its frame
+	uint64_t origin = this->origin.load();
+	if ((origin >> MAILBOX_TIME_SHIFT) == (word >> MAILBOX_TIME_SHIFT))
+	{
+		uint64_t total = (now + wire - origin) & ORIGIN_TIME_MASK;
+		this->captureToWire.record(std::chrono::microseconds(total));
+		this->lastCaptureToWire = static_cast<unsigned int>(std::min<uint64_t>(total, 0xFFFFFFFFull));
+	}
+	return true;
+}
+void SerialLink::readerLoop()
+{
+	const size_t mask = SERIAL_RING_SIZE - 1;
+	while (this->running.load())
+	{
+		if (!this->port->waitReadable(SERIAL_LINK_READ_TIMEOUT)) continue;
+		// Read straight into the free space of the ring, up to its end
+		size_t start = this->head & mask;
+		size_t room = std::min(SERIAL_RING_SIZE - (this->head - this->tail), SERIAL_RING_SIZE - start);
+		if (room == 0)
+		{
+			// Cannot happen while parseRing leaves less than a frame, start over if it does
+			this->rejectedBytes += this->head - this->tail;
+			this->tail = this->head;
+			continue;
+		}
+		int bytes = this->port->readSerialPort(reinterpret_cast<char*>(this->ring + start), static_cast<unsigned int>(room));
+		if (bytes <= 0) continue;
+		this->head += static_cast<size_t>(bytes);
+		SerialLink::parseRing();
+	}
+}
+void SerialLink::parseRing()
+{
+	const size_t mask = SERIAL_RING_SIZE - 1;
+	while (this->head - this->tail > 0)
+	{
+		// Skip to the next sync byte
+		if (this->ring[this->tail & mask] != DRACO_UPLINK_SYNC)
+		{
+			this->tail++;
+			this->rejectedBytes++;
+			continue;
+		}
+		if (this->head - this->tail < DRACO_UPLINK_SIZE) break;
+		draco_uplink uplink;
+		if (draco_decode_uplink(this->ring, mask, this->tail, &uplink))
+		{
+			this->tail += DRACO_UPLINK_SIZE;
+			SerialLink::handleUplink(uplink);
+		}
+		// Not a frame, the sync value was part of something else
+		else
+		{
+			this->tail++;
+			this->rejectedBytes++;
+		}
+	}
+}
+void SerialLink::handleUplink(const draco_uplink& uplink)
+{
+	// The sketch decodes the frames
+	if (uplink.type == DRACO_UPLINK_HELLO)
+	{
+		this->negotiated = true;
+		this->binary = parameter::on;
+	}
+	else if (uplink.type == DRACO_UPLINK_ACK)
+	{
+		uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+		uint64_t sentFrame = this->sentFrames[uplink.sequence & (SERIAL_ACK_WINDOW - 1)].load();
+		if ((sentFrame >> 48) == uplink.sequence)
+			this->roundTrip.record(std::chrono::microseconds((now - sentFrame) & ((1ull << 48) - 1)));
+		else
+			this->unmatchedAcks++;
+		// Acks come in order, a jump means frames or acks lost on the serial line
+		uint16_t gap = static_cast<uint16_t>(uplink.sequence - this->lastAck - 1);
+		if (this->acked && (gap < SERIAL_ACK_WINDOW)) this->lostAcks += gap;
+		this->acked = true;
+		this->lastAck = uplink.sequence;
+		this->acks++;
+		if (uplink.status == 0) this->radioFailures++;
+		this->radioRetries += uplink.value0;
+		this->radioTime.record(std::chrono::microseconds(uplink.value1));
+	}
+	else if (uplink.type == DRACO_UPLINK_TELEMETRY)
+	{
+		uint16_t gap = static_cast<uint16_t>(uplink.sequence - this->lastTelemetry - 1);
+		if (this->telemetryReceived && (gap < SERIAL_ACK_WINDOW)) this->lostTelemetry += gap;
+		this->telemetryReceived = true;
+		this->lastTelemetry = uplink.sequence;
+		this->telemetryFrames++;
+		this->battery = uplink.value0;
+		this->linkQuality = uplink.status;
+		this->radioLost = uplink.value1;
+	}
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#ifndef SERIALLINK_H
+#define SERIALLINK_H
+
+#include "stdafx.h"
+#include "VideoParameters.h"
+#include "ControlMode.h"
+#include "SerialPort.h"
+#include "LatencyMonitor.h"
+#include "draco_serial.h"
+
+#define SERIAL_LINK_READ_TIMEOUT 10 // ms, longest wait of the reader for data, bounds the time to stop it
+#define SERIAL_RING_SIZE 1024 // bytes of the receive ring buffer, a power of two
+#define SERIAL_ACK_WINDOW 256 // sent frames remembered to match acks, a power of two
+#define SERIAL_TRANSMIT_SMOOTHING 8 // writes the transmit delay estimate is averaged over
+#define SERIAL_FAILSAFE_RETRY 10 // ms between two writes of a stop command that failed
+#define SERIAL_FAILSAFE_TIMEOUT 1000 // ms a failed stop command is written again before it is dropped
+
+/*
+Class to write commands to the Arduino from a dedicated thread that owns the serial port
+Producers post into a single-slot mailbox, one 64-bit atomic word holding the four channels
+(10 bits each, offset by MIN_CONTROL_VALUE), a valid bit, a failsafe bit and the post time
+(22 bits of us, so queue-to-wire latencies wrap after 4.19 s). A post replaces the pending command,
+the writer always sends the newest one and never a stale one. A failsafe command (stop) replaces
+any pending command, and a normal command never replaces a pending failsafe one. A failsafe command
+whose write fails goes back in the mailbox and is written again for up to SERIAL_FAILSAFE_TIMEOUT ms
+Posting never allocates and only takes the mutex of the writer to wake it, so the idle writer sleeps
+until a post instead of polling. A slow or stalled adapter only delays the writer thread
+Commands are sent as text until the Arduino sends the draco_serial.h hello frame, binary frames from then on
+A reader thread receives the draco_serial.h uplink frames into a ring buffer and decodes them in place.
+Acks are matched to the send time of their command frame for the round trip, gaps in their sequence
+count as lost frames, and the last telemetry is kept for printLinkState
+The writer keeps a smoothed post to wire delay (queue, write and 10 bits per byte at the baud rate) for
+the latency compensation of the controller, and the capture to wire delay of the commands posted with
+the capture time of their frame
+*/
+class SerialLink
+{
+	public:
+		SerialLink(); // Constructor of the class
+		~SerialLink(); // destructor of the class, sends the pending command and closes the port
+
+		/*
+		@connected serial port, owned and deleted by the link
+		Starts the writer thread
+		*/
+		void open(SerialPort*);
+		void close(); // Sends the pending command (retrying a failed stop), stops the writer thread and closes the port
+		bool isOpen() { return this->port != nullptr; } // Returns true while a port is open
+
+		/*
+		@command to send
+		@true for a stop command, which preempts any pending command
+		@capture time of the frame the command was computed from, default for none
+		Posts a command for the writer, returns false if no port is open or a failsafe command is pending
+		*/
+		bool post(const ControlCommand&, bool, std::chrono::steady_clock::time_point = std::chrono::steady_clock::time_point());
+		parameter getBinary() { return this->binary.load(); } // Returns binary parameter
+
+		/*
+		@enum value to set binary to
+		Sends draco_serial.h frames (on) or text padded to MAX_DATA_LENGTH bytes (off), until the next hello frame of the Arduino
+		*/
+		void setBinary(parameter binary) { this->binary = binary; }
+		bool isNegotiated() { return this->negotiated.load(); } // Returns true once the Arduino has sent the hello frame
+		unsigned long long getSent() { return this->sent.load(); } // Returns number of commands written
+		unsigned long long getSuperseded() { return this->superseded.load(); } // Returns number of commands replaced before being written
+		unsigned long long getFailed() { return this->failed.load(); } // Returns number of failed writes
+		unsigned long long getAcks() { return this->acks.load(); } // Returns number of acks received
+		LatencyHistogram& getQueueToWire() { return this->queueToWire; } // Returns post to end of write latencies
+		LatencyHistogram& getRoundTrip() { return this->roundTrip; } // Returns frame written to ack received latencies
+		LatencyHistogram& getCaptureToWire() { return this->captureToWire; } // Returns capture to last byte on the wire latencies
+		double getLastCaptureToWire() { return this->lastCaptureToWire.load() / 1000.0; } // Returns capture to wire delay in ms of the last command posted with its capture time, 0 if none
+
+		/*
+		Returns expected time from a post to the last byte of the command on the wire, smoothed over
+		SERIAL_TRANSMIT_SMOOTHING writes, 0 before the first write
+		*/
+		std::chrono::microseconds getTransmitDelay() { return std::chrono::microseconds(this->transmitDelay.load()); }
+		void printLinkState(); // Prints commands sent, superseded and rejected, queue-to-wire latency, write time, round trip and link loss
+
+	private:
+		/*
+		@command
+		@failsafe flag
+		Returns the mailbox word of a command posted now
+		*/
+		static uint64_t pack(const ControlCommand&, bool);
+		void writerLoop(); // Routine run by the writer thread
+
+		/*
+		@mailbox word
+		Writes a command to the port, returns false if the write failed
+		*/
+		bool write(uint64_t);
+		void readerLoop(); // Routine run by the reader thread
+		void parseRing(); // Decodes the complete uplink frames of the ring buffer
+
+		/*
+		@uplink frame
+		Updates the round trip, loss and telemetry statistics
+		*/
+		void handleUplink(const draco_uplink&);
+
+		SerialPort* port; // port to the Arduino, nullptr when closed
+		std::thread thread; // writer thread
+		std::atomic<bool> running; // true while the writer thread runs
+		std::atomic<uint64_t> mailbox; // pending command, 0 if none
+		std::atomic<parameter> binary; // binary frames or text
+		std::atomic<uint64_t> origin; // post time (high 22 bits) and capture time in us (low 42 bits) of the newest command posted with a capture time
+		uint16_t frameSequence; // sequence number of the next frame, writer thread only
+		std::mutex mu; // held by the writer from checking the mailbox to sleeping, and by posts to wake it
+		std::condition_variable wake; // signaled on every post and on close
+
+		// Receive path, reader thread only
+		std::thread reader; // reader thread
+		uint8_t ring[SERIAL_RING_SIZE]; // bytes received, decoded in place
+		size_t head, tail; // bytes received and bytes consumed, the ring holds head - tail bytes
+		std::atomic<uint64_t> sentFrames[SERIAL_ACK_WINDOW]; // sequence (high 16 bits) and send time in us (low 48 bits) per frame, by sequence
+		bool acked; // true once an ack has been received
+		uint16_t lastAck, lastTelemetry; // sequence of the last ack and telemetry frame
+		bool telemetryReceived; // true once a telemetry frame has been received
+		std::atomic<bool> negotiated; // true once the Arduino has announced the binary frames
+
+		// Statistics
+		LatencyHistogram queueToWire; // post to end of the write
+		LatencyHistogram writeTime; // time spent in writeSerialPort
+		std::atomic<unsigned int> transmitDelay; // smoothed post to last byte on the wire in us
+		LatencyHistogram captureToWire; // capture of the frame to last byte of its command on the wire
+		std::atomic<unsigned int> lastCaptureToWire; // newest capture to wire delay in us
+		std::atomic<unsigned long long> posted, sent, superseded, rejected, failed, failsafes;
+		LatencyHistogram roundTrip; // end of the command write to reception of its ack
+		LatencyHistogram radioTime; // time spent by the Arduino on the radio exchange, reported in the ack
+		std::atomic<unsigned long long> framesSent; // binary frames written, the only ones acked
+		std::atomic<unsigned long long> acks, unmatchedAcks, lostAcks, radioFailures, radioRetries; // acks received, too old to match, missing in the sequence, drone not reached, radio retries
+		std::atomic<unsigned long long> telemetryFrames, lostTelemetry, rejectedBytes; // telemetry frames received and missing, bytes skipped while resynchronizing
+		std::atomic<unsigned int> battery, linkQuality, radioLost; // last telemetry: mV, 0 to 255, packets lost since boot of the Arduino
+};
+
+#endif // SERIALLINK_H
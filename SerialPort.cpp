@@ -7,10 +7,22 @@
 
 #include "stdafx.h"
 #include "SerialPort.h"
+#ifndef _WIN32
+#include <termios.h> // for tcsetattr(), cfmakeraw(), B115200...
+#include <fcntl.h> // for open(), O_NONBLOCK
+#include <unistd.h> // for read(), write(), close()
+#include <poll.h> // for poll()
+#include <glob.h> // for glob(), listing the serial devices
+#include <errno.h> // for errno, EAGAIN, EINTR
+#include <string.h> // for strerror()
+#endif
 
-SerialPort::SerialPort(char *portName)
+#ifdef _WIN32
+SerialPort::SerialPort(char *portName, unsigned int baudRate)
 {
     this->connected = false;
+    this->ready = false;
+    this->baudRate = baudRate;
 
     this->handler = CreateFileA(static_cast<LPCSTR>(portName),
                                 GENERIC_READ | GENERIC_WRITE,
@@ -40,13 +52,18 @@ SerialPort::SerialPort(char *portName)
         }
         else
 		{
-            dcbSerialParameters.BaudRate = CBR_115200;
+            dcbSerialParameters.BaudRate = baudRate;
             dcbSerialParameters.ByteSize = 8;
             dcbSerialParameters.StopBits = ONESTOPBIT;
             dcbSerialParameters.Parity = NOPARITY;
             dcbSerialParameters.fDtrControl = DTR_CONTROL_ENABLE;
 
-            if (!SetCommState(handler, &dcbSerialParameters))
+            // ReadFile returns at once with what has arrived, WriteFile gives up after SERIAL_WRITE_TIMEOUT ms
+            COMMTIMEOUTS timeouts = {0};
+            timeouts.ReadIntervalTimeout = MAXDWORD;
+            timeouts.WriteTotalTimeoutConstant = SERIAL_WRITE_TIMEOUT;
+
+            if (!SetCommState(handler, &dcbSerialParameters) || !SetCommTimeouts(this->handler, &timeouts))
             {
                 printf("ALERT: could not set Serial port parameters\n");
             }
@@ -54,7 +71,8 @@ SerialPort::SerialPort(char *portName)
 			{
                 this->connected = true;
                 PurgeComm(this->handler, PURGE_RXCLEAR | PURGE_TXCLEAR);
-                Sleep(ARDUINO_WAIT_TIME);
+                // The board resets when the port opens, go on as soon as its setup is done
+                SerialPort::waitReady(ARDUINO_WAIT_TIME);
             }
         }
     }
@@ -75,14 +93,9 @@ int SerialPort::readSerialPort(char *buffer, unsigned int buf_size)
 
     ClearCommError(this->handler, &this->errors, &this->status);
 
-    if (this->status.cbInQue > 0)
-	{
-        if (this->status.cbInQue > buf_size)
-		{
-            toRead = buf_size;
-        }
-        else toRead = this->status.cbInQue;
-    }
+    // Nothing to read, ReadFile is not called
+    if (this->status.cbInQue == 0) return 0;
+    DWORD toRead = (this->status.cbInQue > buf_size) ? buf_size : this->status.cbInQue;
 
     if (ReadFile(this->handler, buffer, toRead, &bytesRead, NULL)) return bytesRead;
 
@@ -93,15 +106,204 @@ bool SerialPort::writeSerialPort(char *buffer, unsigned int buf_size)
 {
     DWORD bytesSend;
 
-    if (!WriteFile(this->handler, (void*) buffer, buf_size, &bytesSend, 0))
+    if (!WriteFile(this->handler, (void*) buffer, buf_size, &bytesSend, 0) || (bytesSend != buf_size))
 	{
-        ClearCommError(this->handler, &this->errors, &this->status);
+        // Own error state, status and errors belong to the thread reading the port
+        COMSTAT writeStatus;
+        DWORD writeErrors;
+        ClearCommError(this->handler, &writeErrors, &writeStatus);
         return false;
     }
     else return true;
 }
 
+bool SerialPort::waitReadable(int timeout)
+{
+    // COM handles cannot be polled without overlapped I/O, the input queue is checked every ms
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    while (true)
+    {
+        ClearCommError(this->handler, &this->errors, &this->status);
+        if (this->status.cbInQue > 0) return true;
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+        Sleep(1);
+    }
+}
+
+vector<string> SerialPort::listPorts()
+{
+    vector<string> ports;
+    char target[MAX_DATA_LENGTH];
+    for (int i = 1; i <= 256; i++)
+    {
+        string name = "COM" + std::to_string(i);
+        if (QueryDosDeviceA(name.c_str(), target, MAX_DATA_LENGTH) != 0) ports.push_back(name);
+    }
+    return ports;
+}
+#else
+/*
+@baud rate
+Returns the termios speed of a baud rate, B0 if it is not supported
+*/
+static speed_t baudToSpeed(unsigned int baudRate)
+{
+    switch (baudRate)
+    {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+#ifdef B460800
+        case 460800: return B460800;
+#endif
+#ifdef B921600
+        case 921600: return B921600;
+#endif
+        default: return B0;
+    }
+}
+
+SerialPort::SerialPort(char *portName, unsigned int baudRate)
+{
+    this->connected = false;
+    this->ready = false;
+    this->baudRate = baudRate;
+
+    this->handler = open(portName, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (this->handler < 0)
+	{
+        printf("ERROR: Handle was not attached. Reason: %s not available (%s)\n", portName, strerror(errno));
+        return;
+    }
+
+    struct termios serialParameters;
+    speed_t speed = baudToSpeed(baudRate);
+    if (tcgetattr(this->handler, &serialParameters) != 0)
+	{
+        printf("failed to get current serial parameters");
+    }
+    else if (speed == B0)
+	{
+        printf("ALERT: baud rate %u not supported\n", baudRate);
+    }
+    else
+	{
+        // Raw 8N1, no flow control, DTR raised on open like on Windows
+        cfmakeraw(&serialParameters);
+        serialParameters.c_cflag |= CLOCAL | CREAD;
+        serialParameters.c_cflag &= ~(CSTOPB | CRTSCTS);
+        serialParameters.c_cc[VMIN] = 0;
+        serialParameters.c_cc[VTIME] = 0;
+        cfsetispeed(&serialParameters, speed);
+        cfsetospeed(&serialParameters, speed);
+
+        if (tcsetattr(this->handler, TCSANOW, &serialParameters) != 0)
+        {
+            printf("ALERT: could not set Serial port parameters\n");
+        }
+        else
+		{
+            this->connected = true;
+            tcflush(this->handler, TCIOFLUSH);
+            // The board resets when the port opens, go on as soon as its setup is done
+            SerialPort::waitReady(ARDUINO_WAIT_TIME);
+            return;
+        }
+    }
+    close(this->handler);
+}
+
+SerialPort::~SerialPort()
+{
+    if (this->connected)
+	{
+        this->connected = false;
+        close(this->handler);
+    }
+}
+
+int SerialPort::readSerialPort(char *buffer, unsigned int buf_size)
+{
+    ssize_t bytesRead = read(this->handler, buffer, buf_size);
+    // Nothing has arrived (EAGAIN) or the read was interrupted
+    if (bytesRead < 0) return 0;
+    return static_cast<int>(bytesRead);
+}
+
+bool SerialPort::writeSerialPort(char *buffer, unsigned int buf_size)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SERIAL_WRITE_TIMEOUT);
+    unsigned int bytesSend = 0;
+    while (bytesSend < buf_size)
+    {
+        ssize_t written = write(this->handler, buffer + bytesSend, buf_size - bytesSend);
+        if (written > 0)
+        {
+            bytesSend += static_cast<unsigned int>(written);
+            continue;
+        }
+        if ((written < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) return false;
+
+        // Output buffer full, wait until it drains
+        int remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+        if (remaining <= 0) return false;
+        struct pollfd descriptor = { this->handler, POLLOUT, 0 };
+        if ((poll(&descriptor, 1, remaining) < 0) && (errno != EINTR)) return false;
+    }
+    return true;
+}
+
+bool SerialPort::waitReadable(int timeout)
+{
+    struct pollfd descriptor = { this->handler, POLLIN, 0 };
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    while (true)
+    {
+        int remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+        int ready = poll(&descriptor, 1, std::max(remaining, 0));
+        if (ready > 0) return (descriptor.revents & POLLIN) != 0;
+        if ((ready == 0) || (errno != EINTR)) return false;
+    }
+}
+
+vector<string> SerialPort::listPorts()
+{
+    vector<string> ports;
+    const char* patterns[2] = { "/dev/ttyACM*", "/dev/ttyUSB*" };
+    for (size_t i = 0; i < 2; i++)
+    {
+        glob_t found;
+        if (glob(patterns[i], 0, NULL, &found) == 0)
+            for (size_t j = 0; j < found.gl_pathc; j++)
+                ports.push_back(found.gl_pathv[j]);
+        globfree(&found);
+    }
+    return ports;
+}
+#endif
+
+bool SerialPort::waitReady(int timeout)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    while (!this->ready)
+    {
+        // One byte at a time, nothing after the ready byte is taken from the reader
+        char byte;
+        if (SerialPort::readSerialPort(&byte, 1) == 1)
+        {
+            this->ready = (byte == ARDUINO_READY_BYTE);
+            continue;
+        }
+        int remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+        if ((remaining <= 0) || !SerialPort::waitReadable(remaining)) return false;
+    }
+    return true;
+}
+
 bool SerialPort::isConnected()
 {
     return this->connected;
-}
\ No newline at end of file
+}
@@ -9,25 +9,37 @@
 #ifndef SERIALPORT_H
 #define SERIALPORT_H
 
-#define ARDUINO_WAIT_TIME 2000
+#define ARDUINO_WAIT_TIME 2000 // ms, longest wait for the ready byte after the port is opened (reset and bootloader)
+#define ARDUINO_READY_BYTE 'k' // sent by the sketch at the end of its setup, the bytes before it are dropped
 #define MAX_DATA_LENGTH 255
+#define SERIAL_BAUD_RATE 115200 // default baud rate
+#define SERIAL_WRITE_TIMEOUT 50 // ms, longest wait for room in the output buffer of the port
 
 #include "stdafx.h"
 
+/*
+Class to exchange data with the Arduino through a serial port
+Win32 backend (COM<X>) on Windows, termios backend (/dev/ttyACM<X>, /dev/ttyUSB<X> or a pty) elsewhere
+The port is in raw mode 8N1, reads return at once with what has arrived, writes wait at most
+SERIAL_WRITE_TIMEOUT ms for the output buffer
+Opening the port resets the board: the buffers are flushed right after the open, then the bytes are
+consumed one at a time up to ARDUINO_READY_BYTE, so whatever the sketch sends after it is left for the reader
+*/
 class SerialPort
 {
 	public:
 		/*
-			@pointer to char var for port name of type COM<X> or \\\\.\\COM<XX>
+			@pointer to char var for port name of type COM<X> or \\\\.\\COM<XX>, or a device path such as /dev/ttyACM0
+			@baud rate
 			Constructor of the class, initiate communication with Arduino on a given port
 		*/
-		SerialPort(char *portName);
+		SerialPort(char *portName, unsigned int baudRate = SERIAL_BAUD_RATE);
 		~SerialPort(); // destructor of the class
 
 		/*
 			@pointer to char var to send - string to char*: &string[0u]
 			@buffer size, use MAX_DATA_LENGTH defined here
-			Function to read from the serial port
+			Function to read from the serial port, returns the number of bytes read, 0 if nothing has arrived
 		*/
 		int readSerialPort(char *buffer, unsigned int buf_size);
 
@@ -38,17 +50,41 @@ class SerialPort
 		*/
 		bool writeSerialPort(char *buffer, unsigned int buf_size);
 
+		/*
+			@timeout in ms
+			Waits until data can be read, returns false on timeout
+		*/
+		bool waitReadable(int timeout);
+
+		/*
+			@timeout in ms
+			Consumes the bytes up to ARDUINO_READY_BYTE, returns false on timeout
+		*/
+		bool waitReady(int timeout);
+
 		/*
 			Boolean function, returns true if arduino is connected
 		*/
 		bool isConnected();
+		bool isReady() { return this->ready; } // Returns true once the ready byte of the sketch was received
+		unsigned int getBaudRate() { return this->baudRate; } // Returns baud rate the port was opened at
+
+		/*
+			Returns the names of the serial ports present on the system
+		*/
+		static vector<string> listPorts();
 
 	private:
-		HANDLE handler;
 		bool connected;
+		bool ready; // true once ARDUINO_READY_BYTE was received
+		unsigned int baudRate; // bits per second, 10 per byte in 8N1
+#ifdef _WIN32
+		HANDLE handler;
 		COMSTAT status;
 		DWORD errors;
-		unsigned int toRead;
+#else
+		int handler; // file descriptor of the port
+#endif
 };
 
-#endif // SERIALPORT_H
\ No newline at end of file
+#endif // SERIALPORT_H
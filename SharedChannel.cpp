@@ -0,0 +1,178 @@
+#include "stdafx.h"
+#include "SharedChannel.h"
+#ifndef _WIN32
+#include <sys/mman.h> // for shm_open(), mmap()
+#include <fcntl.h> // for O_CREAT, O_RDWR
+#include <unistd.h> // for ftruncate(), close(), getpid()
+#include <signal.h> // for kill()
+#include <errno.h> // for errno, EEXIST, EPERM
+#include <sys/stat.h> // for fstat()
+#endif
+
+// Shared channel
+SharedChannel::SharedChannel()
+{
+	this->channel = nullptr;
+#ifdef _WIN32
+	this->mapping = NULL;
+#else
+	this->fd = -1;
+#endif
+	this->lastCommand = this->lastPose = 0;
+	this->lastRoundTrip = this->totalRoundTrip = this->maxRoundTrip = 0;
+	this->roundTrips = this->staleCommands = 0;
+}
+SharedChannel::~SharedChannel()
+{
+	SharedChannel::close();
+}
+bool SharedChannel::open()
+{
+	if (this->channel != nullptr) return true;
+
+	void* address = nullptr;
+	bool created = true; // false if the segment was already there
+#ifdef _WIN32
+	this->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(draco_channel), DRACO_CHANNEL_NAME);
+	if (this->mapping == NULL) return false;
+	created = (GetLastError() != ERROR_ALREADY_EXISTS);
+	address = MapViewOfFile(this->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(draco_channel));
+	if (address == NULL)
+	{
+		CloseHandle(this->mapping);
+		this->mapping = NULL;
+		return false;
+	}
+#else
+	this->fd = shm_open(DRACO_CHANNEL_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if ((this->fd < 0) && (errno == EEXIST))
+	{
+		created = false;
+		this->fd = shm_open(DRACO_CHANNEL_NAME, O_RDWR, 0600);
+	}
+	if (this->fd < 0) return false;
+	// Only a segment created here is sized, an existing one is mapped as it is and its owner checked first.
+	// A smaller one is still being sized by the DRACO that created it, or isn't a DRACO channel
+	struct stat status;
+	if (created && (ftruncate(this->fd, sizeof(draco_channel)) != 0))
+		address = MAP_FAILED;
+	else if (!created && ((fstat(this->fd, &status) != 0) || (status.st_size < static_cast<off_t>(sizeof(draco_channel)))))
+		address = MAP_FAILED;
+	else
+		address = mmap(NULL, sizeof(draco_channel), PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+	if (address == MAP_FAILED)
+	{
+		::close(this->fd);
+		// A segment that was already there may belong to another DRACO, it is never removed
+		if (created) shm_unlink(DRACO_CHANNEL_NAME);
+		this->fd = -1;
+		return false;
+	}
+#endif
+	this->channel = static_cast<draco_channel*>(address);
+
+	// Segment of another DRACO still running, left as it is. One left behind by a DRACO that exited is taken over
+	if (!created && (this->channel->magic == DRACO_CHANNEL_MAGIC) && SharedChannel::isOwnerRunning(this->channel->owner))
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(this->channel);
+		CloseHandle(this->mapping);
+		this->mapping = NULL;
+#else
+		munmap(this->channel, sizeof(draco_channel));
+		::close(this->fd);
+		this->fd = -1;
+#endif
+		this->channel = nullptr;
+		return false;
+	}
+
+	// Fresh segment, a client attached to an older DRACO sees the magic disappear
+	this->channel->magic = 0;
+	DRACO_BARRIER();
+	memset(&this->channel->pose, 0, sizeof(draco_pose_record));
+	memset(&this->channel->command, 0, sizeof(draco_command_record));
+	this->channel->version = DRACO_CHANNEL_VERSION;
+#ifdef _WIN32
+	this->channel->owner = static_cast<uint32_t>(GetCurrentProcessId());
+#else
+	this->channel->owner = static_cast<uint32_t>(getpid());
+#endif
+	DRACO_BARRIER();
+	this->channel->magic = DRACO_CHANNEL_MAGIC;
+	this->lastCommand = this->lastPose = 0;
+	return true;
+}
+void SharedChannel::close()
+{
+	if (this->channel == nullptr) return;
+
+	// Attached clients see the channel is gone
+	this->channel->magic = 0;
+#ifdef _WIN32
+	UnmapViewOfFile(this->channel);
+	CloseHandle(this->mapping);
+	this->mapping = NULL;
+#else
+	munmap(this->channel, sizeof(draco_channel));
+	::close(this->fd);
+	shm_unlink(DRACO_CHANNEL_NAME);
+	this->fd = -1;
+#endif
+	this->channel = nullptr;
+}
+bool SharedChannel::isOwnerRunning(uint32_t owner)
+{
+#ifdef _WIN32
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(owner));
+	if (process == NULL) return false;
+	bool running = (WaitForSingleObject(process, 0) == WAIT_TIMEOUT);
+	CloseHandle(process);
+	return running;
+#else
+	// The process exists, even if it belongs to another user
+	return (owner != 0) && ((kill(static_cast<pid_t>(owner), 0) == 0) || (errno == EPERM));
+#endif
+}
+void SharedChannel::publishPose(draco_pose_record& pose, std::chrono::steady_clock::time_point capture)
+{
+	if (this->channel == nullptr) return;
+
+	pose.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(capture.time_since_epoch()).count();
+	draco_write_pose(this->channel, &pose);
+	this->lastPose = this->channel->pose.sequence;
+	this->lastPublished = std::chrono::steady_clock::now();
+}
+bool SharedChannel::readCommand(draco_command_record& command)
+{
+	if (this->channel == nullptr) return false;
+	if (!draco_read_command(this->channel, &command) || (command.sequence == this->lastCommand)) return false;
+	this->lastCommand = command.sequence;
+
+	// Round trip of the newest pose only, older poses were already answered or skipped by the controller
+	if (command.pose_sequence == this->lastPose)
+	{
+		this->lastRoundTrip = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->lastPublished).count();
+		this->totalRoundTrip += this->lastRoundTrip;
+		if (this->lastRoundTrip > this->maxRoundTrip) this->maxRoundTrip = this->lastRoundTrip;
+		this->roundTrips++;
+	}
+	else
+		this->staleCommands++;
+	return true;
+}
+void SharedChannel::printChannelState()
+{
+	cout << "Controller channel:" << endl;
+	if (this->channel == nullptr)
+	{
+		cout << "\t- Shared memory: closed" << endl;
+		return;
+	}
+	cout << "\t- Shared memory: " << DRACO_CHANNEL_NAME << endl;
+	cout << "\t- Poses published: " << this->lastPose << ", commands read: " << this->lastCommand
+		<< " (" << this->staleCommands << " computed from an older pose)" << endl;
+	if (this->roundTrips > 0)
+		cout << "\t- Pose to command round trip: last " << this->lastRoundTrip << " ms, mean " << this->totalRoundTrip / this->roundTrips
+			<< " ms, max " << this->maxRoundTrip << " ms" << endl;
+}
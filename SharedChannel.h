@@ -0,0 +1,68 @@
+#pragma once
+
+#ifndef SHAREDCHANNEL_H
+#define SHAREDCHANNEL_H
+
+#include "stdafx.h"
+#define DRACO_CHANNEL_NO_CLIENT // DRACO creates the segment itself, see SharedChannel.cpp
+#include "draco_channel.h"
+
+/*
+Class to exchange the pose and the commands with an external controller through shared memory
+DRACO owns the segment described in draco_channel.h: it creates it, publishes a pose per processed
+frame and reads the commands written back. Both records are sequence locked, nothing blocks and no
+file is opened, so a command is picked up microseconds after the controller wrote it
+*/
+class SharedChannel
+{
+	public:
+		SharedChannel(); // Constructor of the class
+		~SharedChannel(); // destructor of the class, unmaps and removes the segment
+
+		/*
+		Creates and maps the segment, returns false if the system refused it or another DRACO still runs on it
+		A segment left behind by a DRACO that exited is taken over and initialized again
+		*/
+		bool open();
+		void close(); // Unmaps and removes the segment
+		bool isOpen() { return this->channel != nullptr; } // Returns true while the segment is mapped
+
+		/*
+		@pose to publish, lock and sequence are set here
+		@capture time of the frame the pose comes from
+		Publishes a pose to the controller
+		*/
+		void publishPose(draco_pose_record&, std::chrono::steady_clock::time_point);
+
+		/*
+		@command out
+		Returns true if the controller wrote a command since last call
+		*/
+		bool readCommand(draco_command_record&);
+		void printChannelState(); // Prints number of poses and commands exchanged, and round trip time
+
+	private:
+		/*
+		@process ID of the DRACO that initialized the segment
+		Returns true if that process is still running
+		*/
+		static bool isOwnerRunning(uint32_t);
+
+		draco_channel* channel; // mapped segment, nullptr if not open
+#ifdef _WIN32
+		HANDLE mapping; // file mapping of the segment
+#else
+		int fd; // shared memory object of the segment
+#endif
+
+		uint64_t lastCommand; // sequence of the last command read
+		uint64_t lastPose; // sequence of the last pose published
+		std::chrono::steady_clock::time_point lastPublished; // time the last pose was published
+
+		// Time from the publication of a pose to the reception of the command computed from it, in ms
+		double lastRoundTrip, totalRoundTrip, maxRoundTrip;
+		unsigned long long roundTrips; // commands answering the last pose
+		unsigned long long staleCommands; // commands computed from an older pose
+};
+
+#endif // SHAREDCHANNEL_H
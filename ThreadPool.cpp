@@ -0,0 +1,113 @@
+#include "stdafx.h"
+#include "ThreadPool.h"
+
+// Thread pool
+ThreadPool::ThreadPool(unsigned int threads)
+{
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	this->task = nullptr;
+	this->pending = 0;
+	this->generation = 0;
+	this->running = true;
+
+	for (unsigned int i = 0; i < threads; i++)
+		this->queues.push_back(new WorkQueue);
+	// Queue 0 belongs to the calling thread
+	for (unsigned int i = 1; i < threads; i++)
+		this->workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+ThreadPool::~ThreadPool()
+{
+	ThreadPool::mu.lock();
+	this->running = false;
+	ThreadPool::mu.unlock();
+	this->wake.notify_all();
+	for (size_t i = 0; i < this->workers.size(); i++)
+		this->workers.at(i).join();
+	for (size_t i = 0; i < this->queues.size(); i++)
+		delete this->queues.at(i);
+}
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& function)
+{
+	if (count <= 0) return;
+	// Nothing to share
+	if ((count == 1) || (this->queues.size() == 1))
+	{
+		for (int i = 0; i < count; i++)
+			function(i);
+		return;
+	}
+
+	std::lock_guard<std::mutex> loopLock(this->loopMu);
+	this->task = &function;
+	this->pending = count;
+	// Contiguous tasks per queue, neighbouring tiles share cache lines of the frame
+	unsigned int threads = static_cast<unsigned int>(this->queues.size());
+	for (unsigned int q = 0; q < threads; q++)
+	{
+		std::lock_guard<std::mutex> queueLock(this->queues.at(q)->mu);
+		for (int i = static_cast<int>(q * count / threads); i < static_cast<int>((q + 1) * count / threads); i++)
+			this->queues.at(q)->indexes.push_back(i);
+	}
+
+	ThreadPool::mu.lock();
+	this->generation++;
+	ThreadPool::mu.unlock();
+	this->wake.notify_all();
+
+	// Work as well, then wait for the tasks stolen by the workers
+	while (ThreadPool::runTask(0)) { ; }
+	std::unique_lock<std::mutex> lock(this->mu);
+	this->done.wait(lock, [this] { return this->pending.load() == 0; });
+	this->task = nullptr;
+}
+void ThreadPool::workerLoop(unsigned int self)
+{
+	unsigned long long seen = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(this->mu);
+			this->wake.wait(lock, [this, seen] { return !this->running || (this->generation != seen); });
+			if (!this->running) return;
+			seen = this->generation;
+		}
+		while (ThreadPool::runTask(self)) { ; }
+	}
+}
+bool ThreadPool::runTask(unsigned int self)
+{
+	int index = -1;
+	// Own queue first, newest task
+	{
+		WorkQueue* queue = this->queues.at(self);
+		std::lock_guard<std::mutex> lock(queue->mu);
+		if (!queue->indexes.empty())
+		{
+			index = queue->indexes.back();
+			queue->indexes.pop_back();
+		}
+	}
+	// Steal the oldest task of another thread
+	for (size_t i = 1; (index < 0) && (i < this->queues.size()); i++)
+	{
+		WorkQueue* victim = this->queues.at((self + i) % this->queues.size());
+		std::lock_guard<std::mutex> lock(victim->mu);
+		if (!victim->indexes.empty())
+		{
+			index = victim->indexes.front();
+			victim->indexes.pop_front();
+		}
+	}
+	if (index < 0) return false;
+
+	(*this->task)(index);
+	// Last task of the loop
+	if (this->pending.fetch_sub(1) == 1)
+	{
+		ThreadPool::mu.lock();
+		ThreadPool::mu.unlock();
+		this->done.notify_all();
+	}
+	return true;
+}
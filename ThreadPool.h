@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "stdafx.h"
+
+// Queue of task indexes owned by one thread of the pool
+struct WorkQueue
+{
+	std::mutex mu; // protects the indexes
+	std::deque<int> indexes; // tasks left, the owner takes from the back, other threads steal from the front
+};
+
+/*
+Class to run short parallel loops on a fixed set of threads
+Tasks of a loop are spread over one queue per thread, and a thread that runs out of tasks
+steals from the others, so uneven tasks (e.g. image tiles with or without markers) still
+keep every core busy. The thread calling parallelFor works on the first queue
+*/
+class ThreadPool
+{
+	public:
+		/*
+		@number of threads, the calling thread included (0 for one per core)
+		Constructor of the class, starts the worker threads
+		*/
+		ThreadPool(unsigned int);
+		~ThreadPool(); // destructor of the class, stops the worker threads
+		unsigned int getThreads() { return static_cast<unsigned int>(this->queues.size()); } // Returns number of threads, the calling thread included
+
+		/*
+		@number of tasks
+		@task, called with an index from 0 to the number of tasks - 1
+		Runs the tasks on all threads and returns when they are done
+		*/
+		void parallelFor(int, const std::function<void(int)>&);
+
+	private:
+		/*
+		@index of the queue of the thread
+		Routine run by the worker threads
+		*/
+		void workerLoop(unsigned int);
+
+		/*
+		@index of the queue of the thread
+		Runs one task from the own queue, or stolen from another one, returns false if none is left
+		*/
+		bool runTask(unsigned int);
+
+		vector<WorkQueue*> queues; // one queue per thread, 0 is the calling thread
+		vector<std::thread> workers; // worker threads
+		const std::function<void(int)>* task; // task of the current loop
+		std::atomic<int> pending; // tasks of the current loop not finished yet
+		unsigned long long generation; // number of loops started, wakes the workers
+		bool running; // false when the workers have to exit
+
+		std::mutex mu; // protects generation and running
+		std::mutex loopMu; // one loop at a time
+		std::condition_variable wake; // signals a new loop to the workers
+		std::condition_variable done; // signals the end of the loop to the calling thread
+};
+
+#endif // THREADPOOL_H
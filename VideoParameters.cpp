@@ -125,12 +125,12 @@ int VideoParameters::startCalibration()
 	cout << "Calibration done." << endl;
 	return 1;
 }
-bool VideoParameters::loadCameraCalibration()
+bool VideoParameters::loadCameraCalibration(string fileName)
 {
 	cout << "Loading calibration file . . ." << endl;
 	//cv::Size chessBoard = cv::Size(6, 9);
 
-	std::ifstream inStream(CALIBDATA_FILE);
+	std::ifstream inStream(fileName);
 	if (inStream)
 	{
 		uint16_t rows;
@@ -171,6 +171,14 @@ bool VideoParameters::loadCameraCalibration()
 	}
 	else return false;
 }
+bool VideoParameters::loadCameraCalibrationOrIdeal(string fileName)
+{
+	if (VideoParameters::loadCameraCalibration(fileName)) return true;
+	cout << "No calibration file, using an ideal camera." << endl;
+	this->cameraMatrix = (cv::Mat_<double>(3, 3) << 800, 0, 320, 0, 800, 240, 0, 0, 1);
+	this->distanceCoeff = cv::Mat::zeros(5, 1, CV_64F);
+	return false;
+}
 bool VideoParameters::saveCameraCalibration()
 {
 	cout << "Saving calibration . . ." << endl;
@@ -8,6 +8,7 @@
 #define CALIBRATION_SQUARE_DIM 0.026f // length of a square on the chess board used for calibration
 #define CHESS_BOARD_DIM cv::Size(6, 9) // number of squares on the chessboard
 #define QR_CODE_SIZE 0.066f // size of the side of the QR code
+#define DETECTION_SCALE 2 // markers are searched at 1/DETECTION_SCALE resolution (1, 2 or 4), corners are refined at full resolution
 #define CALIBDATA_FILE "calibdata.txt" // name of the calibration file
 #define WEBCAM_WINDOW "Webcam feed" // name of webcam window
 
@@ -51,7 +52,18 @@ class VideoParameters
 		*/
 		void setParameter(string, parameter);	
 		int startCalibration(); // Creates a calibration textfile with parameters for the distance coefficients.
-		bool loadCameraCalibration(); // Loads the calibration textfile with parameters for the distance coefficients.
+		/*
+		@name of the calibration file (CALIBDATA_FILE)
+		Loads the calibration textfile with parameters for the distance coefficients.
+		*/
+		bool loadCameraCalibration(string = CALIBDATA_FILE);
+
+		/*
+		@name of the calibration file (CALIBDATA_FILE)
+		Loads the calibration file, or an ideal 640x480 camera without distortion if there is none
+		Returns true if the calibration file was loaded
+		*/
+		bool loadCameraCalibrationOrIdeal(string = CALIBDATA_FILE);
 		bool saveCameraCalibration(); // Saves calibration to file
 
 		/*
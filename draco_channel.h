@@ -0,0 +1,301 @@
+/*
+	draco_channel.h : C client of the shared-memory channel between DRACO and an external controller
+	(MATLAB MEX, Python ctypes, C...). Self-contained, include it alone in the client
+
+	DRACO creates the segment and publishes the pose of the drone on every processed frame,
+	the controller writes throttle, roll, pitch and yaw back. Each record is protected by a
+	sequence lock: the writer makes the counter odd, writes, then makes it even again, and a
+	reader retries until it copied the record between two equal even counters. Neither side
+	ever blocks the other, and each record has a single writer
+
+	Typical client loop:
+		draco_client client;
+		if (draco_attach(&client) != 0) return;
+		draco_pose_record pose;
+		uint64_t last = 0;
+		while (running)
+		{
+			if (draco_read_pose(client.channel, &pose) && (pose.sequence != last))
+			{
+				last = pose.sequence;
+				draco_command_record command = { 0 };
+				command.pose_sequence = pose.sequence;
+				command.throttle = ...; command.roll = ...; command.pitch = ...; command.yaw = ...;
+				draco_write_command(client.channel, &command);
+			}
+		}
+		draco_detach(&client);
+*/
+
+#pragma once
+
+#ifndef DRACO_CHANNEL_H
+#define DRACO_CHANNEL_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+Define DRACO_CHANNEL_NO_CLIENT before including to get the layout and the sequence lock only,
+without draco_attach/draco_detach and the POSIX headers they need (unistd.h declares pause())
+*/
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#ifndef DRACO_CHANNEL_NO_CLIENT
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#endif
+
+#define DRACO_CHANNEL_MAGIC 0x4F434144u // "DACO" in memory, marks an initialized segment
+#define DRACO_CHANNEL_VERSION 2u // incremented when the layout changes
+#ifdef _WIN32
+#define DRACO_CHANNEL_NAME "Local\\draco_channel" // name of the file mapping
+#else
+#define DRACO_CHANNEL_NAME "/draco_channel" // name of the POSIX shared memory object
+#endif
+#define DRACO_READ_ATTEMPTS 64 // retries of a read overlapping a write before giving up
+
+// Full memory barrier, orders the counter of a record with its content
+#if defined(_MSC_VER)
+#define DRACO_BARRIER() MemoryBarrier()
+#else
+#define DRACO_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pose published by DRACO, one per processed frame
+typedef struct
+{
+	volatile uint32_t lock; // sequence lock, odd while the record is written
+	uint32_t detected; // 1 if the drone was found on the frame, the pose is the last known one otherwise
+	uint64_t sequence; // number of the pose, incremented on every write
+	int64_t timestamp; // capture time of the frame in us, same clock as draco_now()
+	int64_t horizon; // us the pose was predicted forward from timestamp by the latency compensation, 0 if not compensated
+	int32_t state; // system state: 0 stop, 1 start, 2 pause, 3 idle
+	int32_t mode; // 0 manual, 1 automatic
+	int32_t regulator; // 0 off, 1 PID, 2 MPC
+	int32_t filter; // 0 off, 1 Kalman
+	double translation[3]; // x, y, z of the drone in m
+	double rotation[3]; // rotation vector of the drone (axis * angle)
+	double setpoint[3]; // x, y, z setpoint in m
+} draco_pose_record;
+
+// Command written by the external controller
+typedef struct
+{
+	volatile uint32_t lock; // sequence lock, odd while the record is written
+	uint32_t reserved;
+	uint64_t sequence; // number of the command, incremented on every write
+	uint64_t pose_sequence; // sequence of the pose the command was computed from
+	int64_t timestamp; // time the command was written in us, same clock as draco_now()
+	int32_t throttle, roll, pitch, yaw; // control values, 1000 to 2000
+} draco_command_record;
+
+// Layout of the segment, records on their own cache lines so both sides never share one
+typedef struct
+{
+	uint32_t magic; // DRACO_CHANNEL_MAGIC once DRACO initialized the segment
+	uint32_t version; // DRACO_CHANNEL_VERSION
+	uint32_t owner; // process ID of the DRACO that initialized the segment
+	uint8_t padding0[52];
+	draco_pose_record pose;
+	uint8_t padding1[64 - sizeof(draco_pose_record) % 64];
+	draco_command_record command;
+} draco_channel;
+
+// Mapping of the segment in a client
+typedef struct
+{
+	draco_channel* channel; // mapped segment, NULL if not attached
+#ifdef _WIN32
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+} draco_client;
+
+/*
+Returns the time in us on the monotonic clock DRACO timestamps with (std::chrono::steady_clock)
+*/
+static inline int64_t draco_now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (int64_t)((counter.QuadPart / frequency.QuadPart) * 1000000 + (counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+/*
+@lock of the record
+Starts a write, the lock is odd until draco_end_write
+*/
+static inline void draco_begin_write(volatile uint32_t* lock)
+{
+	*lock = *lock + 1;
+	DRACO_BARRIER();
+}
+
+/*
+@lock of the record
+Ends a write, the lock is even again
+*/
+static inline void draco_end_write(volatile uint32_t* lock)
+{
+	DRACO_BARRIER();
+	*lock = *lock + 1;
+}
+
+/*
+@lock of the record
+@record to copy
+@copy out
+@size of the record
+Copies a record written concurrently, returns 1 if the copy is consistent, 0 if every attempt overlapped a write
+*/
+static inline int draco_read(volatile uint32_t* lock, const void* record, void* copy, size_t size)
+{
+	int attempt;
+	for (attempt = 0; attempt < DRACO_READ_ATTEMPTS; attempt++)
+	{
+		uint32_t before = *lock;
+		if (before & 1u) continue;
+		DRACO_BARRIER();
+		memcpy(copy, record, size);
+		DRACO_BARRIER();
+		if (*lock == before) return 1;
+	}
+	return 0;
+}
+
+/*
+@channel
+@pose out
+Copies the last pose, returns 1 on success
+*/
+static inline int draco_read_pose(draco_channel* channel, draco_pose_record* pose)
+{
+	return draco_read(&channel->pose.lock, &channel->pose, pose, sizeof(draco_pose_record));
+}
+
+/*
+@channel
+@pose to publish, lock and sequence are set here
+Publishes a pose, only called by DRACO
+*/
+static inline void draco_write_pose(draco_channel* channel, const draco_pose_record* pose)
+{
+	uint64_t sequence = channel->pose.sequence + 1;
+	draco_begin_write(&channel->pose.lock);
+	memcpy((char*)&channel->pose + sizeof(uint32_t), (const char*)pose + sizeof(uint32_t), sizeof(draco_pose_record) - sizeof(uint32_t));
+	channel->pose.sequence = sequence;
+	draco_end_write(&channel->pose.lock);
+}
+
+/*
+@channel
+@command out
+Copies the last command, returns 1 on success
+*/
+static inline int draco_read_command(draco_channel* channel, draco_command_record* command)
+{
+	return draco_read(&channel->command.lock, &channel->command, command, sizeof(draco_command_record));
+}
+
+/*
+@channel
+@command to send, lock, sequence and timestamp are set here
+Publishes a command, only called by the controller
+*/
+static inline void draco_write_command(draco_channel* channel, const draco_command_record* command)
+{
+	uint64_t sequence = channel->command.sequence + 1;
+	int64_t timestamp = draco_now();
+	draco_begin_write(&channel->command.lock);
+	memcpy((char*)&channel->command + sizeof(uint32_t), (const char*)command + sizeof(uint32_t), sizeof(draco_command_record) - sizeof(uint32_t));
+	channel->command.sequence = sequence;
+	channel->command.timestamp = timestamp;
+	draco_end_write(&channel->command.lock);
+}
+
+#ifndef DRACO_CHANNEL_NO_CLIENT
+/*
+@client out
+Maps the segment created by DRACO, returns 0 on success, -1 if DRACO is not running or its version differs
+*/
+static inline int draco_attach(draco_client* client)
+{
+	client->channel = NULL;
+#ifdef _WIN32
+	client->mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, DRACO_CHANNEL_NAME);
+	if (client->mapping == NULL) return -1;
+	client->channel = (draco_channel*)MapViewOfFile(client->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(draco_channel));
+	if (client->channel == NULL)
+	{
+		CloseHandle(client->mapping);
+		return -1;
+	}
+#else
+	void* address;
+	client->fd = shm_open(DRACO_CHANNEL_NAME, O_RDWR, 0);
+	if (client->fd < 0) return -1;
+	address = mmap(NULL, sizeof(draco_channel), PROT_READ | PROT_WRITE, MAP_SHARED, client->fd, 0);
+	if (address == MAP_FAILED)
+	{
+		close(client->fd);
+		return -1;
+	}
+	client->channel = (draco_channel*)address;
+#endif
+	DRACO_BARRIER();
+	if ((client->channel->magic != DRACO_CHANNEL_MAGIC) || (client->channel->version != DRACO_CHANNEL_VERSION))
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(client->channel);
+		CloseHandle(client->mapping);
+#else
+		munmap(client->channel, sizeof(draco_channel));
+		close(client->fd);
+#endif
+		client->channel = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+@client
+Unmaps the segment
+*/
+static inline void draco_detach(draco_client* client)
+{
+	if (client->channel == NULL) return;
+#ifdef _WIN32
+	UnmapViewOfFile(client->channel);
+	CloseHandle(client->mapping);
+#else
+	munmap(client->channel, sizeof(draco_channel));
+	close(client->fd);
+#endif
+	client->channel = NULL;
+}
+#endif // DRACO_CHANNEL_NO_CLIENT
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DRACO_CHANNEL_H
@@ -12,17 +12,50 @@
 
 #include "stdafx.h"
 #include "Process.h"
+#include "Benchmark.h"
+#include "SceneGenerator.h"
 
 // main function
-int main()
+int main(int argc, char* argv[])
 {
 	// Set console title to DRACO
+#ifdef _WIN32
 	SetConsoleTitle(TEXT("DRACO"));
+#else
+	cout << "\033]0;DRACO\007";
+#endif
 	cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
 	cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
 	cout << "\t\t\t\tDRACO\tDrone Regulation with AruCO" << endl;
 	cout << "-----------------------------------------------------------------------------------------------------------------" << endl;
 	cout << "-----------------------------------------------------------------------------------------------------------------" << endl << endl;
+	// Run a benchmark instead of the control program: DRACO bench <name>
+	if ((argc >= 3) && (string(argv[1]) == "bench"))
+	{
+		Benchmark benchmark;
+		return (benchmark.run(argv[2])) ? 0 : 1;
+	}
+	// Render a synthetic sequence with ground truth: DRACO scene <prefix> [hover|orbit|approach] [frames]
+	if ((argc >= 3) && (string(argv[1]) == "scene"))
+	{
+		sceneTrajectory trajectory = sceneTrajectory::orbit;
+		if (argc >= 4)
+		{
+			if (string(argv[3]) == "hover") trajectory = sceneTrajectory::hover;
+			else if (string(argv[3]) == "approach") trajectory = sceneTrajectory::approach;
+		}
+		int frames = (argc >= 5) ? std::atoi(argv[4]) : 300;
+		SceneGenerator generator(BENCH_DISTRACTORS, 1);
+		int written = generator.writeSequence(argv[2], trajectory, frames);
+		cout << written << " frames written, replay with: DRACO replay " << argv[2] << "_%04d.png" << endl;
+		return (written == frames) ? 0 : 1;
+	}
+	// Run the vision pipeline on a recording, without console, window nor serial port: DRACO replay <path> [realtime]
+	if ((argc >= 3) && (string(argv[1]) == "replay"))
+	{
+		Process replay(argv[2], (argc >= 4) && (string(argv[3]) == "realtime"));
+		return 0;
+	}
 	// Initialize process
 	Process* process_control;
 	// Default values are passsed to the constructor of the class, and threads are initiated
@@ -3,6 +3,38 @@
 // stdafx.obj will contain the pre-compiled type information
 
 #include "stdafx.h"
+#ifndef _WIN32
+#include <termios.h> // for tcgetattr(), tcsetattr()
+#include <poll.h> // for poll()
+#include <stdlib.h> // for atexit()
+
+static struct termios savedConsole; // line input settings of the terminal while _kbhit polls keys
+static bool polling = false; // true while the terminal is out of canonical mode
+
+int _kbhit()
+{
+	// Keys are available without ENTER while the terminal is out of canonical mode, they stay in the input for the next read
+	// The mode is switched once, on the first call, and kept until restoreConsole
+	if (!polling)
+	{
+		if (tcgetattr(0, &savedConsole) != 0) return 0;
+		struct termios raw = savedConsole;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		if (tcsetattr(0, TCSANOW, &raw) != 0) return 0;
+		static bool registered = false;
+		if (!registered) registered = (atexit(restoreConsole) == 0);
+		polling = true;
+	}
+	struct pollfd input = { 0, POLLIN, 0 };
+	return (poll(&input, 1, 0) > 0) ? 1 : 0;
+}
+void restoreConsole()
+{
+	if (!polling) return;
+	tcsetattr(0, TCSANOW, &savedConsole);
+	polling = false;
+}
+#endif
 
 // TODO: reference any additional headers you need in STDAFX.H
 // and not in this file
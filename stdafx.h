@@ -10,11 +10,15 @@
 /*
 GENERAL HEADERS
 */
+#ifdef _WIN32
 #include "targetver.h"
-#include <stdlib.h> // for std::atoi(), std::stoi(), std::rand()
 #include <windows.h> // for DWORD, HANDLE, COMSTAT, DCB, Windows OS specific header
+#endif
+#include <stdlib.h> // for std::atoi(), std::stoi(), std::rand()
 #include <time.h> // for clock(), clock_t
 #include <locale> // for std::isalpha()
+#include <algorithm> // for std::min(), std::max(), std::find()
+#include <random> // for std::mt19937, random scenes in benchmarks
 
 /*
 DATA STREAM RELATED HEADERS
@@ -24,12 +28,13 @@ DATA STREAM RELATED HEADERS
 #include <fstream> // for std::ofstream, std::ifstream
 
 // OpenCV specific headers
-#include <opencv2\core.hpp>
-#include <opencv2\highgui.hpp>
-#include <opencv2\aruco.hpp>
-#include <opencv2\ccalib.hpp>
-//#include <opencv2\calib3d.hpp> // used?
-//#include <opencv2\imgcodecs.hpp> // used?
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/aruco.hpp>
+#include <opencv2/ccalib.hpp>
+//#include <opencv2/calib3d.hpp> // used?
+//#include <opencv2/imgcodecs.hpp> // used?
 
 // Including OpenCV to any project in Visual Studio:
 /*
@@ -54,13 +59,28 @@ DATA TYPE HEADERS
 */
 #include <string> // for std::string
 #include <vector> // for std::vector
+#include <deque> // for std::deque
+#include <map> // for std::map
+#include <functional> // for std::function
+#include <memory> // for std::shared_ptr, undistortion grids shared between pose solvers
+#include <charconv> // for std::to_chars(), std::from_chars()
+#ifdef _WIN32
 #include <conio.h> // for getline() and _getch()
+inline void restoreConsole() {} // Line input is never left on Windows
+#else
+int _kbhit(); // Returns non-zero if a key has been pressed, POSIX terminals, defined in stdafx.cpp
+void restoreConsole(); // Ends the key polling started by _kbhit, the terminal is back to line input
+#endif
 
 /*
 THREAD RELATED HEADERS
 */
 #include <thread> // to handle std::threads
 #include <mutex> // to handle std::mutex
+#include <shared_mutex> // for std::shared_mutex, readers of the drone registry
+#include <condition_variable> // for std::condition_variable
+#include <atomic> // for std::atomic, lock-free data shared between threads
+#include <chrono> // for std::chrono::steady_clock
 
 /*
 FREQUENTLY USED FUNCTION CALLS FROM STD NAMESPACE